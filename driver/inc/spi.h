@@ -171,6 +171,10 @@ void Spi_SetCS(boolean_t bFlag);
 en_result_t Spi_SendData(uint8_t u8Data);
 //SPI 接收数据
 uint8_t Spi_ReceiveData(void);
+//SPI 连续收发/发送/接收
+en_result_t Spi_TransferBuf(const uint8_t* pu8TxBuf, uint8_t* pu8RxBuf, uint32_t u32Len);
+en_result_t Spi_SendBuf(const uint8_t* pu8Buf, uint32_t u32Len);
+en_result_t Spi_ReceiveBuf(uint8_t* pu8Buf, uint32_t u32Len);
 
 //@} // Spi Group
 
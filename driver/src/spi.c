@@ -70,6 +70,11 @@
                                         SpiSserr == (x)||\
                                         SpiMdf == (x) )
 
+/* 连续传输一字节：等待传输结束或主机模式错误（出错时不会再置SPIF），读DATA清除SPIF */
+#define SPI_XFER(tx, rx)            do { M0P_SPI->DATA = (tx);\
+                                         while (0u == (M0P_SPI->STAT & (SpiIf | SpiMdf))) { }\
+                                         (rx) = (uint8_t)M0P_SPI->DATA; } while (0)
+
 
 /******************************************************************************/
 /* Local function prototypes ('static')                                       */
@@ -268,6 +273,105 @@ uint8_t Spi_ReceiveData(void)
     return temp;
 }
 
+/**
+ ******************************************************************************
+ ** \brief  SPI 连续收发函数，每4字节展开一次，传输期间不做超时计数
+ **
+ ** \param [in] pu8TxBuf 发送数据，为NULL时发送0x00
+ ** \param [out] pu8RxBuf 接收数据，为NULL时丢弃
+ ** \param [in] u32Len 字节数
+ **
+ ** \retval Ok传输成功
+ ** \retval ErrorInvalidMode SPI未使能或传输中出现主机模式错误/写冲突
+ ** 
+ ******************************************************************************/
+en_result_t Spi_TransferBuf(const uint8_t* pu8TxBuf, uint8_t* pu8RxBuf, uint32_t u32Len)
+{
+    uint8_t u8Dummy;
+
+    if (FALSE == M0P_SPI->CR_f.SPEN)
+    {
+        return ErrorInvalidMode;
+    }
+
+    if (NULL == pu8RxBuf)
+    {
+        while (u32Len >= 4u)
+        {
+            SPI_XFER(pu8TxBuf[0], u8Dummy);
+            SPI_XFER(pu8TxBuf[1], u8Dummy);
+            SPI_XFER(pu8TxBuf[2], u8Dummy);
+            SPI_XFER(pu8TxBuf[3], u8Dummy);
+            pu8TxBuf += 4;
+            u32Len -= 4u;
+        }
+        while (u32Len--)
+        {
+            SPI_XFER(*pu8TxBuf++, u8Dummy);
+        }
+    }
+    else if (NULL == pu8TxBuf)
+    {
+        while (u32Len >= 4u)
+        {
+            SPI_XFER(0x00u, pu8RxBuf[0]);
+            SPI_XFER(0x00u, pu8RxBuf[1]);
+            SPI_XFER(0x00u, pu8RxBuf[2]);
+            SPI_XFER(0x00u, pu8RxBuf[3]);
+            pu8RxBuf += 4;
+            u32Len -= 4u;
+        }
+        while (u32Len--)
+        {
+            SPI_XFER(0x00u, *pu8RxBuf++);
+        }
+    }
+    else
+    {
+        while (u32Len--)
+        {
+            SPI_XFER(*pu8TxBuf++, *pu8RxBuf++);
+        }
+    }
+    (void)u8Dummy;
+
+    if (0u != (M0P_SPI->STAT & (SpiMdf | SpiWcol)))
+    {
+        return ErrorInvalidMode;
+    }
+    return Ok;
+}
+
+/**
+ ******************************************************************************
+ ** \brief  SPI 连续发送函数
+ **
+ ** \param [in] pu8Buf 发送数据
+ ** \param [in] u32Len 字节数
+ **
+ ** \retval 见Spi_TransferBuf
+ ** 
+ ******************************************************************************/
+en_result_t Spi_SendBuf(const uint8_t* pu8Buf, uint32_t u32Len)
+{
+    return Spi_TransferBuf(pu8Buf, NULL, u32Len);
+}
+
+/**
+ ******************************************************************************
+ ** \brief  SPI 连续接收函数（发送0x00）
+ **
+ ** \param [out] pu8Buf 接收数据
+ ** \param [in] u32Len 字节数
+ **
+ ** \retval 见Spi_TransferBuf
+ ** 
+ ******************************************************************************/
+en_result_t Spi_ReceiveBuf(uint8_t* pu8Buf, uint32_t u32Len)
+{
+    return Spi_TransferBuf(NULL, pu8Buf, u32Len);
+}
+
 //@} // SpiGroup
 /******************************************************************************
  * EOF (not truncated)
@@ -0,0 +1,125 @@
+#include "clk_governor.h"
+#include "hc32l110.h"
+#include "system_hc32l110.h"
+#include "uart_interface.h"
+
+#define CLKGOV_STEP_COUNT       4u
+
+// RCH只在相邻的档位之间切换，跨档时逐级经过中间频率
+static const en_clk_freq_t rchSteps[CLKGOV_STEP_COUNT] = { ClkFreq4Mhz, ClkFreq8Mhz, ClkFreq16Mhz, ClkFreq24Mhz };
+
+static volatile uint32_t govTickMs = 0;
+static volatile uint32_t lastRequestMs = 0;
+static volatile uint32_t lastLineActivity = 0;
+static volatile uint32_t lastLineBusyMs = 0;
+static volatile en_clk_freq_t currentFreq = CLKGOV_FAST_FREQ;
+static clkgov_callback_t switchCallback = NULL;
+
+/**
+ * @brief 查找频率在rchSteps中的位置
+ * @return uint8_t 位置，不在表中时返回CLKGOV_STEP_COUNT
+ */
+static uint8_t stepIndex(en_clk_freq_t freq)
+{
+    uint8_t i;
+
+    for (i = 0; i < CLKGOV_STEP_COUNT; i++)
+    {
+        if (rchSteps[i] == freq)
+        {
+            break;
+        }
+    }
+    return i;
+}
+
+/**
+ * @brief 切换RCH频率，并按新的PCLK重新设置串口波特率和TIM0时基（switchCallback）
+ *        只在主循环中调用；串口最近CLKGOV_LINE_QUIET_MS内有收发时不切换，避免改动正在收发的字节的波特率
+ */
+static void switchTo(en_clk_freq_t freq)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint8_t from;
+    uint8_t to;
+
+    __disable_irq();
+    if ((currentFreq == freq) ||
+        ((freq == CLKGOV_IDLE_FREQ) && ((uint32_t)(govTickMs - lastRequestMs) < CLKGOV_IDLE_MS)) ||
+        (UARTIF_lineActivity() != lastLineActivity) ||
+        ((uint32_t)(govTickMs - lastLineBusyMs) < CLKGOV_LINE_QUIET_MS))
+    {
+        __set_PRIMASK(primask);
+        return;
+    }
+
+    from = stepIndex(currentFreq);
+    to = stepIndex(freq);
+    if ((from < CLKGOV_STEP_COUNT) && (to < CLKGOV_STEP_COUNT))
+    {
+        while (from != to)
+        {
+            from = (from < to) ? (uint8_t)(from + 1u) : (uint8_t)(from - 1u);
+            (void)Clk_SetRCHFreq(rchSteps[from]);
+        }
+    }
+    else
+    {
+        (void)Clk_SetRCHFreq(freq);
+    }
+    currentFreq = freq;
+    // delay1ms依赖SystemCoreClock
+    SystemCoreClockUpdate();
+
+    UARTIF_updateBaudRate();
+    if (switchCallback != NULL)
+    {
+        switchCallback();
+    }
+    __set_PRIMASK(primask);
+}
+
+void CLKGOV_init(clkgov_callback_t onSwitch)
+{
+    switchCallback = onSwitch;
+    currentFreq = CLKGOV_FAST_FREQ;
+    lastRequestMs = govTickMs;
+}
+
+void CLKGOV_tick1ms(void)
+{
+    uint32_t activity = UARTIF_lineActivity();
+
+    govTickMs++;
+    // 记录串口最近一次收发的时间，只读计数，不在中断中切换频率
+    if (activity != lastLineActivity)
+    {
+        lastLineActivity = activity;
+        lastLineBusyMs = govTickMs;
+    }
+}
+
+void CLKGOV_request(void)
+{
+    lastRequestMs = govTickMs;
+    if (currentFreq != CLKGOV_FAST_FREQ)
+    {
+        switchTo(CLKGOV_FAST_FREQ);
+    }
+}
+
+void CLKGOV_process(void)
+{
+    if ((uint32_t)(govTickMs - lastRequestMs) < CLKGOV_IDLE_MS)
+    {
+        // 请求时串口正忙而推迟的升频
+        if (currentFreq != CLKGOV_FAST_FREQ)
+        {
+            switchTo(CLKGOV_FAST_FREQ);
+        }
+    }
+    else if (currentFreq != CLKGOV_IDLE_FREQ)
+    {
+        switchTo(CLKGOV_IDLE_FREQ);
+    }
+}
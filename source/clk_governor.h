@@ -0,0 +1,39 @@
+#ifndef CLK_GOVERNOR_H
+#define CLK_GOVERNOR_H
+
+#include <stdint.h>
+#include "clk.h"
+
+// 时钟调节：flash扫描、上传和屏幕刷新期间RCH切到最高频率，空闲CLKGOV_IDLE_MS后降到低频。
+// 每次切换后重新计算UART1/LPUART波特率定时器，并调用CLKGOV_init登记的回调（重设TIM0的1ms时基）。
+#define CLKGOV_FAST_FREQ        ClkFreq24Mhz    // 忙碌时的RCH频率（与SystemInit一致）
+#define CLKGOV_IDLE_FREQ        ClkFreq4Mhz     // 空闲时的RCH频率
+#define CLKGOV_IDLE_MS          50u             // 最后一次请求后保持高频的时间
+#define CLKGOV_LINE_QUIET_MS    2u              // 串口这么久没有收发才切换（19200波特率约4个字节时间）
+
+// 切换频率后在关中断状态下调用，按新的PCLK重设依赖时钟的外设
+typedef void (*clkgov_callback_t)(void);
+
+/**
+ * @brief 初始化时钟调节，记录SystemInit设置的频率；在串口和定时器初始化之前调用
+ * @param onSwitch 每次切换频率后调用，可为NULL
+ */
+void CLKGOV_init(clkgov_callback_t onSwitch);
+
+/**
+ * @brief 1ms时基，在1ms定时中断中调用
+ */
+void CLKGOV_tick1ms(void);
+
+/**
+ * @brief 请求高频运行，从现在起保持CLKGOV_IDLE_MS；串口空闲时立即切换，否则由CLKGOV_process在空闲后切换
+ *        只在主循环中调用（开始上传、刷屏、后台GC前），不要在中断或打印中调用
+ */
+void CLKGOV_request(void);
+
+/**
+ * @brief 在主循环中调用：完成推迟的升频，超过CLKGOV_IDLE_MS没有请求时降到低频
+ */
+void CLKGOV_process(void);
+
+#endif // CLK_GOVERNOR_H
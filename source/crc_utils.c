@@ -62,3 +62,30 @@ uint32_t calculate_crc32_default(const uint8_t* data, uint32_t length)
 {
     return calculate_crc32(data, length, NULL);
 }
+
+/**
+ * @brief 分段计算CRC32（默认配置）
+ * @param crc 前一段的CRC32值，第一段传0
+ * @param data 数据指针
+ * @param length 数据长度
+ * @return uint32_t 到这一段为止的CRC32值
+ */
+uint32_t calculate_crc32_update(uint32_t crc, const uint8_t* data, uint32_t length)
+{
+    uint32_t i, j;
+
+    // 取消上一段的最终异或，接着上一段继续计算
+    crc ^= CRC32_IEEE.final_xor;
+    for (i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (j = 0; j < 8; j++) {
+            if (crc & 1) {
+                crc = (crc >> 1) ^ CRC32_IEEE.polynomial;
+            } else {
+                crc >>= 1;
+            }
+        }
+    }
+
+    return crc ^ CRC32_IEEE.final_xor;
+}
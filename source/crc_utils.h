@@ -32,4 +32,14 @@ uint32_t calculate_crc32(const uint8_t* data, uint32_t length, const crc32_confi
  */
 uint32_t calculate_crc32_default(const uint8_t* data, uint32_t length);
 
+/**
+ * @brief 分段计算CRC32（默认配置）：crc传入前一段的结果，第一段传0
+ *        依次传入各段数据与一次性计算整段数据的结果相同
+ * @param crc 前一段的CRC32值
+ * @param data 数据指针
+ * @param length 数据长度
+ * @return uint32_t 到这一段为止的CRC32值
+ */
+uint32_t calculate_crc32_update(uint32_t crc, const uint8_t* data, uint32_t length);
+
 #endif // CRC_UTILS_H
@@ -28,6 +28,7 @@
 #include "uart_interface.h"
 #include "w25q32.h"
 #include "flash_manager.h"
+#include "clk_governor.h"
 
 /******************************************************************************
  * Local pre-processor symbols/macros ('#define')                            
@@ -53,7 +54,11 @@
 /******************************************************************************
  * Local variable definitions ('static')                                      *
  ******************************************************************************/
+/* 发送填充值，也借给FM_readImagePlane解压压缩帧 */
 static uint8_t G_buffer3[BUFFER_SIZE] = {0};
+/* 正在发送的图像平面：读取失败的帧用planeFill填充 */
+static uint8_t planeSlotId = 0;
+static uint8_t planeFill = 0xff;
 
 /******************************************************************************
  * Local pre-processor symbols/macros ('#define')                             
@@ -110,16 +115,12 @@ static void spiInit(void)
 
 }
 
-static void writeBuffer(uint8_t *buf, uint16_t size)
+static void writeBuffer(const uint8_t *buf, uint16_t size)
 {
-    uint16_t i;
     Spi_SetCS(TRUE);
     Spi_SetCS(FALSE);
 
-    for (i = 0; i < size; i++)
-    {
-        Spi_SendData(*(buf + i));
-    }
+    (void)Spi_SendBuf(buf, size);
     Spi_SetCS(TRUE);
 
 }
@@ -142,11 +143,37 @@ void EPD_UpdateGDEY042Z98ALL_fast(void)
 }
 
 
-void EPD_WhiteScreenGDEY042Z98UsingFlashDate(imageType_t type, uint8_t slotId)
+/* FM_readImagePlane的回调：把读出的一帧直接发送到屏幕，最后一帧只有120字节 */
+static void sendPlaneFrame(uint8_t frameNum, const uint8_t* data, flash_result_t result)
+{
+    if (result != FLASH_OK)
+    {
+        UARTIF_uartPrintf(0, "Flash write image data id 0x%02x page 0x%02x fail! error code is %d \n", planeSlotId, frameNum, result);
+        memset(G_buffer3, planeFill, BUFFER_SIZE);
+        data = G_buffer3;
+    }
+    delay1ms(1);
+    writeBuffer(data, (frameNum == MAX_FRAME_NUM) ? 120u : PAYLOAD_SIZE);
+}
+
+/* 不显示的平面整屏发送填充值 */
+static void sendFillPlane(uint8_t fill)
 {
     unsigned int i;
-//    unsigned int j;
-    flash_result_t result;
+
+    memset(G_buffer3, fill, BUFFER_SIZE);
+    for (i = 0; i <= MAX_FRAME_NUM; i++)
+    {
+        delay1ms(1);
+        writeBuffer(G_buffer3, (i == MAX_FRAME_NUM) ? 120u : PAYLOAD_SIZE);
+    }
+}
+
+void EPD_WhiteScreenGDEY042Z98UsingFlashDate(imageType_t type, uint8_t slotId)
+{
+    // 从flash读出整屏数据送到屏幕期间保持高频，刷新本身不需要
+    CLKGOV_request();
+
     /* 优先使用 flash header 存储的颜色标志（若已知），以自动选择显示通道 */
     {
         uint8_t storedColor = FM_getImageSlotColor(slotId);
@@ -167,27 +194,15 @@ void EPD_WhiteScreenGDEY042Z98UsingFlashDate(imageType_t type, uint8_t slotId)
     }
 	spiWriteCmd(0x24);	       //Transfer BW data
     DC_H;
-    for (i = 0; i <= MAX_FRAME_NUM; i++)
+    planeSlotId = slotId;
+    planeFill = 0xff;
+    if (type == IMAGE_BW || type == IMAGE_BW_AND_RED)
     {
-        memset(G_buffer3, 0xff, BUFFER_SIZE);
-        if (type == IMAGE_BW || type == IMAGE_BW_AND_RED)
-        {
-            result = FM_readImage(MAGIC_BW_IMAGE_DATA, slotId, i, G_buffer3);
-            if (result != FLASH_OK)
-            {
-                UARTIF_uartPrintf(0, "Flash write image data id 0x%02x page 0x%02x fail! error code is %d \n", slotId, i, result);
-                memset(G_buffer3, 0xff, BUFFER_SIZE);
-            }
-        }
-        delay1ms(1);
-        if (i == MAX_FRAME_NUM)
-        {
-           writeBuffer(G_buffer3, 120u);
-        }
-        else 
-        {
-            writeBuffer(G_buffer3, PAYLOAD_SIZE);
-        }
+        (void)FM_readImagePlane(MAGIC_BW_IMAGE_DATA, slotId, G_buffer3, sendPlaneFrame);
+    }
+    else
+    {
+        sendFillPlane(planeFill);
     }
 
     DC_L;
@@ -196,30 +211,14 @@ void EPD_WhiteScreenGDEY042Z98UsingFlashDate(imageType_t type, uint8_t slotId)
 
 	spiWriteCmd(0x26);		     //Transfer new data
     DC_H;
-    for (i = 0; i <= MAX_FRAME_NUM; i++)
+    planeFill = 0;
+    if (type == IMAGE_RED || type == IMAGE_BW_AND_RED)
     {
-        memset(G_buffer3, 0, BUFFER_SIZE);
-        if (type == IMAGE_RED || type == IMAGE_BW_AND_RED)
-        {
-            result = FM_readImage(MAGIC_RED_IMAGE_DATA, slotId, i, G_buffer3);
-
-            if (result != FLASH_OK)
-            {
-                UARTIF_uartPrintf(0, "Flash write image data id 0x%02x page 0x%02x fail! error code is %d \n", slotId, i, result);
-                memset(G_buffer3, 0, BUFFER_SIZE);
-            }
-        }
-        delay1ms(1);
-        if (i == MAX_FRAME_NUM)
-        {
-           writeBuffer(G_buffer3, 120u);
-        }
-        else 
-        {
-            writeBuffer(G_buffer3, PAYLOAD_SIZE);
-        }
-        // delay1ms(1);
-        // UARTIF_uartPrintf(0, " %d cycle \n", i);
+        (void)FM_readImagePlane(MAGIC_RED_IMAGE_DATA, slotId, G_buffer3, sendPlaneFrame);
+    }
+    else
+    {
+        sendFillPlane(planeFill);
     }
     DC_L;
     delay1ms(2);
@@ -5,30 +5,58 @@
 
 // Flash芯片基本参数
 #define FLASH_BASE_ADDRESS      0x000000    // Flash起始地址
-#define FLASH_TOTAL_SIZE        0x400000    // 4MB总容量
+#define FLASH_TOTAL_SIZE        0x400000    // 旧版segment布局按4MB划分；实际容量在启动时识别（W25Q32_TotalSize）
 #define FLASH_PAGE_SIZE         256u         // 页大小
 #define FLASH_SECTOR_SIZE       4096u        // 扇区大小
 #define FLASH_BLOCK_SIZE        65536u       // 块大小
 #define PAYLOAD_SIZE            248u         // 有效载荷大小
+#define FLASH_PAGE_HEADER_SIZE  8u           // page头：magic(1) + id(2) + size(1) + crc32(4)
+#define FLASH_PAGE_PROBE_SIZE   4u           // 启动重建索引时只读取page头的magic、id、size
 
-// Segment配置
-#define FLASH_SEGMENT_COUNT     2           // 两个segment
+// 扇区日志配置：整片Flash按4KB扇区组织成日志，每个扇区page 0为扇区头，page 1~15为日志page
+// 扇区头记录分配序号、上一个日志扇区和当时的映射表快照，启动时只需回放最新扇区
+#define FLASH_PAGES_PER_SECTOR          (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)      // 每个扇区的page数量：16
+#define FLASH_MAX_SECTOR_COUNT          (0xffffu / FLASH_PAGES_PER_SECTOR)         // page号为16位且0xffff表示无效，最多使用4095个扇区（16MB芯片的最后一个扇区不用）
+#define FLASH_LOG_PAGES_PER_SECTOR      (FLASH_PAGES_PER_SECTOR - 1u)               // 每个扇区的日志page数量：15
+#define FLASH_FREE_LIST_SIZE            16u         // 空闲扇区列表长度，扫描一次最多补充这么多个
+#define FLASH_FREE_LIST_LOW             4u          // 空闲扇区列表少于该值时在后台重新扫描
+#define FLASH_FREE_SECTOR_RESERVE       8u          // 整片空闲扇区少于该值时回收有效page最少的扇区
+#define FLASH_LOG_GUARD_SECTORS         16u         // 最近写入的N个日志扇区不参与回收（接收记录被替换的图像写头时要扫描其中的帧）
+#define FLASH_SCAN_WINDOW_SECTORS       (FLASH_PAGE_SIZE * 2u)                      // 一次统计有效page数的扇区数（每扇区4bit）：512
+#define FLASH_GC_STEP_BUDGET_MS         5u          // FM_process单次调用的时间预算
+#define FLASH_WEAR_LEVEL_DELTA          64u         // 擦除最多的扇区比最冷的扇区多擦除这么多次时，回收最冷扇区让它重新参与分配
+#define FLASH_WEAR_SCAN_STEP            64u         // 后台查找最冷扇区时每步读取的扇区头数
+#define FLASH_STATS_SCAN_STEP           64u         // 后台统计已写入page数（FM_getStats）时每步读取的扇区数
+#define FLASH_WEAR_HISTOGRAM_BINS       8u          // FM_getWearInfo的擦除次数分布区间数
+#define FLASH_SCRUB_PAGES_PER_STEP      2u          // 后台巡检每次FM_process最多检查的page数
+#define FLASH_SCRUB_INTERVAL_MS         600000u     // 一轮巡检结束后等待这么久再开始下一轮
+#define FLASH_BAD_SECTOR_LIST_SIZE      4u          // RAM中记录的可疑扇区和坏扇区数
+#define FLASH_SCRUB_READ_TRIES          3u          // 巡检和GC复制时一个page校验失败后最多读取的次数
+#define FLASH_BAD_SECTOR_FAULTS         2u          // 同一扇区巡检出错这么多次后标记为坏扇区，之前每次只把有效page搬走重写
+#define FLASH_POWER_DOWN_IDLE_MS        10u         // Flash空闲这么久后进入掉电模式（下一次访问时驱动自动唤醒）
+#define FLASH_BAD_SECTOR_MARK           0x5Au       // 坏扇区标记：写在扇区头page的最后一个字节（扇区头之后保持擦除状态），该扇区不再分配
+
+// 旧版segment布局（两个2MB segment轮换），仅在启动时识别并迁移到扇区日志
 #define FLASH_SEGMENT_SIZE      (FLASH_TOTAL_SIZE / 2)  // 每个segment 2MB
 #define FLASH_SEGMENT0_BASE     FLASH_BASE_ADDRESS      // Segment 0基地址
 #define FLASH_SEGMENT1_BASE     (FLASH_BASE_ADDRESS + FLASH_SEGMENT_SIZE)  // Segment 1基地址
-
-// GC 标志页地址
-// #define FLASH_SEGMENT0_GCFLAGPAGEADDR      0x1FFF00    // Flash起始地址
-// #define FLASH_SEGMENT1_GCFLAGPAGEADDR      0x3FFF00    // Flash起始地址
-
-// 每个segment的page配置
 #define FLASH_PAGES_PER_SEGMENT (FLASH_SEGMENT_SIZE / FLASH_PAGE_SIZE)  // 每个segment的page数量：8192
-#define FLASH_DATA_PAGES_PER_SEGMENT (FLASH_PAGES_PER_SEGMENT - 1)     // 数据page数量：8191（除去header page）
+#define FLASH_SECTORS_PER_SEGMENT       (FLASH_SEGMENT_SIZE / FLASH_SECTOR_SIZE)   // 每个segment的扇区数量：512
+#define FLASH_LOG_FIRST_PAGE            0x30u       // 带checkpoint区的segment日志起始page
+#define FLASH_LEGACY_LOG_FIRST_PAGE     1u          // 更早的segment布局日志紧跟segment头
 
 // 数据管理配置
-#define MAX_DATA_ENTRIES        16         // 最大数据条目数
-#define MAX_IMAGE_ENTRIES       8         //  最大图像条目数
+#define MAX_DATA_ENTRIES        32         // 最大数据条目数（小数据作为记录打包存放，多个条目共用一个page）
+#define MAX_IMAGE_ENTRIES       64        //  最大图像条目数（槽位对应的图像头地址保存在Flash上的槽位目录中，不占RAM）
 #define MAX_FRAME_NUM           60         // 最大帧数总共61 帧，0-60
+#define FLASH_IMAGE_STREAM_COUNT 2u        // 同时接收中的图像数（RAM中记录已写帧地址，每个68字节），超出的图像写头时退回扫描日志
+#define FLASH_STREAM_SECTOR_COUNT 15u      // 接收记录共用的扇区表项数（帧地址按 表项<<4 | 扇区内page 存一个字节，最多15项），表满时该帧退回扫描日志
+#define FLASH_DEDUP_CACHE_SIZE  4u         // 记住最近写入的几种图像帧内容，相同的帧直接引用已有page
+#define FLASH_PACKED_RECORD_HEADER_SIZE 4u // 压缩帧记录头：帧号(1) + 压缩长度(1) + 解压后数据CRC32的低16位(2)
+#define FLASH_DATA_RECORD_OVERHEAD 4u      // 数据记录：数据ID(1) + 长度(1) + 数据 + 前面各字节CRC32的低16位(2)
+#define FLASH_SLOT_DIR_SLOTS    32u        // 每个槽位目录page记录的槽位数，每个槽位：黑白图像头(2) + 红白图像头(2) + 颜色标志(1)
+#define FLASH_SLOT_DIR_PAGES    ((MAX_IMAGE_ENTRIES + FLASH_SLOT_DIR_SLOTS - 1u) / FLASH_SLOT_DIR_SLOTS) // 槽位目录page数
+#define FLASH_SLOT_CACHE_SIZE   8u         // RAM中缓存的槽位数（不小于旧格式的8个槽位，迁移时用来暂存旧映射表）
 
 #define INVALID_DATA_ID         0xFFFF    // 无效数据ID (16位)
 #define INVALID_ADDRESS         0xFFFFFFFF  // 无效地址
@@ -42,6 +70,14 @@
 #define MAGIC_RED_IMAGE_HEADER  0xA2        // 图像头页
 #define MAGIC_BW_IMAGE_DATA     0xA3        // 黑白图像数据页
 #define MAGIC_RED_IMAGE_DATA    0xA4        // 红白图像数据页
+// 0xA5、0xA6曾用于segment布局的checkpoint页和GC标记页
+#define SECTOR_HEADER_MAGIC     0xA7        // 扇区头页（只出现在扇区的page 0）
+#define DEAD_PAGE_MAGIC         0x00        // 掉电时只写了一部分的page，启动时把magic改写为0作废
+#define MAGIC_BW_IMAGE_PACKED   0xA8        // 黑白图像压缩帧页：同一图像的多个RLE压缩帧依次追加在一个page中
+#define MAGIC_RED_IMAGE_PACKED  0xA9        // 红白图像压缩帧页
+#define SLOT_DIR_MAGIC          0xAA        // 槽位目录页：id为目录序号，payload为各槽位的图像头地址和颜色标志
+#define DATA_DELETED_MAGIC      0xAD        // 数据删除记录页：id为删除的数据ID，没有payload（现在删除写为长度为0的数据记录）
+#define DATA_PACKED_MAGIC       0xAE        // 数据记录页：多个数据记录依次追加在一个page中
 
 // 状态魔法数字定义
 #define SEGMENT_MAGIC_ACTIVE    0x12345678  // 激活状态
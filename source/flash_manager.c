@@ -10,6 +10,7 @@
 #include <string.h>
 #include "uart_interface.h"
 #include "crc_utils.h"
+#include "rle_utils.h"
 #include "ddl.h"
 
 
@@ -17,16 +18,52 @@
  * Local function prototypes ('static')
  ******************************************************************************/
 
-static flash_result_t readSegmentHeader(uint32_t segmentBase, boolean_t isDstHeaderHigh);
-static flash_result_t resetSegment(boolean_t isSetHiSegment, const uint32_t statusMagic, const uint32_t currentGcCounter);
-static flash_result_t scanSegmentPages(void);
+static flash_result_t readSegmentHeader(uint32_t segmentBase, segment_header_t* header);
 //static int16_t find_data_entry(flash_manager_t* manager, uint16_t dataId);
 //static flash_result_t add_data_entry(flash_manager_t* manager, uint16_t dataId, uint32_t page_address);
 
-static flash_result_t eraseSegment(boolean_t eraseHiSegment);
-static flash_result_t copyValidPages(void);
-static void readBlock(uint8_t blockAddress);
-static flash_result_t garbageCollect(void);
+static uint8_t readPageHeader(uint16_t page);
+static uint16_t findLogTail(uint16_t firstPage, uint16_t endPage);
+static void indexPage(uint16_t page);
+static uint8_t scanDataRecords(const uint8_t* buf, uint16_t page, uint8_t dataId);
+static flash_result_t programPage(uint32_t addr, uint8_t magic, uint16_t dataId, const uint8_t* data, uint8_t size);
+static flash_result_t ensureWritablePage(void);
+static void gcLoadVictim(uint16_t sector);
+static flash_result_t gcFinish(void);
+static flash_result_t unpackFrame(const uint8_t* page, uint8_t frameNum, uint8_t* data, boolean_t verify);
+
+/******************************************************************************
+ * Local pre-processor symbols/macros ('#define')
+ ******************************************************************************/
+// 扇区头记录：seq(4) + prevSector(2) + eraseCount(4) + dataEntries + slotDirPages
+#define SECTOR_INFO_SIZE    (4u + 2u + 4u)
+#define SECTOR_RECORD_SIZE  (SECTOR_INFO_SIZE + (MAX_DATA_ENTRIES * 2u) + (FLASH_SLOT_DIR_PAGES * 2u))
+// 槽位目录之前的扇区头记录：8个槽位的映射表直接放在扇区头里（dataEntries + imageBwEntries + imageRedEntries + imageSlotColor）
+#define LEGACY_SLOT_COUNT   8u
+#define LEGACY_DATA_ENTRIES 16u
+#define SECTOR_RECORD_SIZE_V1 (SECTOR_INFO_SIZE + (LEGACY_DATA_ENTRIES * 2u) + (LEGACY_SLOT_COUNT * 2u * 2u) + LEGACY_SLOT_COUNT)
+// 数据条目较少的扇区头（LEGACY_DATA_ENTRIES个）也可以加载，用记录长度区分，不能与旧格式相同
+#define SECTOR_RECORD_SIZE_MIN (SECTOR_INFO_SIZE + (LEGACY_DATA_ENTRIES * 2u) + (FLASH_SLOT_DIR_PAGES * 2u))
+#if (SECTOR_RECORD_SIZE >= SECTOR_RECORD_SIZE_V1)
+#error "sector record size must stay below the legacy 8-slot layout"
+#endif
+#if (MAX_DATA_ENTRIES < LEGACY_DATA_ENTRIES) || (MAX_DATA_ENTRIES >= 0xff)
+#error "MAX_DATA_ENTRIES must be in [16, 254]: data records store the id in one byte"
+#endif
+#if (FLASH_SLOT_CACHE_SIZE < LEGACY_SLOT_COUNT)
+#error "FLASH_SLOT_CACHE_SIZE must hold the legacy 8-slot table during migration"
+#endif
+// 槽位目录page payload：每个槽位 黑白图像头(2) + 红白图像头(2) + 颜色标志(1)
+#define SLOT_DIR_ENTRY_SIZE 5u
+#define SLOT_DIR_SIZE       (FLASH_SLOT_DIR_SLOTS * SLOT_DIR_ENTRY_SIZE)
+// 启动扫描扇区头时只读取page头 + seq + prevSector + eraseCount
+#define SECTOR_PROBE_SIZE   (FLASH_PAGE_HEADER_SIZE + SECTOR_INFO_SIZE)
+// 图像头payload：61个帧地址 + 1字节颜色标志
+#define IMAGE_HEADER_SIZE   ((MAX_FRAME_NUM + 1) * 2 + 1)
+// 统计有效page时分段读取图像头，每次读出的帧地址数
+#define HEADER_READ_CHUNK   8u
+// 图像数据页magic -> 压缩帧页magic
+#define PACKED_MAGIC(magic) ((uint8_t)((magic) + (MAGIC_BW_IMAGE_PACKED - MAGIC_BW_IMAGE_DATA)))
 
 /******************************************************************************
  * Local variable definitions ('static')                                      *
@@ -34,60 +71,37 @@ static flash_result_t garbageCollect(void);
 static flash_manager_t fmCtx;
 
 // 静态缓冲区，用于Flash读写操作的中间变量
+// G_buffer1：page读写暂存，统计扇区有效page数时也用作计数表
 static uint8_t G_buffer1[FLASH_PAGE_SIZE] = {0};
-static uint8_t G_buffer2[FLASH_PAGE_SIZE] = {0};
 
-static uint16_t G_imageAddressBuffer[MAX_FRAME_NUM + 1u];
+// 图像头payload（帧地址 + 颜色标志）：FM_readImage的帧地址缓存，写图像头时也在这里组包，不会被分配扇区的过程改写
+static uint16_t G_imageAddressBuffer[(IMAGE_HEADER_SIZE + 1u) / 2u];
+// G_imageAddressBuffer中缓存的是哪个图像头（FM_readImage使用）
+static uint8_t lastMagicInBuffer = 0xff;
+static uint8_t lastSlotIdInBuffer = 0xff;
+// 上一次读取的压缩帧记录之后的位置，显示时按帧号顺序读取，下一帧通常就在这里
+static uint16_t packedReadPage = 0xffff;
+static uint16_t packedReadOffset = 0;
+// FM_readImage从第0帧起按顺序校验通过的帧数，全部通过时该图像记为已校验
+static uint8_t verifiedRun = 0;
+
+// 1ms时基，FM_process用来限制单次调用耗时
+static volatile uint32_t fmTickMs = 0;
 
 /*****************************************************************************
  * Function implementation - local ('static')
  ******************************************************************************/
 
 /**
- * @brief 辅助函数：重置 segment（可选重置0、1或同时重置两个）
- * @param reset0 是否重置segment0
- * @param reset1 是否重置segment1
- * @param statusMagic0 segment0的magic
- * @param statusMagic1 segment1的magic
- * @param result 返回结果指针
- */
-static void resetSegments(
-    boolean_t reset0, boolean_t reset1,
-    uint32_t statusMagic0, uint32_t statusMagic1,
-    flash_result_t* result
-) {
-    if (reset0 && reset1) {
-        *result = resetSegment(FALSE, statusMagic0, 0);
-        *result = resetSegment(TRUE, statusMagic1, 0);
-        fmCtx.activeSegmentBaseStatus = MAGIC_LOW_ACTIVE;
-        fmCtx.gcInProgress = 0;
-    } else if (reset0) {
-        *result = resetSegment(FALSE, statusMagic0, 0);
-        fmCtx.activeSegmentBaseStatus = MAGIC_LOW_ACTIVE;
-    } else if (reset1) {
-        *result = resetSegment(TRUE, statusMagic1, 0);
-        fmCtx.activeSegmentBaseStatus = MAGIC_HIGH_ACTIVE;
-    }
-}
-
-/** 
- * @brief 读取segment头
+ * @brief 读取旧版segment头
  */
-static flash_result_t readSegmentHeader(uint32_t segmentBase, boolean_t isDstHeaderHigh)
+static flash_result_t readSegmentHeader(uint32_t segmentBase, segment_header_t* header)
 {
     flash_result_t re = FLASH_OK;
 	uint32_t calculatedCrc;
     // 使用静态缓冲区读取数据
-    
-    segment_header_t* header = NULL;
 
-    if (isDstHeaderHigh) {
-        header = &fmCtx.header1;
-    } else {
-        header = &fmCtx.header0;
-    }
-
-    if (W25Q32_ReadData(segmentBase, G_buffer1, sizeof(segment_header_t)) != 0) 
+    if (W25Q32_ReadData(segmentBase, G_buffer1, sizeof(segment_header_t)) != 0)
     {
         re = FLASH_ERROR_READ_FAIL;
     }
@@ -95,13 +109,13 @@ static flash_result_t readSegmentHeader(uint32_t segmentBase, boolean_t isDstHea
     // 从缓冲区复制到结构体
     header->headerMagic = G_buffer1[0];
     header->segmentId = G_buffer1[1];
-    header->statusMagic = (uint32_t)G_buffer1[2] | ((uint32_t)G_buffer1[3] << 8) | 
+    header->statusMagic = (uint32_t)G_buffer1[2] | ((uint32_t)G_buffer1[3] << 8) |
                           ((uint32_t)G_buffer1[4] << 16) | ((uint32_t)G_buffer1[5] << 24);
-    header->gcCounter = (uint32_t)G_buffer1[6] | ((uint32_t)G_buffer1[7] << 8) | 
+    header->gcCounter = (uint32_t)G_buffer1[6] | ((uint32_t)G_buffer1[7] << 8) |
                       ((uint32_t)G_buffer1[8] << 16) | ((uint32_t)G_buffer1[9] << 24);
-    header->crc32 = (uint32_t)G_buffer1[10] | ((uint32_t)G_buffer1[11] << 8) | 
+    header->crc32 = (uint32_t)G_buffer1[10] | ((uint32_t)G_buffer1[11] << 8) |
                    ((uint32_t)G_buffer1[12] << 16) | ((uint32_t)G_buffer1[13] << 24);
-    
+
     // 验证头魔法数字
     if (header->headerMagic != SEGMENT_HEADER_MAGIC) {
         header->headerMagic = 0xE0;
@@ -113,370 +127,270 @@ static flash_result_t readSegmentHeader(uint32_t segmentBase, boolean_t isDstHea
         header->headerMagic = 0xE0;
         re = FLASH_ERROR_INIT_FAIL;
     }
-    
+
     // 验证CRC32 - 只校验有效部分（不包括crc32字段）
     calculatedCrc = calculate_crc32_default(G_buffer1, 10); // headerMagic(1) + segmentId(1) + statusMagic(4) + gcCounter(4) = 10字节有效数据
     if (calculatedCrc != header->crc32) {
         header->headerMagic = 0xE0;
         re = FLASH_ERROR_CRC_FAIL;
     }
-    
-    if (re != FLASH_OK) 
-    {
-        // UARTIF_uartPrintf(0, "buffer 0 is 0x%02x! \n", G_buffer1[0]);
-        // UARTIF_uartPrintf(0, "buffer 1 is 0x%02x! \n", G_buffer1[1]);
-        // UARTIF_uartPrintf(0, "buffer 2 is 0x%02x! \n", G_buffer1[2]);
-        // UARTIF_uartPrintf(0, "buffer 3 is 0x%02x! \n", G_buffer1[3]);
-        // UARTIF_uartPrintf(0, "buffer 4 is 0x%02x! \n", G_buffer1[4]);
-        // UARTIF_uartPrintf(0, "buffer 5 is 0x%02x! \n", G_buffer1[5]);
-        // UARTIF_uartPrintf(0, "buffer 6 is 0x%02x! \n", G_buffer1[6]);
-        // UARTIF_uartPrintf(0, "buffer 7 is 0x%02x! \n", G_buffer1[7]);
-        // UARTIF_uartPrintf(0, "buffer 8 is 0x%02x! \n", G_buffer1[8]);
-        // UARTIF_uartPrintf(0, "buffer 9 is 0x%02x! \n", G_buffer1[9]);
-        // UARTIF_uartPrintf(0, "buffer 10 is 0x%02x! \n", G_buffer1[10]);
-        // UARTIF_uartPrintf(0, "buffer 11 is 0x%02x! \n", G_buffer1[11]);
-        // UARTIF_uartPrintf(0, "buffer 12 is 0x%02x! \n", G_buffer1[12]);
-        // UARTIF_uartPrintf(0, "buffer 13 is 0x%02x! \n", G_buffer1[13]);
 
-    }
     return re;
 }
 
 /**
- * @brief 写入segment头
+ * @brief 只读取page头部的magic、id、size到G_buffer1，不读payload
+ * @return page的magic，读取失败时返回0
  */
-static flash_result_t resetSegment(boolean_t isSetHiSegment, const uint32_t statusMagic, const uint32_t currentGcCounter)
+static uint8_t readPageHeader(uint16_t page)
 {
-	uint32_t crc32;
-    flash_result_t re = FLASH_OK;
-
-    // 清空缓冲区
-    memset(G_buffer1, 0x00u, 256);
-
-    // 将结构体字段复制到缓冲区
-    G_buffer1[0] = SEGMENT_HEADER_MAGIC;
-    G_buffer1[1] = isSetHiSegment ? 1 : 0;
-    G_buffer1[2] = (uint8_t)(statusMagic & 0xFF);
-    G_buffer1[3] = (uint8_t)((statusMagic >> 8) & 0xFF);
-    G_buffer1[4] = (uint8_t)((statusMagic >> 16) & 0xFF);
-    G_buffer1[5] = (uint8_t)((statusMagic >> 24) & 0xFF);
-    G_buffer1[6] = (uint8_t)(currentGcCounter & 0xFF);
-    G_buffer1[7] = (uint8_t)((currentGcCounter >> 8) & 0xFF);
-    G_buffer1[8] = (uint8_t)((currentGcCounter >> 16) & 0xFF);
-    G_buffer1[9] = (uint8_t)((currentGcCounter >> 24) & 0xFF);
-
-    // 计算CRC32 - 只计算有效部分（不包括crc32字段）
-    crc32 = calculate_crc32_default(G_buffer1, 10); // headerMagic(1) + segmentId(1) + statusMagic(4) + gcCounter(4) = 10字节有效数据
-    G_buffer1[10] = (uint8_t)(crc32 & 0xFF);
-    G_buffer1[11] = (uint8_t)((crc32 >> 8) & 0xFF);
-    G_buffer1[12] = (uint8_t)((crc32 >> 16) & 0xFF);
-    G_buffer1[13] = (uint8_t)((crc32 >> 24) & 0xFF);
-
-    // 擦除一个sg
-    eraseSegment( isSetHiSegment);
-
-    UARTIF_uartPrintf(0, "flash_manager: reset segment %s! \n", isSetHiSegment ? "1" : "0");
-    // UARTIF_uartPrintf(0, "buffer 0 is 0x%02x! \n", G_buffer1[0]);
-    // UARTIF_uartPrintf(0, "buffer 1 is 0x%02x! \n", G_buffer1[1]);
-    // UARTIF_uartPrintf(0, "buffer 2 is 0x%02x! \n", G_buffer1[2]);
-    // UARTIF_uartPrintf(0, "buffer 3 is 0x%02x! \n", G_buffer1[3]);
-    // UARTIF_uartPrintf(0, "buffer 4 is 0x%02x! \n", G_buffer1[4]);
-    // UARTIF_uartPrintf(0, "buffer 5 is 0x%02x! \n", G_buffer1[5]);
-    // UARTIF_uartPrintf(0, "buffer 6 is 0x%02x! \n", G_buffer1[6]);
-    // UARTIF_uartPrintf(0, "buffer 7 is 0x%02x! \n", G_buffer1[7]);
-    // UARTIF_uartPrintf(0, "buffer 8 is 0x%02x! \n", G_buffer1[8]);
-    // UARTIF_uartPrintf(0, "buffer 9 is 0x%02x! \n", G_buffer1[9]);
-    // UARTIF_uartPrintf(0, "buffer 10 is 0x%02x! \n", G_buffer1[10]);
-    // UARTIF_uartPrintf(0, "buffer 11 is 0x%02x! \n", G_buffer1[11]);
-    // UARTIF_uartPrintf(0, "buffer 12 is 0x%02x! \n", G_buffer1[12]);
-    // UARTIF_uartPrintf(0, "buffer 13 is 0x%02x! \n", G_buffer1[13]);
-
-    // 写入header（写入整个页面以保持256字节对齐）
-    if (W25Q32_WritePage(isSetHiSegment ? FLASH_SEGMENT1_BASE : FLASH_SEGMENT0_BASE , G_buffer1, FLASH_PAGE_SIZE) != 0) 
-    {
-        re = FLASH_ERROR_WRITE_FAIL;
-    }
-    
-    return re;
+    memset(G_buffer1, 0, FLASH_PAGE_PROBE_SIZE);
+    if (W25Q32_ReadData((uint32_t)page << 8u, G_buffer1, FLASH_PAGE_PROBE_SIZE) != 0)
+    {
+        G_buffer1[0] = 0;
+    }
+    return G_buffer1[0];
 }
 
-static void readBlock(uint8_t blockAddress)
+/**
+ * @brief 只读取page的magic，不改动G_buffer1（统计时G_buffer1中是有效page计数）
+ * @return magic，读取失败时返回0（当作已写入）
+ */
+static uint8_t readPageMagic(uint16_t page)
 {
-    uint16_t i = 0;
-    uint32_t addr = 0;
-    uint8_t magic;
-    uint8_t dataId;
+    uint8_t magic = 0;
 
-    for (i = 0;i<256;i++)
+    if (W25Q32_ReadData((uint32_t)page << 8u, &magic, 1u) != 0)
     {
-        addr = 0;
-        addr |= (uint32_t) (i << 8u);
-        addr |= (uint32_t) (blockAddress << 16u);
-        if ((addr != FLASH_SEGMENT0_BASE) && (addr != FLASH_SEGMENT1_BASE))
-        {
-            // UARTIF_uartPrintf(0, "Read page addr 0x%06lx! \n",addr);
-            memset(G_buffer1, 0, 256);
-            if (W25Q32_ReadData(addr, G_buffer1, 256) == 0)
-            {
-            // delay1ms(1);
-                magic = G_buffer1[0];
-                if (magic == DATA_PAGE_MAGIC || magic == MAGIC_BW_IMAGE_HEADER || magic == MAGIC_RED_IMAGE_HEADER)
-                {
-                    dataId = G_buffer1[1];
-                    if (fmCtx.entriesCountMax[magic & 0x03] > dataId)
-                    {
-                        fmCtx.entries[magic & 0x03][dataId] = (uint16_t)(addr >> 8u);
-                    }
-                    else
-                    {
-                        /* 只打印一次警告，避免刷屏 */
-                        // UARTIF_uartPrintf(0, "WARN: dataId %d out of range (max=%d) at addr 0x%06lx magic=0x%02x\n", 
-                        //                  dataId, fmCtx.entriesCountMax[magic & 0x03], addr, magic);
-                    }
-                }
-                else if (magic == MAGIC_BW_IMAGE_DATA || magic == MAGIC_RED_IMAGE_DATA)
-                {
-                    // do nothing
-                }
-                else if (magic == 0xff)
-                {
-                    if ((G_buffer1[1] == 0xff) && (G_buffer1[3] == 0xff))
-                    {
-                        UARTIF_uartPrintf(0, "flash_manager found last block! \n");
-                    }
-                    else 
-                    {
-                        UARTIF_uartPrintf(0, "ERR: flash_manager 0x07! last block error\n");
-                    }
-                    fmCtx.nextWriteAddress = blockAddress << 8u;
-                    fmCtx.nextWriteAddress |= i;
-                    // UARTIF_uartPrintf(0, "flash_manager found next write address 0x%04x!!! \n", fmCtx.nextWriteAddress);
-                    break;
-                }
-                else
-                {
-                    UARTIF_uartPrintf(0, "ERR: flash_manager 0x06! unknow magic\n");
-                }
-            }
-        }
+        magic = 0;
     }
+    return magic;
 }
 
 /**
- * @brief 返回指定槽位的颜色标志（0 = BW, 1 = RED, 0xFF = 未知）
+ * @brief 二分查找日志尾部：日志只追加写，已写page连续，之后的page全部为擦除状态
+ * @return 第一个已擦除page；日志写满时返回endPage
  */
-uint8_t FM_getImageSlotColor(uint8_t slotId)
+static uint16_t findLogTail(uint16_t firstPage, uint16_t endPage)
 {
-    if (slotId >= MAX_IMAGE_ENTRIES) return 0xFFu;
-    return fmCtx.imageSlotColor[slotId];
+    uint16_t lo = firstPage;
+    uint16_t hi = endPage;
+    uint16_t mid;
+
+    while (lo < hi)
+    {
+        mid = (uint16_t)(lo + ((hi - lo) >> 1u));
+        if (readPageMagic(mid) == 0xff)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = (uint16_t)(mid + 1u);
+        }
+    }
+    return lo;
 }
 
 /**
- * @brief 扫描segment中的所有page，构建内存映射表
+ * @brief 读取一个日志page的头部并更新映射表
+ *        图像头由槽位目录page引用；迁移旧格式时（slotCachePinned）图像头直接更新slotCache中的旧映射表
  */
-static flash_result_t scanSegmentPages(void)
+static void indexPage(uint16_t page)
 {
-    uint8_t endBlockAddr = 0x20;
-    uint8_t blockAddr = 0x00;
- 
-    // 从第1个page开始扫描（第0个是header）
-    blockAddr = (fmCtx.activeSegmentBaseStatus == MAGIC_LOW_ACTIVE) ? 0x00 : 0x20;
-    endBlockAddr = blockAddr + 0x20;
-    for (; blockAddr < endBlockAddr; blockAddr++)
+    uint8_t magic;
+    uint8_t dataId;
+    fm_slot_entry_t* slot;
+
+    // UARTIF_uartPrintf(0, "Read page 0x%04x! \n", page);
+    magic = readPageHeader(page);
+    dataId = G_buffer1[1];
+    if (magic == DATA_PAGE_MAGIC)
     {
-        readBlock(blockAddr);
-        if (fmCtx.nextWriteAddress != 0xffff)
+        if ((dataId < MAX_DATA_ENTRIES) && (G_buffer1[3] <= PAYLOAD_SIZE))
         {
-            break;
+            fmCtx.dataEntries[dataId] = page;
         }
     }
-    if (fmCtx.nextWriteAddress == 0xffff)
+    else if (magic == DATA_PACKED_MAGIC)
     {
-        // 如果扫描完所有page都没找到空page，说明segment已满
-        fmCtx.gcInProgress = 1;
+        // 按写入顺序应用page中的每条数据记录
+        memset(G_buffer1, 0xff, FLASH_PAGE_SIZE);
+        if (W25Q32_ReadData((uint32_t)page << 8u, G_buffer1, FLASH_PAGE_SIZE) == 0)
+        {
+            (void)scanDataRecords(G_buffer1, page, 0xff);
+        }
     }
-    else 
+    else if (magic == DATA_DELETED_MAGIC)
     {
-        UARTIF_uartPrintf(0, "flash_manager next write address is 0x%04x\n", fmCtx.nextWriteAddress);
+        if (dataId < MAX_DATA_ENTRIES)
+        {
+            fmCtx.dataEntries[dataId] = 0xffff;
+        }
     }
-    return FLASH_OK;
-}
-
-static flash_result_t scanImageDataPages(uint8_t magic, uint8_t slotId)
-{
-    uint32_t currentAddr = 0x00;
-    uint32_t endAddr = 0x00;
-    uint8_t frameNum = 0;
-    uint64_t frameIsFull = 0x00;
-    flash_result_t re = FLASH_OK;
-    uint8_t pageMagic;
-    uint8_t pageSlotId;
-
-    currentAddr = (uint32_t)((fmCtx.nextWriteAddress - 1) << 8u);
-    endAddr = (fmCtx.activeSegmentBaseStatus == MAGIC_LOW_ACTIVE) ? FLASH_SEGMENT0_BASE : FLASH_SEGMENT1_BASE;
-    for (; currentAddr > endAddr; currentAddr -= FLASH_PAGE_SIZE)
+    else if (magic == SLOT_DIR_MAGIC)
     {
-        memset(G_buffer1, 0, 256);
-        if (W25Q32_ReadData(currentAddr, G_buffer1, 256) == 0)
+        if ((dataId < FLASH_SLOT_DIR_PAGES) && !fmCtx.slotCachePinned)
         {
-            pageMagic = G_buffer1[0];
-            pageSlotId = G_buffer1[2];
-            
-            // 只要 magic 或 slotId 不匹配，立即停止扫描
-            if (pageMagic != magic || pageSlotId != slotId)
-            {
-                break;
-            }
-            
-            frameNum = G_buffer1[1];
-            if ((frameIsFull & ((uint64_t)1u << frameNum)) != 0u)
-            {
-                // 重复的 frame 号，跳过
-                continue;
-            }
- 
-            if (frameNum > MAX_FRAME_NUM)
-            {
-                UARTIF_uartPrintf(0, "ERR: flash_manager 0x09! image frame num out of range: %d\n", frameNum);
-                re = FLASH_ERROR_IMAGE_FRAME_LOST;
-                break;
-            }
-            G_imageAddressBuffer[frameNum] = (uint16_t)((currentAddr & 0x00ffff00) >> 8u);
-
-
-            frameIsFull |= ((uint64_t)1u << frameNum);
-            if (frameIsFull == 0x1FFFFFFFFFFFFFFF)
-            {
-                // 所有 61 个 frame 都找到了，完成
-                break;
-            }
+            fmCtx.slotDirPages[dataId] = page;
         }
     }
-    if (re == FLASH_OK)
+    else if (magic == MAGIC_BW_IMAGE_HEADER || magic == MAGIC_RED_IMAGE_HEADER)
     {
-        if (frameIsFull != 0x1FFFFFFFFFFFFFFF)
+        if ((dataId < LEGACY_SLOT_COUNT) && fmCtx.slotCachePinned)
         {
-            UARTIF_uartPrintf(0, "ERR: scanImageDataPages frame lost\r\n");
-            re = FLASH_ERROR_IMAGE_FRAME_LOST;
+            slot = &fmCtx.slotCache[dataId];
+            slot->headers[magic - MAGIC_BW_IMAGE_HEADER] = page;
+            // 图像头页payload末尾为颜色标志，单独读取这一个字节
+            (void)W25Q32_ReadData(((uint32_t)page << 8u) + FLASH_PAGE_HEADER_SIZE + (MAX_FRAME_NUM + 1) * 2,
+                                  &slot->color, 1u);
         }
     }
-    return re;
-}
-
-static flash_result_t checkAndDoGarbageCollection(void)
-{
-    flash_result_t re = FLASH_OK;
-    uint32_t nextWriteAddress = (uint32_t)(fmCtx.nextWriteAddress << 8u);
-    if (fmCtx.gcInProgress)
+    else if (magic == MAGIC_BW_IMAGE_DATA || magic == MAGIC_RED_IMAGE_DATA ||
+             magic == MAGIC_BW_IMAGE_PACKED || magic == MAGIC_RED_IMAGE_PACKED || magic == DEAD_PAGE_MAGIC)
     {
-        // UARTIF_uartPrintf(0, "go to gc 0\n");
-        // re = garbageCollect();
-        UARTIF_uartPrintf(0, "Gc on going! \n");
+        // do nothing
     }
-    else 
+    else
     {
-        if (fmCtx.activeSegmentBaseStatus == MAGIC_LOW_ACTIVE)
-        {
-            if (nextWriteAddress >= FLASH_SEGMENT1_BASE)
-            {
-                fmCtx.gcInProgress = 1;
-                UARTIF_uartPrintf(0, "go to gc 1\n");
+        UARTIF_uartPrintf(0, "ERR: flash_manager 0x06! unknow magic\n");
+    }
+}
 
-                re = garbageCollect();
-            }
-        }
-        else 
-        {
-            if (nextWriteAddress >= FLASH_TOTAL_SIZE)
-            {
-                fmCtx.gcInProgress = 1;
-                UARTIF_uartPrintf(0, "go to gc 2\n");
+static void writeU16(uint8_t* buf, uint16_t value)
+{
+    buf[0] = (uint8_t)(value & 0xFF);
+    buf[1] = (uint8_t)((value >> 8) & 0xFF);
+}
 
-                re = garbageCollect();
-            }
-        }
-    }
-    return re;
+static void writeU32(uint8_t* buf, uint32_t value)
+{
+    buf[0] = (uint8_t)(value & 0xFF);
+    buf[1] = (uint8_t)((value >> 8) & 0xFF);
+    buf[2] = (uint8_t)((value >> 16) & 0xFF);
+    buf[3] = (uint8_t)((value >> 24) & 0xFF);
+}
+
+static uint16_t readU16(const uint8_t* buf)
+{
+    return (uint16_t)((uint16_t)buf[0] | ((uint16_t)buf[1] << 8));
+}
+
+static uint32_t readU32(const uint8_t* buf)
+{
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+/**
+ * @brief 发出页编程命令，并计入实际编程的字节数
+ */
+static uint8_t startWritePage(uint32_t addr, uint8_t* buf, uint16_t len)
+{
+    fmCtx.bytesWritten += len;
+    return W25Q32_StartWritePage(addr, buf, len);
+}
+
+/**
+ * @brief 发出页编程命令：head之后紧接着发送data，并计入实际编程的字节数
+ */
+static uint8_t startWritePageGather(uint32_t addr, const uint8_t* head, uint16_t headLen, const uint8_t* data, uint16_t dataLen)
+{
+    fmCtx.bytesWritten += (uint32_t)headLen + dataLen;
+    return W25Q32_StartWritePageGather(addr, head, headLen, data, dataLen);
 }
 
 /**
- * @brief 擦除整个segment
+ * @brief 按统一页格式写入一个page：magic(1) + id(2) + size(1) + crc32(4) + payload
+ *        page头在栈上组好，与调用者的data在同一条编程命令中发出，不复制到G_buffer1；
+ *        payload之后的部分保持擦除状态
  */
-static flash_result_t eraseSegment(boolean_t eraseHiSegment)
+static flash_result_t programPage(uint32_t addr, uint8_t magic, uint16_t dataId, const uint8_t* data, uint8_t size)
 {
-    uint32_t sectorAddress = 0x00;
-    uint32_t i;
-    uint8_t startAddr = 0;
+    flash_result_t result = FLASH_OK;
+    uint8_t header[FLASH_PAGE_HEADER_SIZE];
+
+    header[0] = magic; // 魔法数字
+    header[1] = (uint8_t)(dataId & 0xFF); // if image data, this byte is frameNum
+    header[2] = (uint8_t)((dataId >> 8) & 0xFF); // if image data, this byte is slotId
+    header[3] = size;
 
-    // 按扇区擦除整个segment
-    startAddr = (eraseHiSegment) ? 0x20 : 0x00;
+    // 计算CRC32（只计算数据部分）
+    writeU32(&header[4], calculate_crc32_default(data, size));
 
-    UARTIF_uartPrintf(0, "flash_manager: start to erase block 0x%02x to 0x%02x! \n", startAddr, startAddr + 0x1f);
-    for (i = startAddr; i < (startAddr + 0x1f); i++) 
+    // 写入Flash：只发出编程命令，下一次访问Flash时驱动再等待完成
+    if (startWritePageGather(addr, header, FLASH_PAGE_HEADER_SIZE, data, size) != 0)
     {
-        sectorAddress = 0x00;
-        sectorAddress |= i << 16;
-        W25Q32_Erase64k(sectorAddress);
+        result = FLASH_ERROR_WRITE_FAIL;
     }
-    return FLASH_OK;
+    return result;
 }
 
-static flash_result_t readImageHeaderIntoBuffer(uint8_t magic, uint8_t slotId)
+/**
+ * @brief 读到内存的page是否完好：整页CRC，压缩帧page校验每条记录；没有CRC的page（数据记录页等）不检查
+ */
+static boolean_t pageIntact(const uint8_t* buf)
 {
-    // uint8_t i = 0;
-    flash_result_t result = FLASH_OK;
-    /* Read addresses plus one-byte color flag (if present).
-     * FM_readData returns FLASH_OK only if the page exists and CRC matches.
-     */
-    memset(G_buffer2, 0xff, FLASH_PAGE_SIZE);
-    result = FM_readData(magic, slotId, G_buffer2, (MAX_FRAME_NUM + 1) * 2 + 1);
-    
-    if (result != FLASH_OK)
+    uint16_t offset = FLASH_PAGE_HEADER_SIZE;
+    uint32_t outLen;
+    uint8_t len;
+
+    if ((buf[0] == MAGIC_BW_IMAGE_PACKED) || (buf[0] == MAGIC_RED_IMAGE_PACKED))
     {
-        return result;
+        while ((offset + FLASH_PACKED_RECORD_HEADER_SIZE <= FLASH_PAGE_SIZE) && (buf[offset] <= MAX_FRAME_NUM))
+        {
+            len = buf[offset + 1u];
+            if ((offset + FLASH_PACKED_RECORD_HEADER_SIZE + len > FLASH_PAGE_SIZE) ||
+                ((uint16_t)rle_decoded_crc32(&buf[offset + FLASH_PACKED_RECORD_HEADER_SIZE], len, &outLen) != readU16(&buf[offset + 2u])) ||
+                (outLen != PAYLOAD_SIZE))
+            {
+                return FALSE;
+            }
+            offset += FLASH_PACKED_RECORD_HEADER_SIZE + len;
+        }
+        return TRUE;
     }
-    
-    /* copy addresses - only copy actual valid data */
-    memcpy(G_imageAddressBuffer, G_buffer2, (MAX_FRAME_NUM + 1) * 2);
-    /* copy stored color flag if present */
-    if (slotId < MAX_IMAGE_ENTRIES)
+    if ((buf[0] == DEAD_PAGE_MAGIC) || (buf[0] == DATA_PACKED_MAGIC) || (buf[3] > PAYLOAD_SIZE))
     {
-        fmCtx.imageSlotColor[slotId] = G_buffer2[(MAX_FRAME_NUM + 1) * 2];
+        return TRUE;
     }
-    return result;
+    return (calculate_crc32_default(&buf[FLASH_PAGE_HEADER_SIZE], buf[3]) == readU32(&buf[4])) ? TRUE : FALSE;
 }
 
-static flash_result_t copyPage(uint16_t srcAddr, uint16_t destAddr, boolean_t isDestNext)
+static flash_result_t copyPage(uint16_t srcAddr, uint16_t destAddr)
 {
     uint32_t srcAddress = 0;
     uint32_t destAddress = 0;
     flash_result_t result = FLASH_OK;
+    uint8_t tries;
 
     srcAddress |= (uint32_t) (srcAddr << 8u);
-
-    if (isDestNext)
-    {
-        destAddress |= (uint32_t) (fmCtx.nextWriteAddress << 8u);
-    }
-    else 
-    {
-        destAddress |= (uint32_t) (destAddr << 8u);
-    }
+    destAddress |= (uint32_t) (destAddr << 8u);
     // UARTIF_uartPrintf(0, "Copy data from 0x%06lx to 0x%06lx! \n", srcAddress, destAddress);
 
-    // 读取源page
-    if (result == FLASH_OK)
+    // 读取源page，校验失败时重读
+    for (tries = 0; (result == FLASH_OK) && (tries < FLASH_SCRUB_READ_TRIES); tries++)
     {
         memset(G_buffer1, 0, 256);
-        if (W25Q32_ReadData(srcAddress, G_buffer1, FLASH_PAGE_SIZE) != 0) 
+        if (W25Q32_ReadData(srcAddress, G_buffer1, FLASH_PAGE_SIZE) != 0)
         {
             result =  FLASH_ERROR_READ_FAIL;
         }
+        else if (pageIntact(G_buffer1))
+        {
+            break;
+        }
+    }
+    if ((result == FLASH_OK) && (tries == FLASH_SCRUB_READ_TRIES))
+    {
+        // 数据已无法恢复：复制为作废page，巡检不会把错误算到新扇区上，读取时仍然报错
+        UARTIF_uartPrintf(0, "ERR: flash_manager 0x0E! gc copy page 0x%04x crc error\n", srcAddr);
+        fmCtx.crcErrors++;
+        G_buffer1[0] = DEAD_PAGE_MAGIC;
     }
     // 写入目标page
     if (result == FLASH_OK)
     {
-        if (W25Q32_WritePage(destAddress, G_buffer1, FLASH_PAGE_SIZE) != 0) 
+        if (startWritePage(destAddress, G_buffer1, FLASH_PAGE_SIZE) != 0)
         {
             return FLASH_ERROR_WRITE_FAIL;
         }
@@ -485,703 +399,3655 @@ static flash_result_t copyPage(uint16_t srcAddr, uint16_t destAddr, boolean_t is
 }
 
 /**
- * @brief 复制有效页面到备用segment
+ * @brief 作废FM_readImage缓存的图像头（G_imageAddressBuffer被复用或图像头地址变化时调用）
  */
-static flash_result_t copyValidPages(void)
+static void invalidateImageCache(void)
 {
-	uint8_t i, j, k;
+    lastMagicInBuffer = 0xff;
+    lastSlotIdInBuffer = 0xff;
+    packedReadPage = 0xffff;
+    verifiedRun = 0;
+}
 
-    flash_result_t result = FLASH_OK;
+/**
+ * @brief 图像是否已完整校验过（FM_VERIFY_ONCE）
+ * @param idx 槽位 * 2 + 颜色
+ */
+static boolean_t imageVerified(uint8_t idx)
+{
+    return ((fmCtx.verifiedImages[idx >> 3u] & (1u << (idx & 7u))) != 0u) ? TRUE : FALSE;
+}
 
-    for (i = 0; i < MAX_DATA_ENTRIES; i++) 
+static void setImageVerified(uint8_t idx, boolean_t verified)
+{
+    if (verified)
     {
-        if (fmCtx.dataEntries[i] != 0xffff)
-        {
-            result = copyPage(fmCtx.dataEntries[i], 0, TRUE);
-            if (result != FLASH_OK)
-            {
-                UARTIF_uartPrintf(0, "ERR: flash_manager 0x10! copy data page fail entry %d\n", i);
-                // 删除映射表中的地址
-                fmCtx.dataEntries[i] = 0xffff;
-            }
-            else
-            {
-                // 更新映射表中的地址
-                fmCtx.dataEntries[i] = fmCtx.nextWriteAddress;
-                // 更新Next Write Address
-                fmCtx.nextWriteAddress++;
-            }
-        }
+        fmCtx.verifiedImages[idx >> 3u] |= (uint8_t)(1u << (idx & 7u));
     }
-
-    for (k = 1; k < 3; k++)
+    else
     {
-        for (i = 0; i < MAX_IMAGE_ENTRIES; i++) 
-        {
-            if (fmCtx.entries[k][i] != 0xffff)
-            {
-                memset(G_imageAddressBuffer, 0xff, sizeof(G_imageAddressBuffer));
-                result = readImageHeaderIntoBuffer(DATA_PAGE_MAGIC + k, i);
-                if (result != FLASH_OK)
-                {
-                    // 删除映射表中的地址
-                    UARTIF_uartPrintf(0, "ERR: flash_manager 0x10! read image header into buffer fail\n");
-                    fmCtx.entries[k][i] = 0xffff;
-                    continue;
-                }
-                for (j = 0; j < MAX_FRAME_NUM + 1; j++)
-                {
-                    if (G_imageAddressBuffer[j] != 0xffff)
-                    {
-                        result = copyPage(G_imageAddressBuffer[j], 0, TRUE);
-                    }
-                    if (result == FLASH_OK)
-                    {
-                        fmCtx.nextWriteAddress++;
-                    }
-                    else
-                    {
-                        UARTIF_uartPrintf(0, "ERR: flash_manager 0x10! copy image data page fail entry %d frame %d\n", i, j);
-                        break;
-                    }
-                }
-                if (result != FLASH_OK)
-                {
-                    // 删除映射表中的地址
-                    fmCtx.entries[k][i] = 0xffff;
-                    continue;
-                }
-                // else
-                // {
-                //     result = FM_writeImageHeader(DATA_PAGE_MAGIC + k, i);
-                // }
-            }
-        }
+        fmCtx.verifiedImages[idx >> 3u] &= (uint8_t)~(1u << (idx & 7u));
     }
-        
-    return result;
 }
 
-static flash_result_t judgeWhichSegmentIsActive(void)
+/**
+ * @brief 图像头在回收扇区中或引用了回收扇区中的帧，FIXUP时按gcMap重写
+ */
+static void gcMarkFixup(uint16_t idx)
 {
-    flash_result_t result = FLASH_OK;
-    uint8_t sg0Tail, sg1Tail;
+    fmCtx.gcFixupImages[idx >> 3u] |= (uint8_t)(1u << (idx & 7u));
+}
 
-    memset(G_buffer1, 0, 256);
+/**
+ * @brief 按校验策略决定读取该图像的帧时是否计算CRC
+ * @param magic 图像数据页magic
+ */
+static boolean_t needVerify(uint8_t magic, uint8_t slotId)
+{
+    boolean_t verify = TRUE;
 
-    if (W25Q32_ReadData(FLASH_SEGMENT1_BASE - 0x100, G_buffer1, sizeof(segment_header_t)) != 0) 
+    if (fmCtx.verifyPolicy == FM_VERIFY_NONE)
     {
-        result = FLASH_ERROR_READ_FAIL;
+        verify = FALSE;
     }
-    else
+    else if (fmCtx.verifyPolicy == FM_VERIFY_ONCE)
     {
-        sg0Tail = G_buffer1[0];
+        verify = imageVerified((uint8_t)(slotId * 2u + (magic - MAGIC_BW_IMAGE_DATA))) ? FALSE : TRUE;
     }
+    return verify;
+}
 
-    if (result == FLASH_OK)
-    {
-        memset(G_buffer1, 0, 256);
+/**
+ * @brief 检查读到G_buffer1中的原样图像帧page，verify为FALSE时只检查page头，不计算CRC
+ */
+static flash_result_t checkFramePage(uint8_t magic, boolean_t verify)
+{
+    flash_result_t result = FLASH_OK;
 
-        if (W25Q32_ReadData(FLASH_TOTAL_SIZE - 0x100, G_buffer1, sizeof(segment_header_t)) != 0) 
-        {
-            result = FLASH_ERROR_READ_FAIL;
-        }
-        else
-        {
-            sg1Tail = G_buffer1[0];
-        }
+    if ((G_buffer1[0] != magic) || (G_buffer1[3] != PAYLOAD_SIZE))
+    {
+        result = FLASH_ERROR_INVALID_PARAM;
     }
-
-    if (result == FLASH_OK)
+    else if (verify && (calculate_crc32_default(&G_buffer1[FLASH_PAGE_HEADER_SIZE], PAYLOAD_SIZE) != readU32(&G_buffer1[4])))
     {
-        if ((sg0Tail == DATA_PAGE_MAGIC ||
-            sg0Tail == MAGIC_BW_IMAGE_DATA ||
-            sg0Tail == MAGIC_RED_IMAGE_DATA ||
-            sg0Tail == MAGIC_BW_IMAGE_HEADER ||
-            sg0Tail == MAGIC_RED_IMAGE_HEADER) && 
-            (sg1Tail != DATA_PAGE_MAGIC ||
-            sg1Tail != MAGIC_BW_IMAGE_DATA ||
-            sg1Tail != MAGIC_RED_IMAGE_DATA ||
-            sg1Tail != MAGIC_BW_IMAGE_HEADER ||
-            sg1Tail != MAGIC_RED_IMAGE_HEADER))
-        {
-            fmCtx.activeSegmentBaseStatus = MAGIC_LOW_ACTIVE;
-            UARTIF_uartPrintf(0, "regc flash_manager low active\n");
-        }
-        else if ((sg1Tail == DATA_PAGE_MAGIC ||
-            sg1Tail == MAGIC_BW_IMAGE_DATA ||
-            sg1Tail == MAGIC_RED_IMAGE_DATA ||
-            sg1Tail == MAGIC_BW_IMAGE_HEADER ||
-            sg1Tail == MAGIC_RED_IMAGE_HEADER) && 
-            (sg0Tail != DATA_PAGE_MAGIC ||
-            sg0Tail != MAGIC_BW_IMAGE_DATA ||
-            sg0Tail != MAGIC_RED_IMAGE_DATA ||
-            sg0Tail != MAGIC_BW_IMAGE_HEADER ||
-            sg0Tail != MAGIC_RED_IMAGE_HEADER))
-        {
-            fmCtx.activeSegmentBaseStatus = MAGIC_HIGH_ACTIVE;
-            UARTIF_uartPrintf(0, "regc flash_manager high active\n");
-        }
-        else if (sg0Tail == 0xff && sg1Tail == 0xff)
-        {
-            // to do: scan all pages to find last write page
-            // if not found, reset 2 segments
-            UARTIF_uartPrintf(0, "flash_manager no active segment, reset 2 segments\n");
-            result = FLASH_ERROR_INIT_FAIL;
-        }
-        else
-        {
-            UARTIF_uartPrintf(0, "ERR: flash_manager 0x09! regc error, reset 2 segments\n");
-            result = FLASH_ERROR_INIT_FAIL;
-        }
+        result = FLASH_ERROR_CRC_FAIL;
     }
-
     return result;
 }
 
-static flash_result_t checkArguments(uint8_t magic, uint16_t dataId, const uint8_t* data, uint16_t size)
+/**
+ * @brief 清空槽位缓存
+ */
+static void resetSlotCache(void)
 {
-    flash_result_t result = FLASH_OK;
-    uint8_t slotId, frameNum;
+    uint8_t i;
 
-    if (magic != MAGIC_BW_IMAGE_DATA && magic != MAGIC_RED_IMAGE_DATA && magic != DATA_PAGE_MAGIC
-        && magic != MAGIC_BW_IMAGE_HEADER && magic != MAGIC_RED_IMAGE_HEADER)
+    for (i = 0; i < FLASH_SLOT_CACHE_SIZE; i++)
     {
-        result = FLASH_ERROR_INVALID_PARAM;
+        fmCtx.slotCache[i].slotId = 0xff;
+        fmCtx.slotCache[i].color = 0xff;
+        fmCtx.slotCache[i].headers[0] = 0xffff;
+        fmCtx.slotCache[i].headers[1] = 0xffff;
     }
+    fmCtx.slotCacheNext = 0;
+}
 
-    if (data == NULL || size == 0 || size > PAYLOAD_SIZE)
+/**
+ * @brief 开始迁移旧格式：slotCache[n]用作旧的槽位n的映射表，槽位目录写入前不从Flash读取槽位
+ */
+static void pinSlotCache(void)
+{
+    uint8_t i;
+
+    resetSlotCache();
+    for (i = 0; i < LEGACY_SLOT_COUNT; i++)
+    {
+        fmCtx.slotCache[i].slotId = i;
+    }
+    memset(fmCtx.slotDirPages, 0xff, sizeof(fmCtx.slotDirPages));
+    fmCtx.slotCachePinned = 1;
+}
+
+/**
+ * @brief 从槽位目录page读取一个槽位（只读这5个字节，不校验目录page的CRC，图像头自身有CRC和槽位号）
+ */
+static void readSlotEntry(uint8_t slotId, fm_slot_entry_t* slot)
+{
+    uint16_t dirPage = fmCtx.slotDirPages[slotId / FLASH_SLOT_DIR_SLOTS];
+    uint8_t buf[SLOT_DIR_ENTRY_SIZE];
+
+    memset(buf, 0xff, sizeof(buf));
+    if (dirPage != 0xffff)
+    {
+        (void)W25Q32_ReadData(((uint32_t)dirPage << 8u) + FLASH_PAGE_HEADER_SIZE + (slotId % FLASH_SLOT_DIR_SLOTS) * SLOT_DIR_ENTRY_SIZE,
+                              buf, SLOT_DIR_ENTRY_SIZE);
+    }
+    slot->slotId = slotId;
+    slot->headers[0] = readU16(&buf[0]);
+    slot->headers[1] = readU16(&buf[2]);
+    slot->color = buf[4];
+}
+
+/**
+ * @brief 取得槽位的图像头地址和颜色标志，不在缓存中时从槽位目录读取并替换一个缓存项
+ * @return 缓存项，槽位号无效时返回NULL
+ */
+static fm_slot_entry_t* lookupSlot(uint8_t slotId)
+{
+    fm_slot_entry_t* slot = NULL;
+    uint8_t i;
+
+    if (slotId >= MAX_IMAGE_ENTRIES)
+    {
+        return NULL;
+    }
+    if (fmCtx.slotCachePinned)
+    {
+        // 迁移旧格式时缓存就是旧的8个槽位的映射表
+        return (slotId < LEGACY_SLOT_COUNT) ? &fmCtx.slotCache[slotId] : NULL;
+    }
+    for (i = 0; i < FLASH_SLOT_CACHE_SIZE; i++)
+    {
+        if (fmCtx.slotCache[i].slotId == slotId)
+        {
+            return &fmCtx.slotCache[i];
+        }
+    }
+    slot = &fmCtx.slotCache[fmCtx.slotCacheNext];
+    fmCtx.slotCacheNext = (uint8_t)((fmCtx.slotCacheNext + 1u) % FLASH_SLOT_CACHE_SIZE);
+    readSlotEntry(slotId, slot);
+    return slot;
+}
+
+/**
+ * @brief 第n个图像头的page（n = 槽位 * 2 + 颜色，0黑白、1红白），GC遍历全部图像头时使用，不经过缓存
+ */
+static uint16_t imageHeaderPage(uint16_t n)
+{
+    uint8_t slotId = (uint8_t)(n / 2u);
+    uint16_t dirPage = fmCtx.slotDirPages[slotId / FLASH_SLOT_DIR_SLOTS];
+    uint8_t buf[2];
+
+    if (fmCtx.slotCachePinned)
+    {
+        return (slotId < LEGACY_SLOT_COUNT) ? fmCtx.slotCache[slotId].headers[n % 2u] : 0xffff;
+    }
+    if (dirPage == 0xffff)
+    {
+        return 0xffff;
+    }
+    buf[0] = 0xff;
+    buf[1] = 0xff;
+    (void)W25Q32_ReadData(((uint32_t)dirPage << 8u) + FLASH_PAGE_HEADER_SIZE +
+                          (slotId % FLASH_SLOT_DIR_SLOTS) * SLOT_DIR_ENTRY_SIZE + (n % 2u) * 2u, buf, 2u);
+    return readU16(buf);
+}
+
+/**
+ * @brief 返回指定槽位的颜色标志（0 = BW, 1 = RED, 0xFF = 未知）
+ */
+uint8_t FM_getImageSlotColor(uint8_t slotId)
+{
+    fm_slot_entry_t* slot = lookupSlot(slotId);
+
+    return (slot != NULL) ? slot->color : 0xFFu;
+}
+
+/**
+ * @brief 查找接收中的图像记录
+ * @return 记录指针，没有时返回NULL
+ */
+static fm_image_stream_t* findImageStream(uint8_t magic, uint8_t slotId)
+{
+    uint8_t i;
+
+    for (i = 0; i < FLASH_IMAGE_STREAM_COUNT; i++)
+    {
+        if ((fmCtx.streams[i].magic == magic) && (fmCtx.streams[i].slotId == slotId))
+        {
+            return &fmCtx.streams[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 取得图像的接收记录，没有时占用空闲或已放弃的记录
+ * @return 记录指针，记录都在使用中时返回NULL（该图像写头时扫描日志）
+ */
+static fm_image_stream_t* openImageStream(uint8_t magic, uint8_t slotId)
+{
+    fm_image_stream_t* stream = findImageStream(magic, slotId);
+    uint8_t i;
+
+    for (i = 0; (i < FLASH_IMAGE_STREAM_COUNT) && (stream == NULL); i++)
+    {
+        if ((fmCtx.streams[i].magic == 0xff) || (fmCtx.streams[i].idle > MAX_FRAME_NUM + 1u))
+        {
+            stream = &fmCtx.streams[i];
+            stream->magic = magic;
+            stream->slotId = slotId;
+            memset(stream->frameCodes, 0xff, sizeof(stream->frameCodes));
+            stream->packPage = 0xffff;
+            stream->packUsed = 0;
+        }
+    }
+
+    // 已记录的帧不会因为记录被替换而丢失，记录只在长时间没有写入时才让出
+    for (i = 0; i < FLASH_IMAGE_STREAM_COUNT; i++)
+    {
+        if (&fmCtx.streams[i] == stream)
+        {
+            fmCtx.streams[i].idle = 0;
+        }
+        else if (fmCtx.streams[i].idle < 0xff)
+        {
+            fmCtx.streams[i].idle++;
+        }
+    }
+    return stream;
+}
+
+static void closeImageStream(uint8_t magic, uint8_t slotId)
+{
+    fm_image_stream_t* stream = findImageStream(magic, slotId);
+
+    if (stream != NULL)
+    {
+        stream->magic = 0xff;
+    }
+}
+
+/**
+ * @brief 接收记录中帧n所在的page
+ * @return page号，未记录时返回0xffff
+ */
+static uint16_t streamFramePage(const fm_image_stream_t* stream, uint8_t frame)
+{
+    uint8_t code = stream->frameCodes[frame];
+
+    if (code == 0xff)
+    {
+        return 0xffff;
+    }
+    return (uint16_t)(fmCtx.streamSectors[code >> 4] * FLASH_PAGES_PER_SECTOR + (code & 0x0fu));
+}
+
+/**
+ * @brief 扇区表项是否还被接收中的图像引用
+ */
+static uint8_t streamSectorUsed(uint8_t entry)
+{
+    uint8_t i;
+    uint8_t frame;
+
+    for (i = 0; i < FLASH_IMAGE_STREAM_COUNT; i++)
+    {
+        for (frame = 0; (fmCtx.streams[i].magic != 0xff) && (frame <= MAX_FRAME_NUM); frame++)
+        {
+            if ((fmCtx.streams[i].frameCodes[frame] != 0xff) && ((fmCtx.streams[i].frameCodes[frame] >> 4) == entry))
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 在接收记录中登记帧n所在的page；扇区表已满时该帧不登记，写图像头时退回扫描日志
+ */
+static void setStreamFrame(fm_image_stream_t* stream, uint8_t frame, uint16_t page)
+{
+    uint16_t sector = (uint16_t)(page / FLASH_PAGES_PER_SECTOR);
+    uint8_t entry;
+
+    // 先清掉本帧原来的记录，旧扇区的表项才能被复用
+    stream->frameCodes[frame] = 0xff;
+    entry = 0;
+    while ((entry < FLASH_STREAM_SECTOR_COUNT) && (fmCtx.streamSectors[entry] != sector))
+    {
+        entry++;
+    }
+    if (entry == FLASH_STREAM_SECTOR_COUNT)
+    {
+        // 新扇区：占用空表项或不再被引用的表项，每个扇区只发生一次
+        for (entry = 0; entry < FLASH_STREAM_SECTOR_COUNT; entry++)
+        {
+            if ((fmCtx.streamSectors[entry] == 0xffff) || !streamSectorUsed(entry))
+            {
+                fmCtx.streamSectors[entry] = sector;
+                break;
+            }
+        }
+        if (entry == FLASH_STREAM_SECTOR_COUNT)
+        {
+            return;
+        }
+    }
+    stream->frameCodes[frame] = (uint8_t)((entry << 4) | (page % FLASH_PAGES_PER_SECTOR));
+}
+
+/**
+ * @brief GC搬移page后更新接收中图像的帧地址；正在追加的压缩帧page原样复制，之后追加到新page
+ */
+static void relocateStreamPage(uint16_t srcPage, uint16_t newPage)
+{
+    uint8_t i;
+    uint8_t frame;
+
+    for (i = 0; i < FLASH_IMAGE_STREAM_COUNT; i++)
+    {
+        if ((fmCtx.streams[i].magic != 0xff) && (fmCtx.streams[i].packPage == srcPage))
+        {
+            fmCtx.streams[i].packPage = newPage;
+        }
+        for (frame = 0; frame <= MAX_FRAME_NUM; frame++)
+        {
+            if ((fmCtx.streams[i].magic != 0xff) && (streamFramePage(&fmCtx.streams[i], frame) == srcPage))
+            {
+                setStreamFrame(&fmCtx.streams[i], frame, newPage);
+            }
+        }
+    }
+}
+
+static uint16_t sectorOfPage(uint16_t page)
+{
+    return (uint16_t)(page / FLASH_PAGES_PER_SECTOR);
+}
+
+/**
+ * @brief page所在扇区即将被擦除（空闲列表中、正在擦除或正在回收），不能再被引用
+ */
+static boolean_t pageRetiring(uint16_t page)
+{
+    uint16_t sector = sectorOfPage(page);
+    uint8_t i;
+
+    if ((fmCtx.eraseBusy && sector == fmCtx.eraseSector) || (sector == fmCtx.gcVictim))
+    {
+        return TRUE;
+    }
+    for (i = 0; i < fmCtx.freeCount; i++)
+    {
+        if (fmCtx.freeSectors[i] == sector)
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief 在最近写入的图像帧中查找内容完全相同的page
+ * @return page，没有时返回0xffff
+ */
+static uint16_t findDuplicatePage(uint8_t magic, const uint8_t* data, uint8_t size, uint32_t crc32)
+{
+    uint8_t i;
+    uint16_t page;
+
+    for (i = 0; i < FLASH_DEDUP_CACHE_SIZE; i++)
+    {
+        page = fmCtx.dedup[i].page;
+        if ((page == 0xffff) || (fmCtx.dedup[i].crc32 != crc32) || pageRetiring(page))
+        {
+            continue;
+        }
+        // CRC相同还要逐字节比较；page被回收重写过时这里也会不一致
+        memset(G_buffer1, 0, FLASH_PAGE_SIZE);
+        if (W25Q32_ReadData((uint32_t)page << 8u, G_buffer1, FLASH_PAGE_HEADER_SIZE + size) == 0)
+        {
+            if ((G_buffer1[0] == magic) && (G_buffer1[3] == size) && (readU32(&G_buffer1[4]) == crc32) &&
+                (memcmp(&G_buffer1[FLASH_PAGE_HEADER_SIZE], data, size) == 0))
+            {
+                return page;
+            }
+        }
+        fmCtx.dedup[i].page = 0xffff;
+    }
+    return 0xffff;
+}
+
+static void rememberPage(uint16_t page, uint32_t crc32)
+{
+    fmCtx.dedup[fmCtx.dedupNext].crc32 = crc32;
+    fmCtx.dedup[fmCtx.dedupNext].page = page;
+    fmCtx.dedupNext = (uint8_t)((fmCtx.dedupNext + 1u) % FLASH_DEDUP_CACHE_SIZE);
+}
+
+/**
+ * @brief 在压缩帧page中查找帧的记录（同一page中一个帧号只有一条记录），找到时G_buffer1前4字节为记录头
+ * @param frameNum 帧号
+ * @param frames 非NULL时读取全部记录，输出page中有记录的帧（bit n对应帧n）
+ * @return 记录在page内的偏移，没有时返回0
+ */
+static uint8_t findPackedRecord(uint16_t page, uint8_t frameNum, uint64_t* frames)
+{
+    uint32_t addr = (uint32_t)page << 8u;
+    uint16_t offset;
+
+    if ((frames == NULL) && (page == packedReadPage) &&
+        (packedReadOffset + FLASH_PACKED_RECORD_HEADER_SIZE <= FLASH_PAGE_SIZE) &&
+        (W25Q32_ReadData(addr + packedReadOffset, G_buffer1, FLASH_PACKED_RECORD_HEADER_SIZE) == 0) &&
+        (G_buffer1[0] == frameNum))
+    {
+        return (uint8_t)packedReadOffset;
+    }
+    for (offset = FLASH_PAGE_HEADER_SIZE; offset + FLASH_PACKED_RECORD_HEADER_SIZE <= FLASH_PAGE_SIZE;
+         offset += FLASH_PACKED_RECORD_HEADER_SIZE + G_buffer1[1])
+    {
+        // 帧号为0xff：之后还没有写入记录
+        if ((W25Q32_ReadData(addr + offset, G_buffer1, FLASH_PACKED_RECORD_HEADER_SIZE) != 0) ||
+            (G_buffer1[0] > MAX_FRAME_NUM))
+        {
+            break;
+        }
+        if (frames != NULL)
+        {
+            *frames |= (uint64_t)1u << G_buffer1[0];
+        }
+        else if (G_buffer1[0] == frameNum)
+        {
+            return (uint8_t)offset;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 读取压缩帧page中的一帧，解压到data（PAYLOAD_SIZE字节）
+ * @param verify FALSE：不校验解压后数据的CRC
+ */
+static flash_result_t readPackedFrame(uint16_t page, uint8_t frameNum, uint8_t* data, boolean_t verify)
+{
+    flash_result_t result = FLASH_OK;
+    uint8_t offset = findPackedRecord(page, frameNum, NULL);
+    uint8_t len = G_buffer1[1];
+
+    if (offset == 0u)
+    {
+        result = FLASH_ERROR_NOT_FOUND;
+    }
+    else if (offset + FLASH_PACKED_RECORD_HEADER_SIZE + len > FLASH_PAGE_SIZE)
+    {
+        result = FLASH_ERROR_CRC_FAIL;
+    }
+    else
+    {
+        // 只读取这一条记录
+        if (W25Q32_ReadData(((uint32_t)page << 8u) + offset + FLASH_PACKED_RECORD_HEADER_SIZE,
+                            &G_buffer1[FLASH_PACKED_RECORD_HEADER_SIZE], len) != 0)
+        {
+            result = FLASH_ERROR_READ_FAIL;
+        }
+    }
+
+    if (result == FLASH_OK)
+    {
+        if ((rle_decode(&G_buffer1[FLASH_PACKED_RECORD_HEADER_SIZE], len, data, PAYLOAD_SIZE) != PAYLOAD_SIZE) ||
+            (verify && ((uint16_t)calculate_crc32_default(data, PAYLOAD_SIZE) != readU16(&G_buffer1[2]))))
+        {
+            result = FLASH_ERROR_CRC_FAIL;
+        }
+    }
+
+    if (result == FLASH_OK)
+    {
+        packedReadPage = page;
+        packedReadOffset = (uint16_t)(offset + FLASH_PACKED_RECORD_HEADER_SIZE + len);
+    }
+    return result;
+}
+
+/**
+ * @brief 依次解析数据记录页中的记录（整页在buf中），遇到未写入或校验失败的记录时停止
+ * @param dataId 0xff：回放，把每条记录应用到映射表（长度为0的记录表示删除）；否则查找该数据ID
+ * @return 该数据ID最后一条记录在page内的偏移，没有时返回0
+ */
+static uint8_t scanDataRecords(const uint8_t* buf, uint16_t page, uint8_t dataId)
+{
+    uint16_t offset;
+    uint8_t len = 0;
+    uint8_t found = 0;
+
+    for (offset = FLASH_PAGE_HEADER_SIZE; offset + FLASH_DATA_RECORD_OVERHEAD <= FLASH_PAGE_SIZE;
+         offset += FLASH_DATA_RECORD_OVERHEAD + len)
+    {
+        // 数据ID为0xff：之后还没有写入记录
+        len = buf[offset + 1u];
+        if ((buf[offset] >= MAX_DATA_ENTRIES) || (offset + FLASH_DATA_RECORD_OVERHEAD + len > FLASH_PAGE_SIZE) ||
+            ((uint16_t)calculate_crc32_default(&buf[offset], 2u + len) != readU16(&buf[offset + 2u + len])))
+        {
+            break;
+        }
+        if (dataId == 0xff)
+        {
+            fmCtx.dataEntries[buf[offset]] = (len != 0u) ? page : 0xffff;
+        }
+        else if (buf[offset] == dataId)
+        {
+            found = (uint8_t)offset;
+        }
+    }
+    return found;
+}
+
+static uint16_t sectorFirstPage(uint16_t sector)
+{
+    return (uint16_t)(sector * FLASH_PAGES_PER_SECTOR);
+}
+
+/**
+ * @brief 扇区头记录长度是否有效：当前格式、数据条目较少的格式或旧的8槽位格式
+ */
+static boolean_t sectorRecordSizeValid(uint8_t size)
+{
+    return ((size == SECTOR_RECORD_SIZE_V1) ||
+            ((size >= SECTOR_RECORD_SIZE_MIN) && (size <= SECTOR_RECORD_SIZE) && (((size - SECTOR_RECORD_SIZE_MIN) % 2u) == 0u))) ? TRUE : FALSE;
+}
+
+/**
+ * @brief 读取扇区头的seq、prevSector和擦除次数，只检查magic、id、size，不校验CRC
+ * @return TRUE 扇区头格式有效
+ */
+static boolean_t readSectorInfo(uint16_t sector, uint32_t* seq, uint16_t* prevSector, uint32_t* eraseCount)
+{
+    uint8_t probe[SECTOR_PROBE_SIZE];
+    boolean_t valid = FALSE;
+
+    if (W25Q32_ReadData((uint32_t)sector * FLASH_SECTOR_SIZE, probe, SECTOR_PROBE_SIZE) == 0)
+    {
+        if (probe[0] == SECTOR_HEADER_MAGIC && readU16(&probe[1]) == sector && sectorRecordSizeValid(probe[3]))
+        {
+            *seq = readU32(&probe[FLASH_PAGE_HEADER_SIZE]);
+            *prevSector = readU16(&probe[FLASH_PAGE_HEADER_SIZE + 4u]);
+            *eraseCount = readU32(&probe[FLASH_PAGE_HEADER_SIZE + 6u]);
+            valid = TRUE;
+        }
+    }
+    return valid;
+}
+
+/**
+ * @brief 扇区的擦除次数，没有扇区头（从未使用过）时为0
+ */
+static uint32_t sectorEraseCount(uint16_t sector)
+{
+    uint32_t seq;
+    uint16_t prevSector;
+    uint32_t eraseCount = 0;
+
+    if (!readSectorInfo(sector, &seq, &prevSector, &eraseCount))
+    {
+        eraseCount = 0;
+    }
+    return eraseCount;
+}
+
+/**
+ * @brief 在已擦除的扇区page 0写入扇区头：分配序号、上一个日志扇区、擦除次数和当前映射表快照
+ *        迁移旧格式的过程中（槽位目录还没写入）仍写旧格式的快照，迁移中途掉电时下次启动重新迁移
+ */
+static flash_result_t writeSectorHeader(uint16_t sector, uint16_t prevSector, uint32_t eraseCount)
+{
+    flash_result_t result = FLASH_OK;
+    uint8_t* p = &G_buffer1[FLASH_PAGE_HEADER_SIZE];
+    uint8_t size = SECTOR_RECORD_SIZE;
+    uint8_t i;
+
+    writeU32(p, fmCtx.sectorSeq + 1u);
+    p += 4;
+    writeU16(p, prevSector);
+    p += 2;
+    writeU32(p, eraseCount);
+    p += 4;
+    if (fmCtx.slotCachePinned)
+    {
+        // 旧格式的数据条目只有LEGACY_DATA_ENTRIES个，迁移中不会写入更大的数据ID
+        memcpy(p, fmCtx.dataEntries, LEGACY_DATA_ENTRIES * 2u);
+        p += LEGACY_DATA_ENTRIES * 2u;
+        for (i = 0; i < LEGACY_SLOT_COUNT; i++)
+        {
+            writeU16(&p[i * 2u], fmCtx.slotCache[i].headers[0]);
+            writeU16(&p[(LEGACY_SLOT_COUNT + i) * 2u], fmCtx.slotCache[i].headers[1]);
+            p[LEGACY_SLOT_COUNT * 4u + i] = fmCtx.slotCache[i].color;
+        }
+        size = SECTOR_RECORD_SIZE_V1;
+    }
+    else
+    {
+        memcpy(p, fmCtx.dataEntries, MAX_DATA_ENTRIES * 2u);
+        p += MAX_DATA_ENTRIES * 2u;
+        memcpy(p, fmCtx.slotDirPages, FLASH_SLOT_DIR_PAGES * 2u);
+    }
+
+    result = programPage((uint32_t)sector * FLASH_SECTOR_SIZE, SECTOR_HEADER_MAGIC, sector,
+                         &G_buffer1[FLASH_PAGE_HEADER_SIZE], size);
+    if (result == FLASH_OK)
+    {
+        fmCtx.sectorSeq++;
+    }
+    else
+    {
+        UARTIF_uartPrintf(0, "ERR: flash_manager 0x0A! write sector header 0x%03x fail\n", sector);
+    }
+    return result;
+}
+
+/**
+ * @brief 读取并校验扇区头，把其中的映射表快照加载到fmCtx
+ *        旧格式的快照（8个槽位的映射表）加载到slotCache并置slotCachePinned，由FM_init迁移到槽位目录
+ */
+static flash_result_t loadSectorSnapshot(uint16_t sector)
+{
+    flash_result_t result = FLASH_OK;
+    const uint8_t* p = &G_buffer1[FLASH_PAGE_HEADER_SIZE + SECTOR_INFO_SIZE];
+    uint8_t count;
+    uint8_t i;
+
+    memset(G_buffer1, 0, FLASH_PAGE_SIZE);
+    if (W25Q32_ReadData((uint32_t)sector * FLASH_SECTOR_SIZE, G_buffer1, FLASH_PAGE_SIZE) != 0)
+    {
+        result = FLASH_ERROR_READ_FAIL;
+    }
+    else if (G_buffer1[0] != SECTOR_HEADER_MAGIC || !sectorRecordSizeValid(G_buffer1[3]))
+    {
+        result = FLASH_ERROR_NOT_FOUND;
+    }
+    else if (calculate_crc32_default(&G_buffer1[FLASH_PAGE_HEADER_SIZE], G_buffer1[3]) != readU32(&G_buffer1[4]))
+    {
+        result = FLASH_ERROR_CRC_FAIL;
+    }
+
+    if (result == FLASH_OK)
+    {
+        count = (G_buffer1[3] == SECTOR_RECORD_SIZE_V1) ? LEGACY_DATA_ENTRIES :
+                (uint8_t)(LEGACY_DATA_ENTRIES + (G_buffer1[3] - SECTOR_RECORD_SIZE_MIN) / 2u);
+        memset(fmCtx.dataEntries, 0xff, sizeof(fmCtx.dataEntries));
+        memcpy(fmCtx.dataEntries, p, count * 2u);
+        p += count * 2u;
+        if (G_buffer1[3] == SECTOR_RECORD_SIZE_V1)
+        {
+            pinSlotCache();
+            for (i = 0; i < LEGACY_SLOT_COUNT; i++)
+            {
+                fmCtx.slotCache[i].headers[0] = readU16(&p[i * 2u]);
+                fmCtx.slotCache[i].headers[1] = readU16(&p[(LEGACY_SLOT_COUNT + i) * 2u]);
+                fmCtx.slotCache[i].color = p[LEGACY_SLOT_COUNT * 4u + i];
+            }
+        }
+        else
+        {
+            resetSlotCache();
+            memcpy(fmCtx.slotDirPages, p, FLASH_SLOT_DIR_PAGES * 2u);
+            fmCtx.slotCachePinned = 0;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief 扫描全部扇区头，找出分配序号小于limit的最新扇区；同时记下最大擦除次数和最冷的扇区
+ * @param limit 上一个候选扇区头CRC错误时，排除序号不小于它的扇区
+ * @param bestSeq 输出：找到的扇区的序号
+ * @param maxSeq 输出：全部扇区头中的最大序号（新扇区的序号必须比它大）
+ * @return 扇区号，没有时返回0xffff
+ */
+static uint16_t findNewestSector(uint32_t limit, uint32_t* bestSeq, uint32_t* maxSeq)
+{
+    uint16_t sector;
+    uint16_t best = 0xffff;
+    uint16_t prev;
+    uint32_t seq;
+    uint32_t eraseCount;
+
+    fmCtx.coldSector = 0xffff;
+    for (sector = 0; sector < fmCtx.sectorCount; sector++)
+    {
+        if (readSectorInfo(sector, &seq, &prev, &eraseCount))
+        {
+            if (seq > *maxSeq)
+            {
+                *maxSeq = seq;
+            }
+            if (eraseCount > fmCtx.wearMax)
+            {
+                fmCtx.wearMax = eraseCount;
+            }
+            if ((fmCtx.coldSector == 0xffff) || (eraseCount < fmCtx.coldEraseCount))
+            {
+                fmCtx.coldSector = sector;
+                fmCtx.coldEraseCount = eraseCount;
+            }
+            if ((seq < limit) && (best == 0xffff || seq > *bestSeq))
+            {
+                best = sector;
+                *bestSeq = seq;
+            }
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief 检查掉电时可能正在编程的page，只写了一部分时把magic改写为DEAD_PAGE_MAGIC作废，
+ *        否则回放时它会顶替映射表中之前的有效版本，之后的写入也会叠写在它上面
+ * @return TRUE page已作废
+ */
+static boolean_t dropTornPage(uint16_t page)
+{
+    uint8_t magic = DEAD_PAGE_MAGIC;
+    uint8_t i;
+    boolean_t torn = FALSE;
+
+    memset(G_buffer1, 0, FLASH_PAGE_SIZE);
+    if (W25Q32_ReadData((uint32_t)page << 8u, G_buffer1, FLASH_PAGE_SIZE) != 0)
+    {
+        return FALSE;
+    }
+    if (G_buffer1[0] == 0xff)
+    {
+        // page头还是擦除状态，其余部分也必须是
+        for (i = 1; (i != 0u) && !torn; i++)
+        {
+            torn = (G_buffer1[i] != 0xff) ? TRUE : FALSE;
+        }
+    }
+    else if (G_buffer1[0] == DATA_PAGE_MAGIC || G_buffer1[0] == MAGIC_BW_IMAGE_HEADER || G_buffer1[0] == MAGIC_RED_IMAGE_HEADER ||
+             G_buffer1[0] == MAGIC_BW_IMAGE_DATA || G_buffer1[0] == MAGIC_RED_IMAGE_DATA || G_buffer1[0] == SLOT_DIR_MAGIC ||
+             G_buffer1[0] == DATA_DELETED_MAGIC)
+    {
+        torn = ((G_buffer1[3] > PAYLOAD_SIZE) ||
+                (calculate_crc32_default(&G_buffer1[FLASH_PAGE_HEADER_SIZE], G_buffer1[3]) != readU32(&G_buffer1[4]))) ? TRUE : FALSE;
+    }
+    else if (G_buffer1[0] != MAGIC_BW_IMAGE_PACKED && G_buffer1[0] != MAGIC_RED_IMAGE_PACKED &&
+             G_buffer1[0] != DATA_PACKED_MAGIC && G_buffer1[0] != DEAD_PAGE_MAGIC)
+    {
+        // 压缩帧page和数据记录页的每条记录单独校验，其他magic说明page头没写完整
+        torn = TRUE;
+    }
+
+    if (torn)
+    {
+        UARTIF_uartPrintf(0, "ERR: flash_manager 0x0B! drop torn page 0x%04x\n", page);
+        (void)W25Q32_WritePage((uint32_t)page << 8u, &magic, 1u);
+    }
+    return torn;
+}
+
+/**
+ * @brief 回放最新扇区中快照之后写入的page，并把它作为当前写入扇区
+ */
+static void replaySector(uint16_t sector)
+{
+    uint16_t page;
+    uint16_t firstPage = (uint16_t)(sectorFirstPage(sector) + 1u);
+    uint16_t endPage = (uint16_t)(sectorFirstPage(sector) + FLASH_PAGES_PER_SECTOR);
+    uint16_t tailPage;
+
+    // 先二分定位日志尾部，再只读page头重建映射表
+    tailPage = findLogTail(firstPage, endPage);
+    // 掉电时正在编程的只可能是最后写入的page，或者page头还没写入的尾部page
+    if (tailPage != firstPage)
+    {
+        (void)dropTornPage((uint16_t)(tailPage - 1u));
+    }
+    if ((tailPage != endPage) && dropTornPage(tailPage))
+    {
+        tailPage++;
+    }
+    for (page = firstPage; page != tailPage; page++)
+    {
+        indexPage(page);
+    }
+
+    if (tailPage != endPage)
+    {
+        memset(G_buffer1, 0, FLASH_PAGE_HEADER_SIZE);
+        (void)W25Q32_ReadData((uint32_t)tailPage << 8u, G_buffer1, FLASH_PAGE_HEADER_SIZE);
+        if ((G_buffer1[1] == 0xff) && (G_buffer1[3] == 0xff))
+        {
+            UARTIF_uartPrintf(0, "flash_manager found last block! \n");
+        }
+        else
+        {
+            UARTIF_uartPrintf(0, "ERR: flash_manager 0x07! last block error\n");
+        }
+    }
+    // 扇区已写满时nextWriteAddress停在下一个扇区的page 0，下次写入时再分配新扇区
+    fmCtx.openSector = sector;
+    fmCtx.nextWriteAddress = tailPage;
+    UARTIF_uartPrintf(0, "flash_manager next write address is 0x%04x\n", fmCtx.nextWriteAddress);
+}
+
+/**
+ * @brief 从日志尾部往前查找图像的各帧（接收记录已被其他图像替换时使用）
+ */
+static flash_result_t scanImageDataPages(uint8_t magic, uint8_t slotId)
+{
+    uint16_t page = fmCtx.nextWriteAddress;
+    uint16_t sector = fmCtx.openSector;
+    uint16_t prevSector;
+    uint32_t seq;
+    uint32_t eraseCount;
+    uint8_t hops = 0;
+    uint8_t frameNum = 0;
+    uint64_t frameIsFull = 0x00;
+    flash_result_t re = FLASH_OK;
+    uint8_t pageMagic;
+    uint8_t pageSlotId;
+    uint64_t packedFrames;
+
+    invalidateImageCache();
+    while (sector != 0xffff)
+    {
+        if ((page % FLASH_PAGES_PER_SECTOR) == 1u)
+        {
+            // 本扇区已扫描完，沿扇区头的prevSector往前；最近的几个日志扇区不会被回收
+            hops++;
+            if (hops >= FLASH_LOG_GUARD_SECTORS || !readSectorInfo(sector, &seq, &prevSector, &eraseCount))
+            {
+                break;
+            }
+            sector = prevSector;
+            page = (uint16_t)(sectorFirstPage(sector) + FLASH_PAGES_PER_SECTOR);
+            continue;
+        }
+        page--;
+
+        // 只需要magic、帧号和槽位号
+        pageMagic = readPageHeader(page);
+        pageSlotId = G_buffer1[2];
+        if (pageMagic == 0xff)
+        {
+            // 提前关闭的扇区尾部没有写过
+            continue;
+        }
+
+        // 遇到本槽位上一次的图像头（id低字节为槽位号）说明更早的帧属于旧图像；其他槽位的帧和数据page跳过
+        if (pageMagic == (uint8_t)(magic - 2u) && G_buffer1[1] == slotId)
+        {
+            break;
+        }
+        if (pageMagic == PACKED_MAGIC(magic) && pageSlotId == slotId)
+        {
+            // 压缩帧page中的帧都由这个page引用
+            packedFrames = 0;
+            (void)findPackedRecord(page, 0xff, &packedFrames);
+            for (frameNum = 0; frameNum <= MAX_FRAME_NUM; frameNum++)
+            {
+                if ((packedFrames & ~frameIsFull & ((uint64_t)1u << frameNum)) != 0u)
+                {
+                    G_imageAddressBuffer[frameNum] = page;
+                }
+            }
+            frameIsFull |= packedFrames;
+            if (frameIsFull == 0x1FFFFFFFFFFFFFFF)
+            {
+                break;
+            }
+            continue;
+        }
+        if (pageMagic != magic || pageSlotId != slotId)
+        {
+            continue;
+        }
+
+        frameNum = G_buffer1[1];
+        if (frameNum > MAX_FRAME_NUM)
+        {
+            UARTIF_uartPrintf(0, "ERR: flash_manager 0x09! image frame num out of range: %d\n", frameNum);
+            re = FLASH_ERROR_IMAGE_FRAME_LOST;
+            break;
+        }
+        if ((frameIsFull & ((uint64_t)1u << frameNum)) != 0u)
+        {
+            // 重复的 frame 号，跳过
+            continue;
+        }
+        G_imageAddressBuffer[frameNum] = page;
+
+        frameIsFull |= ((uint64_t)1u << frameNum);
+        if (frameIsFull == 0x1FFFFFFFFFFFFFFF)
+        {
+            // 所有 61 个 frame 都找到了，完成
+            break;
+        }
+    }
+    if (re == FLASH_OK)
+    {
+        if (frameIsFull != 0x1FFFFFFFFFFFFFFF)
+        {
+            UARTIF_uartPrintf(0, "ERR: scanImageDataPages frame lost\r\n");
+            re = FLASH_ERROR_IMAGE_FRAME_LOST;
+        }
+    }
+    return re;
+}
+
+static flash_result_t readImageHeaderIntoBuffer(uint8_t magic, uint8_t slotId)
+{
+    // uint8_t i = 0;
+    flash_result_t result = FLASH_OK;
+    /* Read addresses plus one-byte color flag (if present).
+     * FM_readData returns FLASH_OK only if the page exists and CRC matches.
+     */
+    result = FM_readData(magic, slotId, (uint8_t*)G_imageAddressBuffer, IMAGE_HEADER_SIZE);
+
+    if (result != FLASH_OK)
+    {
+        memset(G_imageAddressBuffer, 0xff, sizeof(G_imageAddressBuffer));
+    }
+    return result;
+}
+
+/**
+ * @brief 旧版segment布局：两个segment头都是激活状态时，根据segment尾部判断哪个是写满的旧segment
+ */
+static flash_result_t judgeWhichSegmentIsActive(boolean_t* isHigh)
+{
+    flash_result_t result = FLASH_OK;
+    uint8_t sg0Tail, sg1Tail;
+
+    memset(G_buffer1, 0, 256);
+
+    if (W25Q32_ReadData(FLASH_SEGMENT1_BASE - 0x100, G_buffer1, sizeof(segment_header_t)) != 0)
+    {
+        result = FLASH_ERROR_READ_FAIL;
+    }
+    else
+    {
+        sg0Tail = G_buffer1[0];
+    }
+
+    if (result == FLASH_OK)
+    {
+        memset(G_buffer1, 0, 256);
+
+        if (W25Q32_ReadData(FLASH_TOTAL_SIZE - 0x100, G_buffer1, sizeof(segment_header_t)) != 0)
+        {
+            result = FLASH_ERROR_READ_FAIL;
+        }
+        else
+        {
+            sg1Tail = G_buffer1[0];
+        }
+    }
+
+    if (result == FLASH_OK)
+    {
+        if ((sg0Tail == DATA_PAGE_MAGIC ||
+            sg0Tail == MAGIC_BW_IMAGE_DATA ||
+            sg0Tail == MAGIC_RED_IMAGE_DATA ||
+            sg0Tail == MAGIC_BW_IMAGE_HEADER ||
+            sg0Tail == MAGIC_RED_IMAGE_HEADER) &&
+            (sg1Tail != DATA_PAGE_MAGIC ||
+            sg1Tail != MAGIC_BW_IMAGE_DATA ||
+            sg1Tail != MAGIC_RED_IMAGE_DATA ||
+            sg1Tail != MAGIC_BW_IMAGE_HEADER ||
+            sg1Tail != MAGIC_RED_IMAGE_HEADER))
+        {
+            *isHigh = FALSE;
+            UARTIF_uartPrintf(0, "regc flash_manager low active\n");
+        }
+        else if ((sg1Tail == DATA_PAGE_MAGIC ||
+            sg1Tail == MAGIC_BW_IMAGE_DATA ||
+            sg1Tail == MAGIC_RED_IMAGE_DATA ||
+            sg1Tail == MAGIC_BW_IMAGE_HEADER ||
+            sg1Tail == MAGIC_RED_IMAGE_HEADER) &&
+            (sg0Tail != DATA_PAGE_MAGIC ||
+            sg0Tail != MAGIC_BW_IMAGE_DATA ||
+            sg0Tail != MAGIC_RED_IMAGE_DATA ||
+            sg0Tail != MAGIC_BW_IMAGE_HEADER ||
+            sg0Tail != MAGIC_RED_IMAGE_HEADER))
+        {
+            *isHigh = TRUE;
+            UARTIF_uartPrintf(0, "regc flash_manager high active\n");
+        }
+        else
+        {
+            UARTIF_uartPrintf(0, "ERR: flash_manager 0x09! regc error\n");
+            result = FLASH_ERROR_INIT_FAIL;
+        }
+    }
+
+    return result;
+}
+
+static flash_result_t checkArguments(uint8_t magic, uint16_t dataId, const uint8_t* data, uint16_t size)
+{
+    flash_result_t result = FLASH_OK;
+    uint8_t slotId, frameNum;
+
+    if (magic != MAGIC_BW_IMAGE_DATA && magic != MAGIC_RED_IMAGE_DATA && magic != DATA_PAGE_MAGIC
+        && magic != MAGIC_BW_IMAGE_HEADER && magic != MAGIC_RED_IMAGE_HEADER)
+    {
+        result = FLASH_ERROR_INVALID_PARAM;
+    }
+
+    if (data == NULL || size == 0 || size > PAYLOAD_SIZE)
+    {
+        result = FLASH_ERROR_INVALID_PARAM;
+    }
+
+    if (magic == DATA_PAGE_MAGIC && dataId >= MAX_DATA_ENTRIES)
+    {
+        result = FLASH_ERROR_INVALID_PARAM;
+    }
+
+    if ((magic == MAGIC_BW_IMAGE_HEADER || magic == MAGIC_RED_IMAGE_HEADER) && dataId >= MAX_IMAGE_ENTRIES)
+    {
+        result = FLASH_ERROR_INVALID_PARAM;
+    }
+
+    if (magic == MAGIC_BW_IMAGE_DATA || magic == MAGIC_RED_IMAGE_DATA)
+    {
+        slotId = (uint8_t)((dataId & 0xff00u) >> 8u);
+        frameNum = (uint8_t)(dataId & 0xffu);
+        if (slotId >= MAX_IMAGE_ENTRIES || frameNum > MAX_FRAME_NUM)
+        {
+            result = FLASH_ERROR_INVALID_PARAM;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief 后台擦除完成后的登记：擦除的是空闲列表首个扇区时，分配时不必再擦
+ */
+static void eraseDone(void)
+{
+    uint32_t elapsed = fmTickMs - fmCtx.eraseStartMs;
+
+    fmCtx.eraseBusy = 0;
+    fmCtx.erases++;
+    fmCtx.eraseTotalMs += elapsed;
+    if (elapsed > fmCtx.eraseMaxMs)
+    {
+        fmCtx.eraseMaxMs = elapsed;
+    }
+    if ((fmCtx.freeCount > 0u) && (fmCtx.freeSectors[0] == fmCtx.eraseSector))
+    {
+        fmCtx.spareErased = 1;
+    }
+}
+
+/**
+ * @brief 前台写入Flash前等待后台擦除完成（擦除期间Flash不响应编程命令）
+ *        读取不需要等待：W25Q32_ReadData暂停擦除后读取，FM_process查询擦除状态时恢复
+ */
+static void waitForErase(void)
+{
+    if (fmCtx.eraseBusy)
+    {
+        W25Q32_WaitForReady();
+        eraseDone();
+    }
+}
+
+static void startErase(uint16_t sector)
+{
+    W25Q32_StartEraseSector((uint32_t)sector * FLASH_SECTOR_SIZE);
+    fmCtx.eraseSector = sector;
+    fmCtx.eraseStartMs = fmTickMs;
+    fmCtx.eraseBusy = 1;
+}
+
+/**
+ * @brief 阻塞擦除一个扇区（启动和迁移时），与后台擦除一样计入擦除统计
+ */
+static void eraseSectorNow(uint16_t sector)
+{
+    waitForErase();
+    startErase(sector);
+    waitForErase();
+}
+
+/**
+ * @brief 扇区在坏扇区列表中的序号
+ * @return FLASH_BAD_SECTOR_LIST_SIZE：不在列表中
+ */
+static uint8_t badSectorIndex(uint16_t sector)
+{
+    uint8_t i;
+
+    for (i = 0; (i < fmCtx.badCount) && (fmCtx.badSectors[i] != sector); i++)
+    {
+    }
+    return (i < fmCtx.badCount) ? i : FLASH_BAD_SECTOR_LIST_SIZE;
+}
+
+/**
+ * @brief 扇区头是否完整有效：magic、id、size正确且CRC校验通过，不占用G_buffer1
+ */
+static boolean_t sectorHeaderValid(uint16_t sector)
+{
+    uint8_t chunk[16];
+    uint32_t addr = (uint32_t)sector * FLASH_SECTOR_SIZE;
+    uint32_t crc = 0;
+    uint32_t expected;
+    uint8_t size;
+    uint8_t offset;
+    uint8_t len;
+
+    if ((W25Q32_ReadData(addr, chunk, FLASH_PAGE_HEADER_SIZE) != 0) ||
+        (chunk[0] != SECTOR_HEADER_MAGIC) || (readU16(&chunk[1]) != sector) || !sectorRecordSizeValid(chunk[3]))
+    {
+        return FALSE;
+    }
+    size = chunk[3];
+    expected = readU32(&chunk[4]);
+    for (offset = 0; offset < size; offset = (uint8_t)(offset + len))
+    {
+        len = (uint8_t)(size - offset);
+        if (len > sizeof(chunk))
+        {
+            len = sizeof(chunk);
+        }
+        if (W25Q32_ReadData(addr + FLASH_PAGE_HEADER_SIZE + offset, chunk, len) != 0)
+        {
+            return FALSE;
+        }
+        crc = calculate_crc32_update(crc, chunk, len);
+    }
+    return (crc == expected) ? TRUE : FALSE;
+}
+
+/**
+ * @brief 找到或加入坏扇区列表：列表已满时替换一个可疑扇区，没有时替换一个已搬空的坏扇区
+ *        （之后由扇区头中的标记识别，见badOverflow）；有效page还没有搬走的扇区不替换
+ * @return FLASH_BAD_SECTOR_LIST_SIZE：无法加入
+ */
+static uint8_t trackBadSector(uint16_t sector)
+{
+    uint8_t i = badSectorIndex(sector);
+    uint8_t j;
+
+    if (i != FLASH_BAD_SECTOR_LIST_SIZE)
+    {
+        return i;
+    }
+    if (fmCtx.badCount < FLASH_BAD_SECTOR_LIST_SIZE)
+    {
+        i = fmCtx.badCount;
+        fmCtx.badCount++;
+    }
+    else
+    {
+        for (j = 0; j < FLASH_BAD_SECTOR_LIST_SIZE; j++)
+        {
+            if ((fmCtx.badPending & (1u << j)) != 0u)
+            {
+                continue;
+            }
+            if (fmCtx.badFaults[j] < FLASH_BAD_SECTOR_FAULTS)
+            {
+                i = j;
+                break;
+            }
+            if (i == FLASH_BAD_SECTOR_LIST_SIZE)
+            {
+                i = j;
+            }
+        }
+        if (i == FLASH_BAD_SECTOR_LIST_SIZE)
+        {
+            return i;
+        }
+        if (fmCtx.badFaults[i] >= FLASH_BAD_SECTOR_FAULTS)
+        {
+            fmCtx.badOverflow = 1;
+        }
+    }
+    fmCtx.badSectors[i] = sector;
+    fmCtx.badFaults[i] = 0;
+    return i;
+}
+
+/**
+ * @brief 扇区头page是否带有坏扇区标记；只有扇区头完整有效时才认标记，
+ *        旧布局迁移来的扇区page 0是普通数据，最后一个字节可能恰好等于标记
+ */
+static boolean_t sectorMarkedBad(uint16_t sector)
+{
+    uint8_t mark = 0xff;
+
+    (void)W25Q32_ReadData((uint32_t)sector * FLASH_SECTOR_SIZE + FLASH_PAGE_SIZE - 1u, &mark, 1u);
+    return ((mark == FLASH_BAD_SECTOR_MARK) && sectorHeaderValid(sector)) ? TRUE : FALSE;
+}
+
+/**
+ * @brief 扇区是否为坏扇区：在坏扇区列表中且已标记，或扇区头page带有坏扇区标记（上电前标记的）
+ */
+static boolean_t sectorIsBad(uint16_t sector)
+{
+    uint8_t i = badSectorIndex(sector);
+
+    if (i != FLASH_BAD_SECTOR_LIST_SIZE)
+    {
+        return (fmCtx.badFaults[i] >= FLASH_BAD_SECTOR_FAULTS) ? TRUE : FALSE;
+    }
+    if (!sectorMarkedBad(sector))
+    {
+        return FALSE;
+    }
+    i = trackBadSector(sector);
+    if (i != FLASH_BAD_SECTOR_LIST_SIZE)
+    {
+        fmCtx.badFaults[i] = FLASH_BAD_SECTOR_FAULTS;
+    }
+    else
+    {
+        fmCtx.badOverflow = 1;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 统计空闲扇区用：只查坏扇区列表，有坏扇区被挤出列表时才读取扇区头中的标记
+ */
+static boolean_t knownBadSector(uint16_t sector)
+{
+    uint8_t i = badSectorIndex(sector);
+
+    if (i != FLASH_BAD_SECTOR_LIST_SIZE)
+    {
+        return (fmCtx.badFaults[i] >= FLASH_BAD_SECTOR_FAULTS) ? TRUE : FALSE;
+    }
+    return fmCtx.badOverflow ? sectorMarkedBad(sector) : FALSE;
+}
+
+/**
+ * @brief 把扇区加入空闲列表（已在列表中或列表已满时忽略）
+ * @return FALSE 坏扇区，不能加入
+ */
+static boolean_t pushFreeSector(uint16_t sector)
+{
+    uint8_t i;
+
+    for (i = 0; i < fmCtx.freeCount; i++)
+    {
+        if (fmCtx.freeSectors[i] == sector)
+        {
+            return TRUE;
+        }
+    }
+    if (fmCtx.freeCount >= FLASH_FREE_LIST_SIZE)
+    {
+        return TRUE;
+    }
+    if (sectorIsBad(sector))
+    {
+        return FALSE;
+    }
+
+    fmCtx.freeSectors[fmCtx.freeCount] = sector;
+    fmCtx.freeCount++;
+    return TRUE;
+}
+
+/**
+ * @brief 把空闲列表中擦除次数最少的扇区换到首部，下一次分配使用它
+ * @return 该扇区的擦除次数
+ */
+static uint32_t preferLeastWornFree(void)
+{
+    uint8_t i;
+    uint8_t best = 0;
+    uint16_t sector;
+    uint32_t eraseCount;
+    uint32_t bestCount = 0xffffffff;
+
+    for (i = 0; i < fmCtx.freeCount; i++)
+    {
+        eraseCount = sectorEraseCount(fmCtx.freeSectors[i]);
+        if (eraseCount < bestCount)
+        {
+            best = i;
+            bestCount = eraseCount;
+        }
+    }
+    sector = fmCtx.freeSectors[best];
+    fmCtx.freeSectors[best] = fmCtx.freeSectors[0];
+    fmCtx.freeSectors[0] = sector;
+    return bestCount;
+}
+
+/**
+ * @brief 扇区是否在最近写入的FLASH_LOG_GUARD_SECTORS个日志扇区中
+ */
+static boolean_t sectorInLogGuard(uint16_t target)
+{
+    uint16_t sector = fmCtx.openSector;
+    uint16_t prevSector;
+    uint32_t seq;
+    uint32_t eraseCount;
+    uint8_t i;
+
+    for (i = 0; (i < FLASH_LOG_GUARD_SECTORS) && (sector != 0xffff); i++)
+    {
+        if (sector == target)
+        {
+            return TRUE;
+        }
+        if (!readSectorInfo(sector, &seq, &prevSector, &eraseCount))
+        {
+            break;
+        }
+        sector = prevSector;
+    }
+    return FALSE;
+}
+
+static void popFreeSector(void)
+{
+    fmCtx.freeCount--;
+    memmove(&fmCtx.freeSectors[0], &fmCtx.freeSectors[1], fmCtx.freeCount * sizeof(uint16_t));
+    fmCtx.spareErased = 0;
+}
+
+/**
+ * @brief 从Flash上的图像头page中读出一个帧地址，frame为HEADER_READ_CHUNK的整数倍时读入下一段到chunk
+ *        不使用G_imageAddressBuffer：图像头在其中组包时分配扇区也要统计有效page
+ */
+static uint16_t readHeaderFrame(uint16_t page, uint8_t frame, uint16_t* chunk)
+{
+    if ((frame % HEADER_READ_CHUNK) == 0u)
+    {
+        memset(chunk, 0xff, HEADER_READ_CHUNK * 2u);
+        (void)W25Q32_ReadData(((uint32_t)page << 8u) + FLASH_PAGE_HEADER_SIZE + frame * 2u, (uint8_t*)chunk, HEADER_READ_CHUNK * 2u);
+    }
+    return chunk[frame % HEADER_READ_CHUNK];
+}
+
+/**
+ * @brief 窗口内扇区的有效page数：G_buffer1每字节存两个扇区，每个4bit，饱和到15
+ */
+static uint8_t liveCount(uint16_t windowFirst, uint16_t sector)
+{
+    uint16_t i = (uint16_t)(sector - windowFirst);
+
+    return (uint8_t)((G_buffer1[i >> 1u] >> ((i & 1u) * 4u)) & 0x0Fu);
+}
+
+static void addLive(uint16_t windowFirst, uint16_t sector, uint8_t count)
+{
+    uint16_t i;
+    uint8_t live;
+
+    if ((sector >= windowFirst) && (sector < windowFirst + FLASH_SCAN_WINDOW_SECTORS) && (sector < fmCtx.sectorCount))
+    {
+        i = (uint16_t)(sector - windowFirst);
+        live = (uint8_t)(liveCount(windowFirst, sector) + count);
+        if (live > 0x0Fu)
+        {
+            live = 0x0Fu;
+        }
+        G_buffer1[i >> 1u] = (uint8_t)((G_buffer1[i >> 1u] & ~(0x0Fu << ((i & 1u) * 4u))) | (live << ((i & 1u) * 4u)));
+    }
+}
+
+/**
+ * @brief 统计窗口内每个扇区被映射表和图像头引用的page数
+ */
+static void countLivePages(uint16_t windowFirst)
+{
+    uint16_t chunk[HEADER_READ_CHUNK];
+    uint16_t idx;
+    uint16_t other;
+    uint8_t frame;
+    uint16_t page;
+    uint16_t framePage;
+
+    memset(G_buffer1, 0, FLASH_PAGE_SIZE);
+    for (idx = 0; idx < MAX_DATA_ENTRIES; idx++)
+    {
+        // 同一数据记录页中的多个条目只算一个page
+        page = fmCtx.dataEntries[idx];
+        for (other = 0; (other < idx) && (fmCtx.dataEntries[other] != page); other++)
+        {
+        }
+        if ((page != 0xffff) && (other == idx))
+        {
+            addLive(windowFirst, sectorOfPage(page), 1u);
+        }
+    }
+    for (idx = 0; idx < FLASH_SLOT_DIR_PAGES; idx++)
+    {
+        if (fmCtx.slotDirPages[idx] != 0xffff)
+        {
+            addLive(windowFirst, sectorOfPage(fmCtx.slotDirPages[idx]), 1u);
+        }
+    }
+    for (idx = 0; idx < MAX_IMAGE_ENTRIES * 2u; idx++)
+    {
+        page = imageHeaderPage(idx);
+        if (page == 0xffff)
+        {
+            continue;
+        }
+        addLive(windowFirst, sectorOfPage(page), 1u);
+        for (frame = 0; frame <= MAX_FRAME_NUM; frame++)
+        {
+            framePage = readHeaderFrame(page, frame, chunk);
+            if (framePage != 0xffff)
+            {
+                addLive(windowFirst, sectorOfPage(framePage), 1u);
+            }
+        }
+    }
+
+    // 接收中图像已写入的帧
+    for (idx = 0; idx < FLASH_IMAGE_STREAM_COUNT; idx++)
+    {
+        for (frame = 0; frame <= MAX_FRAME_NUM; frame++)
+        {
+            page = streamFramePage(&fmCtx.streams[idx], frame);
+            if ((fmCtx.streams[idx].magic != 0xff) && (page != 0xffff))
+            {
+                addLive(windowFirst, sectorOfPage(page), 1u);
+            }
+        }
+    }
+}
+
+/**
+ * @brief 最近的日志扇区、正在回收的扇区和可分配范围外的扇区记为15：既不算空闲，也不会被选为回收扇区
+ */
+static void reserveSectors(uint16_t windowFirst)
+{
+    uint16_t idx;
+    uint16_t sector;
+    uint16_t prevSector;
+    uint32_t seq;
+    uint32_t eraseCount;
+
+    sector = fmCtx.openSector;
+    for (idx = 0; (idx < FLASH_LOG_GUARD_SECTORS) && (sector != 0xffff); idx++)
+    {
+        addLive(windowFirst, sector, 0x0Fu);
+        if (!readSectorInfo(sector, &seq, &prevSector, &eraseCount))
+        {
+            break;
+        }
+        sector = prevSector;
+    }
+
+    for (sector = windowFirst; (sector < windowFirst + FLASH_SCAN_WINDOW_SECTORS) && (sector < fmCtx.sectorCount); sector++)
+    {
+        if ((sector < fmCtx.allocFirstSector) || (sector >= fmCtx.allocEndSector) ||
+            (sector == fmCtx.gcSkipSector) || (sector == fmCtx.gcVictim))
+        {
+            addLive(windowFirst, sector, 0x0Fu);
+        }
+    }
+}
+
+static void scanBegin(fm_sector_scan_t* scan)
+{
+    scan->victim = 0xffff;
+    scan->minLive = FLASH_LOG_PAGES_PER_SECTOR;
+    scan->added = 0;
+    scan->freeTotal = 0;
+}
+
+/**
+ * @brief 统计一个窗口：不含有效page的扇区从allocCursor起依次加入空闲列表，同时记下有效page最少的扇区
+ */
+static void scanSectorWindow(uint16_t windowFirst, fm_sector_scan_t* scan)
+{
+    uint16_t sector;
+    uint8_t live;
+
+    countLivePages(windowFirst);
+    reserveSectors(windowFirst);
+    for (sector = windowFirst; (sector < windowFirst + FLASH_SCAN_WINDOW_SECTORS) && (sector < fmCtx.sectorCount); sector++)
+    {
+        live = liveCount(windowFirst, sector);
+        if (live == 0u)
+        {
+            // 坏扇区搬空后不再分配，也不算空闲扇区
+            if (!knownBadSector(sector))
+            {
+                scan->freeTotal++;
+                if ((sector >= fmCtx.allocCursor) && (fmCtx.freeCount < FLASH_FREE_LIST_SIZE) && pushFreeSector(sector))
+                {
+                    fmCtx.allocCursor = (uint16_t)(sector + 1u);
+                    scan->added++;
+                }
+            }
+        }
+        else if (live < scan->minLive)
+        {
+            scan->victim = sector;
+            scan->minLive = live;
+        }
+    }
+}
+
+/**
+ * @brief 一轮统计结束：轮换到芯片末尾后从头开始
+ * @return TRUE 空闲扇区不足，需要回收scan->victim
+ */
+static boolean_t scanEnd(const fm_sector_scan_t* scan)
+{
+    if ((scan->added == 0u) && (scan->freeTotal > fmCtx.freeCount))
+    {
+        fmCtx.allocCursor = 0;
+    }
+    return ((scan->freeTotal < FLASH_FREE_SECTOR_RESERVE) && (scan->victim != 0xffff)) ? TRUE : FALSE;
+}
+
+/**
+ * @brief 阻塞统计全部窗口，补充空闲扇区列表
+ */
+static boolean_t refillFreeSectors(fm_sector_scan_t* scan)
+{
+    uint16_t windowFirst;
+    boolean_t needGc;
+
+    scanBegin(scan);
+    for (windowFirst = 0; windowFirst < fmCtx.sectorCount; windowFirst += FLASH_SCAN_WINDOW_SECTORS)
+    {
+        scanSectorWindow(windowFirst, scan);
+    }
+    needGc = scanEnd(scan);
+    if ((fmCtx.freeCount == 0u) && (scan->freeTotal > 0u))
+    {
+        // 空闲扇区都在轮换起点之前，从头再统计一次
+        scanBegin(scan);
+        for (windowFirst = 0; windowFirst < fmCtx.sectorCount; windowFirst += FLASH_SCAN_WINDOW_SECTORS)
+        {
+            scanSectorWindow(windowFirst, scan);
+        }
+        needGc = scanEnd(scan);
+    }
+    return needGc;
+}
+
+/**
+ * @brief 保证空闲列表非空；没有完全无效的扇区时阻塞回收有效page最少的扇区
+ */
+static flash_result_t ensureFreeSector(void)
+{
+    fm_sector_scan_t scan;
+    uint8_t tries;
+
+    for (tries = 0; (tries < FLASH_FREE_SECTOR_RESERVE) && (fmCtx.freeCount == 0u); tries++)
+    {
+        (void)refillFreeSectors(&scan);
+        if ((fmCtx.freeCount > 0u) || fmCtx.gcInProgress)
+        {
+            break;
+        }
+        if ((fmCtx.gcState == FM_GC_IDLE) && (scan.victim != 0xffff))
+        {
+            gcLoadVictim(scan.victim);
+        }
+        if (fmCtx.gcState == FM_GC_IDLE)
+        {
+            break;
+        }
+        (void)gcFinish();
+    }
+    return (fmCtx.freeCount > 0u) ? FLASH_OK : FLASH_ERROR_NO_SPACE;
+}
+
+/**
+ * @brief 关闭当前日志扇区，从空闲列表取一个扇区擦除后写入扇区头
+ */
+static flash_result_t openNewSector(void)
+{
+    flash_result_t result = FLASH_OK;
+    uint16_t sector;
+    uint32_t eraseCount;
+
+    if (fmCtx.freeCount == 0u)
+    {
+        result = ensureFreeSector();
+    }
+
+    if (result == FLASH_OK)
+    {
+        waitForErase();
+        if (fmCtx.spareErased)
+        {
+            eraseCount = fmCtx.spareEraseCount;
+        }
+        else
+        {
+            // 擦除前从旧扇区头取出擦除次数
+            eraseCount = preferLeastWornFree() + 1u;
+            startErase(fmCtx.freeSectors[0]);
+            waitForErase();
+        }
+        sector = fmCtx.freeSectors[0];
+        popFreeSector();
+        fmCtx.scanNeeded = 1;
+        if (eraseCount > fmCtx.wearMax)
+        {
+            fmCtx.wearMax = eraseCount;
+        }
+        if (fmCtx.coldSector == 0xffff)
+        {
+            fmCtx.wearScanNeeded = 1;
+        }
+        result = writeSectorHeader(sector, fmCtx.openSector, eraseCount);
+        if (result == FLASH_OK)
+        {
+            fmCtx.openSector = sector;
+            fmCtx.nextWriteAddress = (uint16_t)(sectorFirstPage(sector) + 1u);
+        }
+    }
+
+    if (result != FLASH_OK)
+    {
+        UARTIF_uartPrintf(0, "ERR: flash_manager 0x08! open sector error: %d\n", result);
+    }
+    return result;
+}
+
+/**
+ * @brief 当前扇区写满（或还没有打开扇区）时分配新扇区
+ */
+static flash_result_t ensureWritablePage(void)
+{
+    flash_result_t result = FLASH_OK;
+
+    if ((fmCtx.nextWriteAddress == 0xffff) || ((fmCtx.nextWriteAddress % FLASH_PAGES_PER_SECTOR) == 0u))
+    {
+        result = openNewSector();
+    }
+    return result;
+}
+
+/**
+ * @brief 在日志尾部写入一个page
+ * @param page 输出：写入的page
+ */
+static flash_result_t appendPage(uint8_t magic, uint16_t dataId, const uint8_t* data, uint8_t size, uint16_t* page)
+{
+    flash_result_t result = ensureWritablePage();
+
+    if (result == FLASH_OK)
+    {
+        result = programPage((uint32_t)fmCtx.nextWriteAddress << 8u, magic, dataId, data, size);
+    }
+    if (result == FLASH_OK)
+    {
+        *page = fmCtx.nextWriteAddress;
+        fmCtx.nextWriteAddress++;
+    }
+    return result;
+}
+
+/**
+ * @brief 把一个page原样复制到日志尾部，复制后G_buffer1中为该page内容
+ */
+static flash_result_t appendCopy(uint16_t srcPage, uint16_t* page)
+{
+    flash_result_t result = ensureWritablePage();
+
+    if (result == FLASH_OK)
+    {
+        result = copyPage(srcPage, fmCtx.nextWriteAddress);
+    }
+    if (result == FLASH_OK)
+    {
+        *page = fmCtx.nextWriteAddress;
+        fmCtx.nextWriteAddress++;
+    }
+    return result;
+}
+
+/**
+ * @brief 把图像帧RLE压缩后追加到该图像的压缩帧page，放不下时在日志尾部新开一个page
+ *        每次只编程记录占用的字节；page头的size和crc32保持擦除状态，由每条记录单独校验
+ * @param page 输出：帧所在的page
+ * @return FLASH_ERROR_NO_SPACE：压缩后一个page也放不下，调用者按原样写入
+ */
+static flash_result_t appendPackedFrame(fm_image_stream_t* stream, uint8_t magic, uint8_t frameNum,
+                                        const uint8_t* data, uint32_t crc32, uint16_t* page)
+{
+    // 先分配好写入位置：分配扇区时可能阻塞回收，回收会改写G_buffer1并搬移压缩帧page
+    flash_result_t result = ensureWritablePage();
+    uint8_t* record = &G_buffer1[FLASH_PAGE_HEADER_SIZE];
+    uint8_t size = 0;
+
+    if (result == FLASH_OK)
+    {
+        size = (uint8_t)rle_encode(data, PAYLOAD_SIZE, &record[FLASH_PACKED_RECORD_HEADER_SIZE],
+                                   PAYLOAD_SIZE - FLASH_PACKED_RECORD_HEADER_SIZE);
+        if (size == 0u)
+        {
+            result = FLASH_ERROR_NO_SPACE;
+        }
+    }
+
+    if (result == FLASH_OK)
+    {
+        record[0] = frameNum;
+        record[1] = size;
+        writeU16(&record[2], (uint16_t)crc32);
+        size += FLASH_PACKED_RECORD_HEADER_SIZE;
+        // 同一page中每个帧号只有一条记录，重传的帧写到新page
+        if ((stream->packPage != 0xffff) && (stream->packUsed + size <= PAYLOAD_SIZE) &&
+            (streamFramePage(stream, frameNum) != stream->packPage))
+        {
+            if (startWritePage(((uint32_t)stream->packPage << 8u) + FLASH_PAGE_HEADER_SIZE + stream->packUsed,
+                                      record, size) != 0)
+            {
+                result = FLASH_ERROR_WRITE_FAIL;
+            }
+        }
+        else
+        {
+            memset(G_buffer1, 0xff, FLASH_PAGE_HEADER_SIZE);
+            G_buffer1[0] = PACKED_MAGIC(magic);
+            G_buffer1[1] = frameNum;
+            G_buffer1[2] = stream->slotId;
+            if (startWritePage((uint32_t)fmCtx.nextWriteAddress << 8u, G_buffer1, FLASH_PAGE_HEADER_SIZE + size) != 0)
+            {
+                result = FLASH_ERROR_WRITE_FAIL;
+            }
+            else
+            {
+                stream->packPage = fmCtx.nextWriteAddress;
+                stream->packUsed = 0;
+                fmCtx.nextWriteAddress++;
+            }
+        }
+    }
+
+    if (result == FLASH_OK)
+    {
+        stream->packUsed = (uint8_t)(stream->packUsed + size);
+        *page = stream->packPage;
+    }
+    return result;
+}
+
+/**
+ * @brief 把一条组好的记录追加到当前的数据记录页，放不下时在日志尾部新开一个page
+ *        每次只编程记录占用的字节；page头的id、size和crc32保持擦除状态，由每条记录单独校验
+ *        调用前要先分配好写入位置，record不会被复制
+ * @param page 输出：记录所在的page
+ */
+static flash_result_t appendRecord(const uint8_t* record, uint8_t recordSize, uint16_t* page)
+{
+    flash_result_t result = FLASH_OK;
+    uint8_t header[FLASH_PAGE_HEADER_SIZE];
+
+    // 启动时只回放最新扇区，记录只能追加到当前扇区中的记录页
+    if ((fmCtx.dataRecordPage != 0xffff) && (sectorOfPage(fmCtx.dataRecordPage) == fmCtx.openSector) &&
+        (fmCtx.dataRecordUsed + recordSize <= PAYLOAD_SIZE))
+    {
+        if (startWritePage(((uint32_t)fmCtx.dataRecordPage << 8u) + FLASH_PAGE_HEADER_SIZE + fmCtx.dataRecordUsed,
+                                  (uint8_t*)record, recordSize) != 0)
+        {
+            result = FLASH_ERROR_WRITE_FAIL;
+        }
+    }
+    else
+    {
+        memset(header, 0xff, FLASH_PAGE_HEADER_SIZE);
+        header[0] = DATA_PACKED_MAGIC;
+        if (startWritePageGather((uint32_t)fmCtx.nextWriteAddress << 8u, header, FLASH_PAGE_HEADER_SIZE, record, recordSize) != 0)
+        {
+            result = FLASH_ERROR_WRITE_FAIL;
+        }
+        else
+        {
+            fmCtx.dataRecordPage = fmCtx.nextWriteAddress;
+            fmCtx.dataRecordUsed = 0;
+            fmCtx.nextWriteAddress++;
+        }
+    }
+
+    if (result == FLASH_OK)
+    {
+        fmCtx.dataRecordUsed = (uint8_t)(fmCtx.dataRecordUsed + recordSize);
+        *page = fmCtx.dataRecordPage;
+    }
+    return result;
+}
+
+/**
+ * @brief 把一个数据条目组成记录追加到数据记录页
+ * @param size 数据长度，0：删除该数据
+ * @param page 输出：记录所在的page
+ */
+static flash_result_t appendDataRecord(uint8_t dataId, const uint8_t* data, uint8_t size, uint16_t* page)
+{
+    // 先分配好写入位置：分配扇区时可能阻塞回收，回收会改写G_buffer1并搬移数据记录
+    flash_result_t result = ensureWritablePage();
+    uint8_t* record = &G_buffer1[FLASH_PAGE_HEADER_SIZE];
+
+    if (result == FLASH_OK)
+    {
+        record[0] = dataId;
+        record[1] = size;
+        if (size != 0u)
+        {
+            memcpy(&record[2], data, size);
+        }
+        writeU16(&record[2u + size], (uint16_t)calculate_crc32_default(record, 2u + size));
+        result = appendRecord(record, (uint8_t)(size + FLASH_DATA_RECORD_OVERHEAD), page);
+    }
+    return result;
+}
+
+/**
+ * @brief 更新槽位目录中一个槽位的图像头地址和颜色标志：在日志尾部写入该组槽位的新目录page
+ * @param plane 0：黑白图像头，1：红白图像头
+ */
+static flash_result_t writeSlot(uint8_t slotId, uint8_t plane, uint16_t headerPage, uint8_t color)
+{
+    // 先分配好写入位置：分配扇区时可能阻塞回收，回收会改写G_buffer1和槽位目录
+    flash_result_t result = ensureWritablePage();
+    uint8_t group = (uint8_t)(slotId / FLASH_SLOT_DIR_SLOTS);
+    uint16_t dirPage = fmCtx.slotDirPages[group];
+    uint8_t* dir = &G_buffer1[FLASH_PAGE_HEADER_SIZE];
+    uint8_t* entry = &dir[(slotId % FLASH_SLOT_DIR_SLOTS) * SLOT_DIR_ENTRY_SIZE];
+    uint16_t page = 0xffff;
+    uint8_t i;
+
+    if (result != FLASH_OK)
+    {
+        return result;
+    }
+    // 图像头改变后要重新校验；回收期间改写的图像头在FIXUP时再检查一次
+    setImageVerified((uint8_t)(slotId * 2u + plane), FALSE);
+    if (fmCtx.gcVictim != 0xffff)
+    {
+        gcMarkFixup((uint16_t)(slotId * 2u + plane));
+    }
+    memset(G_buffer1, 0xff, FLASH_PAGE_SIZE);
+    if (dirPage != 0xffff)
+    {
+        if ((W25Q32_ReadData((uint32_t)dirPage << 8u, G_buffer1, FLASH_PAGE_HEADER_SIZE + SLOT_DIR_SIZE) != 0) ||
+            (G_buffer1[3] != SLOT_DIR_SIZE) ||
+            (calculate_crc32_default(dir, SLOT_DIR_SIZE) != readU32(&G_buffer1[4])))
+        {
+            // 目录page损坏时该组其他槽位的图像丢失，但仍写入本槽位
+            UARTIF_uartPrintf(0, "ERR: flash_manager 0x0C! slot dir 0x%04x crc error\n", dirPage);
+            memset(G_buffer1, 0xff, FLASH_PAGE_SIZE);
+        }
+    }
+    if (fmCtx.slotCachePinned && (group == 0u))
+    {
+        // 迁移旧格式：缓存中是旧的8个槽位的映射表
+        for (i = 0; i < LEGACY_SLOT_COUNT; i++)
+        {
+            writeU16(&dir[i * SLOT_DIR_ENTRY_SIZE], fmCtx.slotCache[i].headers[0]);
+            writeU16(&dir[i * SLOT_DIR_ENTRY_SIZE + 2u], fmCtx.slotCache[i].headers[1]);
+            dir[i * SLOT_DIR_ENTRY_SIZE + 4u] = fmCtx.slotCache[i].color;
+        }
+    }
+    writeU16(&entry[plane * 2u], headerPage);
+    entry[4] = color;
+
+    result = appendPage(SLOT_DIR_MAGIC, group, dir, SLOT_DIR_SIZE, &page);
+    if (result == FLASH_OK)
+    {
+        fmCtx.slotDirPages[group] = page;
+        if (group == 0u)
+        {
+            fmCtx.slotCachePinned = 0;
+        }
+        for (i = 0; i < FLASH_SLOT_CACHE_SIZE; i++)
+        {
+            if (fmCtx.slotCache[i].slotId == slotId)
+            {
+                fmCtx.slotCache[i].headers[plane] = headerPage;
+                fmCtx.slotCache[i].color = color;
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief 开始回收扇区：记下其中仍被数据条目、槽位目录或图像头引用的page，以及FIXUP要重写的图像头
+ */
+static void gcLoadVictim(uint16_t sector)
+{
+    uint16_t chunk[HEADER_READ_CHUNK];
+    uint16_t idx;
+    uint8_t frame;
+    uint16_t page;
+    uint16_t framePage;
+
+    fmCtx.gcVictim = sector;
+    fmCtx.gcStartMs = fmTickMs;
+    fmCtx.gcLiveMask = 0;
+    memset(fmCtx.gcMap, 0xff, sizeof(fmCtx.gcMap));
+    memset(fmCtx.gcFixupImages, 0, sizeof(fmCtx.gcFixupImages));
+    for (idx = 0; idx < MAX_DATA_ENTRIES + FLASH_SLOT_DIR_PAGES; idx++)
+    {
+        page = (idx < MAX_DATA_ENTRIES) ? fmCtx.dataEntries[idx] : fmCtx.slotDirPages[idx - MAX_DATA_ENTRIES];
+        if ((page != 0xffff) && (sectorOfPage(page) == sector))
+        {
+            fmCtx.gcLiveMask |= (uint16_t)(1u << (page % FLASH_PAGES_PER_SECTOR));
+        }
+    }
+    for (idx = 0; idx < MAX_IMAGE_ENTRIES * 2u; idx++)
+    {
+        page = imageHeaderPage(idx);
+        if (page == 0xffff)
+        {
+            continue;
+        }
+        if (sectorOfPage(page) == sector)
+        {
+            gcMarkFixup(idx);
+        }
+        for (frame = 0; frame <= MAX_FRAME_NUM; frame++)
+        {
+            framePage = readHeaderFrame(page, frame, chunk);
+            if ((framePage != 0xffff) && (sectorOfPage(framePage) == sector))
+            {
+                fmCtx.gcLiveMask |= (uint16_t)(1u << (framePage % FLASH_PAGES_PER_SECTOR));
+                gcMarkFixup(idx);
+            }
+        }
+    }
+    for (idx = 0; idx < FLASH_IMAGE_STREAM_COUNT; idx++)
+    {
+        for (frame = 0; frame <= MAX_FRAME_NUM; frame++)
+        {
+            page = streamFramePage(&fmCtx.streams[idx], frame);
+            if ((fmCtx.streams[idx].magic != 0xff) && (page != 0xffff) && (sectorOfPage(page) == sector))
+            {
+                fmCtx.gcLiveMask |= (uint16_t)(1u << (page % FLASH_PAGES_PER_SECTOR));
+            }
+        }
+    }
+    fmCtx.gcState = FM_GC_RELOCATE;
+    fmCtx.gcCursor = 1;
+    UARTIF_uartPrintf(0, "flash_manager start garbage collecting sector 0x%03x! \n", sector);
+}
+
+/**
+ * @brief 放弃本次回收：回收扇区保持原样，下次统计时跳过它
+ */
+static void gcAbort(flash_result_t result)
+{
+    UARTIF_uartPrintf(0, "ERR: flash_manager 0x08! gc error: %d\n", result);
+    fmCtx.gcSkipSector = fmCtx.gcVictim;
+    fmCtx.gcVictim = 0xffff;
+    fmCtx.gcState = FM_GC_IDLE;
+}
+
+/**
+ * @brief SCAN：每次统计一个窗口，全部统计完后决定是否回收扇区
+ */
+static boolean_t gcStepScan(void)
+{
+    if (fmCtx.gcCursor == 0u)
+    {
+        scanBegin(&fmCtx.scan);
+    }
+    scanSectorWindow(fmCtx.gcCursor, &fmCtx.scan);
+    fmCtx.gcCursor += FLASH_SCAN_WINDOW_SECTORS;
+    if (fmCtx.gcCursor >= fmCtx.sectorCount)
+    {
+        fmCtx.gcState = FM_GC_IDLE;
+        fmCtx.scanNeeded = 0;
+        if (scanEnd(&fmCtx.scan))
+        {
+            gcLoadVictim(fmCtx.scan.victim);
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 把数据记录页中仍被引用的记录逐条追加到当前的数据记录页，并把数据条目改到新地址
+ *        不能整页复制：复制的page在回放时会重新应用其中已被覆盖的记录
+ * @param page 输出：最后追加的记录所在的page，没有需要搬移的记录时不变
+ */
+static flash_result_t gcRelocateDataRecords(uint16_t srcPage, uint16_t* page)
+{
+    flash_result_t result = FLASH_OK;
+    uint8_t idx;
+    uint8_t offset;
+
+    for (idx = 0; (idx < MAX_DATA_ENTRIES) && (result == FLASH_OK); idx++)
+    {
+        if (fmCtx.dataEntries[idx] != srcPage)
+        {
+            continue;
+        }
+        // 先分配好写入位置（打开新扇区会改写G_buffer1），再把记录页读到G_buffer1，记录原样追加
+        result = ensureWritablePage();
+        if (result == FLASH_OK)
+        {
+            memset(G_buffer1, 0xff, FLASH_PAGE_SIZE);
+            if (W25Q32_ReadData((uint32_t)srcPage << 8u, G_buffer1, FLASH_PAGE_SIZE) != 0)
+            {
+                result = FLASH_ERROR_READ_FAIL;
+            }
+        }
+        // 找不到记录时条目保持不变，RELEASE时放弃回收这个扇区
+        offset = (result == FLASH_OK) ? scanDataRecords(G_buffer1, srcPage, idx) : 0u;
+        if (offset != 0u)
+        {
+            result = appendRecord(&G_buffer1[offset], (uint8_t)(G_buffer1[offset + 1u] + FLASH_DATA_RECORD_OVERHEAD), page);
+            if (result == FLASH_OK)
+            {
+                fmCtx.dataEntries[idx] = *page;
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief RELOCATE：每次复制回收扇区中的一个有效page；仍指向原page的数据条目和槽位目录直接改到新地址
+ *        数据记录页只搬移仍有效的记录，数据page不再被引用时不复制
+ */
+static boolean_t gcStepRelocate(void)
+{
+    flash_result_t result = FLASH_OK;
+    uint16_t srcPage;
+    uint16_t newPage = 0xffff;
+    uint8_t magic;
+
+    while ((fmCtx.gcCursor < FLASH_PAGES_PER_SECTOR) && ((fmCtx.gcLiveMask & (1u << fmCtx.gcCursor)) == 0u))
+    {
+        fmCtx.gcCursor++;
+    }
+    if (fmCtx.gcCursor >= FLASH_PAGES_PER_SECTOR)
+    {
+        fmCtx.gcState = FM_GC_FIXUP;
+        fmCtx.gcCursor = 0;
+        return TRUE;
+    }
+
+    srcPage = (uint16_t)(sectorFirstPage(fmCtx.gcVictim) + fmCtx.gcCursor);
+    magic = readPageHeader(srcPage);
+    if (magic == DATA_PACKED_MAGIC)
+    {
+        result = gcRelocateDataRecords(srcPage, &newPage);
+    }
+    else if ((magic != DATA_PAGE_MAGIC) || ((G_buffer1[1] < MAX_DATA_ENTRIES) && (fmCtx.dataEntries[G_buffer1[1]] == srcPage)))
+    {
+        result = appendCopy(srcPage, &newPage);
+    }
+    else
+    {
+        // 数据在开始回收后已被改写或删除，复制的旧版本会在回放时覆盖新数据
+        magic = DEAD_PAGE_MAGIC;
+    }
+    if (result != FLASH_OK)
+    {
+        gcAbort(result);
+        return FALSE;
+    }
+
+    fmCtx.gcMap[fmCtx.gcCursor] = newPage;
+    if (newPage != 0xffff)
+    {
+        fmCtx.gcPagesCopied++;
+    }
+    if (magic == DATA_PAGE_MAGIC)
+    {
+        fmCtx.dataEntries[G_buffer1[1]] = newPage;
+        // 之后的数据记录不能再追加到这个page之前的记录页，否则回放时会被它覆盖
+        fmCtx.dataRecordPage = 0xffff;
+    }
+    else if ((magic == SLOT_DIR_MAGIC) && (G_buffer1[1] < FLASH_SLOT_DIR_PAGES) && (fmCtx.slotDirPages[G_buffer1[1]] == srcPage))
+    {
+        fmCtx.slotDirPages[G_buffer1[1]] = newPage;
+    }
+    else if ((magic == MAGIC_BW_IMAGE_DATA) || (magic == MAGIC_RED_IMAGE_DATA) ||
+             (magic == MAGIC_BW_IMAGE_PACKED) || (magic == MAGIC_RED_IMAGE_PACKED))
+    {
+        relocateStreamPage(srcPage, newPage);
+    }
+    fmCtx.gcCursor++;
+    return TRUE;
+}
+
+/**
+ * @brief FIXUP：每次重写一个开始回收时标记的图像头，帧地址按gcMap换成新地址，未标记的图像头不读取
+ */
+static boolean_t gcStepFixup(void)
+{
+    flash_result_t result = FLASH_OK;
+    uint16_t idx;
+    uint8_t magic;
+    uint8_t slotId;
+    uint16_t entry;
+    uint16_t framePage;
+    uint16_t newPage = 0xffff;
+    uint8_t* header = (uint8_t*)G_imageAddressBuffer;
+    boolean_t rewrite = FALSE;
+    uint8_t frame;
+
+    while ((fmCtx.gcCursor < MAX_IMAGE_ENTRIES * 2u) &&
+           ((fmCtx.gcFixupImages[fmCtx.gcCursor >> 3u] & (1u << (fmCtx.gcCursor & 7u))) == 0u))
+    {
+        fmCtx.gcCursor++;
+    }
+    if (fmCtx.gcCursor >= MAX_IMAGE_ENTRIES * 2u)
+    {
+        fmCtx.gcState = FM_GC_RELEASE;
+        return TRUE;
+    }
+    idx = fmCtx.gcCursor;
+    magic = (uint8_t)(MAGIC_BW_IMAGE_HEADER + idx % 2u);
+    slotId = (uint8_t)(idx / 2u);
+    fmCtx.gcCursor++;
+
+    entry = imageHeaderPage(idx);
+    if (entry == 0xffff)
+    {
+        return TRUE;
+    }
+    // 图像头读到G_imageAddressBuffer中改写；CRC错误时该图像本来就无法读取，不再处理
+    invalidateImageCache();
+    if (FM_readData(magic, slotId, header, IMAGE_HEADER_SIZE) != FLASH_OK)
+    {
+        return TRUE;
+    }
+
+    rewrite = (sectorOfPage(entry) == fmCtx.gcVictim) ? TRUE : FALSE;
+    for (frame = 0; frame <= MAX_FRAME_NUM; frame++)
+    {
+        framePage = readU16(&header[frame * 2u]);
+        if ((framePage != 0xffff) && (sectorOfPage(framePage) == fmCtx.gcVictim))
+        {
+            if (fmCtx.gcMap[framePage % FLASH_PAGES_PER_SECTOR] == 0xffff)
+            {
+                // 回收开始后才被引用的帧没有复制，不能擦除该扇区
+                gcAbort(FLASH_ERROR_IMAGE_FRAME_LOST);
+                return FALSE;
+            }
+            writeU16(&header[frame * 2u], fmCtx.gcMap[framePage % FLASH_PAGES_PER_SECTOR]);
+            rewrite = TRUE;
+        }
+    }
+
+    if (rewrite)
+    {
+        result = appendPage(magic, slotId, header, IMAGE_HEADER_SIZE, &newPage);
+        if (result == FLASH_OK)
+        {
+            fmCtx.gcPagesCopied++;
+            result = writeSlot(slotId, (uint8_t)(idx % 2u), newPage, header[IMAGE_HEADER_SIZE - 1u]);
+        }
+        if (result != FLASH_OK)
+        {
+            gcAbort(result);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * @brief RELEASE：确认没有条目再指向回收扇区后放回空闲列表
+ *        扇区到分配时才擦除，擦除前还能从扇区头读出擦除次数
+ */
+static boolean_t gcStepRelease(void)
+{
+    uint16_t idx;
+    uint16_t page;
+    uint32_t elapsed;
+
+    for (idx = 0; idx < MAX_DATA_ENTRIES + FLASH_SLOT_DIR_PAGES + MAX_IMAGE_ENTRIES * 2u; idx++)
+    {
+        if (idx < MAX_DATA_ENTRIES)
+        {
+            page = fmCtx.dataEntries[idx];
+        }
+        else if (idx < MAX_DATA_ENTRIES + FLASH_SLOT_DIR_PAGES)
+        {
+            page = fmCtx.slotDirPages[idx - MAX_DATA_ENTRIES];
+        }
+        else
+        {
+            page = imageHeaderPage((uint16_t)(idx - MAX_DATA_ENTRIES - FLASH_SLOT_DIR_PAGES));
+        }
+        if ((page != 0xffff) && (sectorOfPage(page) == fmCtx.gcVictim))
+        {
+            gcAbort(FLASH_ERROR_GC_FAIL);
+            return FALSE;
+        }
+    }
+
+    (void)pushFreeSector(fmCtx.gcVictim);
+    elapsed = fmTickMs - fmCtx.gcStartMs;
+    fmCtx.gcRuns++;
+    fmCtx.gcTotalMs += elapsed;
+    if (elapsed > fmCtx.gcMaxMs)
+    {
+        fmCtx.gcMaxMs = elapsed;
+    }
+    UARTIF_uartPrintf(0, "flash_manager garbage collecting sector 0x%03x finished successfully! \n", fmCtx.gcVictim);
+    fmCtx.gcVictim = 0xffff;
+    fmCtx.gcState = FM_GC_IDLE;
+    fmCtx.scanNeeded = 1;
+    return TRUE;
+}
+
+/**
+ * @brief WEAR：每次读取FLASH_WEAR_SCAN_STEP个扇区头，找出仍在使用的扇区中擦除次数最少的一个
+ */
+static boolean_t gcStepWear(void)
+{
+    uint16_t sector;
+    uint16_t prevSector;
+    uint32_t seq;
+    uint32_t eraseCount;
+
+    for (sector = fmCtx.gcCursor; (sector < fmCtx.gcCursor + FLASH_WEAR_SCAN_STEP) && (sector < fmCtx.sectorCount); sector++)
+    {
+        // 空闲列表中的扇区分配时会按擦除次数挑选，不需要回收
+        if (readSectorInfo(sector, &seq, &prevSector, &eraseCount) && !pageRetiring(sectorFirstPage(sector)))
+        {
+            if (eraseCount > fmCtx.wearMax)
+            {
+                fmCtx.wearMax = eraseCount;
+            }
+            if ((fmCtx.coldSector == 0xffff) || (eraseCount < fmCtx.coldEraseCount))
+            {
+                fmCtx.coldSector = sector;
+                fmCtx.coldEraseCount = eraseCount;
+            }
+        }
+    }
+    fmCtx.gcCursor = sector;
+    if (sector >= fmCtx.sectorCount)
+    {
+        fmCtx.gcState = FM_GC_IDLE;
+        fmCtx.wearScanNeeded = 0;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 静态磨损均衡：最冷扇区比擦除最多的扇区少擦除FLASH_WEAR_LEVEL_DELTA次以上时回收它，
+ *        其中长期不变的数据搬到新扇区，它自己回到空闲列表，因擦除次数少会被优先分配
+ */
+static void wearLevelColdSector(void)
+{
+    uint16_t sector = fmCtx.coldSector;
+
+    // 下一次分配扇区后重新查找最冷扇区
+    fmCtx.coldSector = 0xffff;
+    if ((sector >= fmCtx.allocFirstSector) && (sector < fmCtx.allocEndSector) && (sector != fmCtx.gcSkipSector) &&
+        !pageRetiring(sectorFirstPage(sector)) && !sectorInLogGuard(sector))
+    {
+        UARTIF_uartPrintf(0, "flash_manager wear leveling sector 0x%03x (%lu erases, max %lu)\n",
+                          sector, fmCtx.coldEraseCount, fmCtx.wearMax);
+        gcLoadVictim(sector);
+    }
+}
+
+/**
+ * @brief 执行一步GC
+ * @return TRUE 可以继续执行下一步
+ */
+static boolean_t gcStep(void)
+{
+    boolean_t goOn = FALSE;
+
+    fmCtx.gcInProgress = 1;
+    if (fmCtx.gcState == FM_GC_SCAN)
+    {
+        goOn = gcStepScan();
+    }
+    else if (fmCtx.gcState == FM_GC_RELOCATE)
+    {
+        goOn = gcStepRelocate();
+    }
+    else if (fmCtx.gcState == FM_GC_FIXUP)
+    {
+        goOn = gcStepFixup();
+    }
+    else if (fmCtx.gcState == FM_GC_RELEASE)
+    {
+        goOn = gcStepRelease();
+    }
+    else if (fmCtx.gcState == FM_GC_WEAR)
+    {
+        goOn = gcStepWear();
+    }
+    fmCtx.gcInProgress = 0;
+    return goOn;
+}
+
+/**
+ * @brief 阻塞执行GC直到完成
+ */
+static flash_result_t gcFinish(void)
+{
+    while (fmCtx.gcState != FM_GC_IDLE)
+    {
+        if (!gcStep() && fmCtx.eraseBusy)
+        {
+            waitForErase();
+        }
+    }
+    return FLASH_OK;
+}
+
+/**
+ * @brief 把旧版segment布局中的有效数据迁移到扇区日志
+ *        先擦除另一个segment的头，只在那一半分配扇区；全部复制完后再擦除激活segment的头，
+ *        中途掉电时旧布局仍然完整，下次启动重新迁移
+ *        图像头地址先记在slotCache中（旧格式的8个槽位），由FM_init最后写入槽位目录
+ */
+static flash_result_t migrateLegacyLayout(boolean_t isHigh)
+{
+    flash_result_t result = FLASH_OK;
+    uint32_t activeBase = isHigh ? FLASH_SEGMENT1_BASE : FLASH_SEGMENT0_BASE;
+    uint32_t backupBase = isHigh ? FLASH_SEGMENT0_BASE : FLASH_SEGMENT1_BASE;
+    uint16_t segmentFirstPage = (uint16_t)(activeBase >> 8u);
+    uint16_t logFirstPage = FLASH_LOG_FIRST_PAGE;
+    uint16_t page;
+    uint16_t tailPage;
+    uint16_t newPage = 0xffff;
+    uint16_t* entry;
+    uint8_t* header = (uint8_t*)G_imageAddressBuffer;
+    uint8_t idx;
+    uint8_t frame;
+    uint8_t magic = 0xff;
+
+    UARTIF_uartPrintf(0, "flash_manager migrate %s segment to sector log\n", isHigh ? "high" : "low");
+    pinSlotCache();
+
+    // 更早的布局日志紧跟segment头，没有checkpoint区
+    (void)W25Q32_ReadData(activeBase + ((uint32_t)FLASH_LEGACY_LOG_FIRST_PAGE << 8u), &magic, 1u);
+    if (magic >= DATA_PAGE_MAGIC && magic <= MAGIC_RED_IMAGE_DATA)
+    {
+        logFirstPage = FLASH_LEGACY_LOG_FIRST_PAGE;
+    }
+    tailPage = findLogTail((uint16_t)(segmentFirstPage + logFirstPage), (uint16_t)(segmentFirstPage + FLASH_PAGES_PER_SEGMENT));
+    for (page = (uint16_t)(segmentFirstPage + logFirstPage); page != tailPage; page++)
+    {
+        indexPage(page);
+    }
+
+    eraseSectorNow((uint16_t)(backupBase / FLASH_SECTOR_SIZE));
+    fmCtx.allocFirstSector = (uint16_t)(backupBase / FLASH_SECTOR_SIZE);
+    fmCtx.allocEndSector = (uint16_t)(fmCtx.allocFirstSector + FLASH_SECTORS_PER_SEGMENT);
+    fmCtx.allocCursor = fmCtx.allocFirstSector;
+    fmCtx.gcInProgress = 1;
+
+    for (idx = 0; (idx < MAX_DATA_ENTRIES + LEGACY_SLOT_COUNT * 2u) && (result == FLASH_OK); idx++)
+    {
+        if (idx < MAX_DATA_ENTRIES)
+        {
+            entry = &fmCtx.dataEntries[idx];
+            if (*entry != 0xffff)
+            {
+                result = appendCopy(*entry, &newPage);
+                if (result == FLASH_OK)
+                {
+                    *entry = newPage;
+                }
+            }
+            continue;
+        }
+
+        // 旧格式的映射表顺序：先8个黑白图像头，再8个红白图像头
+        magic = (uint8_t)(MAGIC_BW_IMAGE_HEADER + (idx - MAX_DATA_ENTRIES) / LEGACY_SLOT_COUNT);
+        entry = &fmCtx.slotCache[(idx - MAX_DATA_ENTRIES) % LEGACY_SLOT_COUNT].headers[magic - MAGIC_BW_IMAGE_HEADER];
+        if (*entry == 0xffff)
+        {
+            continue;
+        }
+        if (FM_readData(magic, (uint8_t)((idx - MAX_DATA_ENTRIES) % LEGACY_SLOT_COUNT), header, IMAGE_HEADER_SIZE) != FLASH_OK)
+        {
+            // 图像头已损坏，不迁移
+            UARTIF_uartPrintf(0, "ERR: flash_manager 0x10! copy entry %d fail\n", idx);
+            *entry = 0xffff;
+            continue;
+        }
+        for (frame = 0; (frame <= MAX_FRAME_NUM) && (result == FLASH_OK); frame++)
+        {
+            page = readU16(&header[frame * 2u]);
+            if (page != 0xffff)
+            {
+                result = appendCopy(page, &newPage);
+                writeU16(&header[frame * 2u], newPage);
+            }
+        }
+        if (result == FLASH_OK)
+        {
+            result = appendPage(magic, (uint8_t)((idx - MAX_DATA_ENTRIES) % LEGACY_SLOT_COUNT), header, IMAGE_HEADER_SIZE, &newPage);
+        }
+        if (result == FLASH_OK)
+        {
+            *entry = newPage;
+        }
+    }
+
+    fmCtx.gcInProgress = 0;
+    fmCtx.allocFirstSector = 0;
+    fmCtx.allocEndSector = fmCtx.sectorCount;
+    // 图像头在G_imageAddressBuffer中改写过
+    invalidateImageCache();
+    if (result == FLASH_OK)
+    {
+        // 旧segment头在后台擦除，FM_process查询完成，之前的写入会先等待擦除完成
+        // 旧布局的扇区没有擦除次数，之后作为空闲扇区分配时按第一次擦除计
+        fmCtx.spareEraseCount = 1u;
+        startErase((uint16_t)(activeBase / FLASH_SECTOR_SIZE));
+        UARTIF_uartPrintf(0, "flash_manager migrate finished\n");
+    }
+    else
+    {
+        UARTIF_uartPrintf(0, "ERR: flash_manager 0x08! migrate error: %d\n", result);
+    }
+    return result;
+}
+
+/**
+ * @brief 启动时判断是否为旧版segment布局
+ * @param isHigh 输出：旧布局的激活segment
+ * @return TRUE 有激活的旧版segment，需要迁移
+ */
+static boolean_t findLegacySegment(boolean_t* isHigh)
+{
+    segment_header_t header0;
+    segment_header_t header1;
+    boolean_t active0;
+    boolean_t active1;
+    boolean_t found = TRUE;
+
+    active0 = ((readSegmentHeader(FLASH_SEGMENT0_BASE, &header0) == FLASH_OK) && (header0.statusMagic == SEGMENT_MAGIC_ACTIVE)) ? TRUE : FALSE;
+    active1 = ((readSegmentHeader(FLASH_SEGMENT1_BASE, &header1) == FLASH_OK) && (header1.statusMagic == SEGMENT_MAGIC_ACTIVE)) ? TRUE : FALSE;
+
+    if (active0 && active1)
+    {
+        // 增量GC切换后新segment的gcCounter更大；更早的GC中断时两个gcCounter相同，按segment尾部判断
+        if (header0.gcCounter != header1.gcCounter)
+        {
+            *isHigh = (header1.gcCounter > header0.gcCounter) ? TRUE : FALSE;
+        }
+        else if (judgeWhichSegmentIsActive(isHigh) != FLASH_OK)
+        {
+            found = FALSE;
+        }
+    }
+    else if (active0 || active1)
+    {
+        *isHigh = active1;
+    }
+    else
+    {
+        found = FALSE;
+    }
+    return found;
+}
+
+/******************************************************************************
+ * Function implementation - global ('extern') and local ('static')
+ ******************************************************************************/
+
+/**
+ * @brief 初始化Flash管理器
+ */
+
+flash_result_t FM_init()
+{
+    flash_result_t result = FLASH_OK;
+    boolean_t isHigh = FALSE;
+    uint16_t sector;
+    uint32_t limit = 0xffffffff;
+    uint32_t bestSeq = 0;
+    uint32_t maxSeq = 0;
+    uint8_t i;
+
+    fmCtx.gcInProgress = 0;
+    fmCtx.gcState = FM_GC_IDLE;
+    fmCtx.gcVictim = 0xffff;
+    fmCtx.gcSkipSector = 0xffff;
+    fmCtx.eraseBusy = 0;
+    fmCtx.erases = 0;
+    fmCtx.eraseTotalMs = 0;
+    fmCtx.eraseMaxMs = 0;
+    fmCtx.lastAccessCount = W25Q32_AccessCount();
+    fmCtx.lastAccessMs = fmTickMs;
+    fmCtx.powerDowns = 0;
+    fmCtx.freeCount = 0;
+    for (i = 0; i < FLASH_IMAGE_STREAM_COUNT; i++)
+    {
+        fmCtx.streams[i].magic = 0xff;
+    }
+    memset(fmCtx.streamSectors, 0xff, sizeof(fmCtx.streamSectors));
+    fmCtx.dedupNext = 0;
+    for (i = 0; i < FLASH_DEDUP_CACHE_SIZE; i++)
+    {
+        fmCtx.dedup[i].page = 0xffff;
+    }
+    fmCtx.spareErased = 0;
+    fmCtx.spareEraseCount = 0;
+    fmCtx.wearMax = 0;
+    fmCtx.coldSector = 0xffff;
+    fmCtx.coldEraseCount = 0;
+    fmCtx.wearScanNeeded = 0;
+    fmCtx.scanNeeded = 1;
+    fmCtx.gcRuns = 0;
+    fmCtx.gcPagesCopied = 0;
+    fmCtx.gcTotalMs = 0;
+    fmCtx.gcMaxMs = 0;
+    fmCtx.bytesRequested = 0;
+    fmCtx.bytesWritten = 0;
+    fmCtx.crcErrors = 0;
+    fmCtx.verifyPolicy = FM_VERIFY_ONCE;
+    memset(fmCtx.verifiedImages, 0, sizeof(fmCtx.verifiedImages));
+    fmCtx.scrubCursor = 0;
+    fmCtx.scrubWaiting = 0;
+    fmCtx.scrubPasses = 0;
+    fmCtx.badCount = 0;
+    fmCtx.badPending = 0;
+    fmCtx.badOverflow = 0;
+    fmCtx.statsCursor = 0xffff;
+    fmCtx.statsHave = 0;
+    fmCtx.badCheckedSector = 0xffff;
+    fmCtx.sectorCount = (uint16_t)((W25Q32_TotalSize() / FLASH_SECTOR_SIZE < FLASH_MAX_SECTOR_COUNT) ?
+                                   (W25Q32_TotalSize() / FLASH_SECTOR_SIZE) : FLASH_MAX_SECTOR_COUNT);
+    UARTIF_uartPrintf(0, "flash_manager capacity %lu KB, %u sectors\n", W25Q32_TotalSize() / 1024u, fmCtx.sectorCount);
+    fmCtx.allocCursor = 0;
+    fmCtx.allocFirstSector = 0;
+    fmCtx.allocEndSector = fmCtx.sectorCount;
+    fmCtx.openSector = 0xffff;
+    fmCtx.nextWriteAddress = 0xffff;
+    invalidateImageCache();
+    memset(fmCtx.dataEntries, 0xff, sizeof(uint16_t) * MAX_DATA_ENTRIES);
+    fmCtx.dataRecordPage = 0xffff;
+    fmCtx.dataRecordUsed = 0;
+    memset(fmCtx.slotDirPages, 0xff, sizeof(fmCtx.slotDirPages));
+    resetSlotCache();
+    fmCtx.slotCachePinned = 0;
+
+    // 找到分配序号最大且CRC正确的扇区头：其中的快照加上该扇区的日志就是完整映射表
+    do
+    {
+        sector = findNewestSector(limit, &bestSeq, &maxSeq);
+        if (sector == 0xffff)
+        {
+            break;
+        }
+        if (loadSectorSnapshot(sector) == FLASH_OK)
+        {
+            break;
+        }
+        UARTIF_uartPrintf(0, "ERR: flash_manager 0x04! sector 0x%03x header error\n", sector);
+        if (readPageHeader((uint16_t)(sectorFirstPage(sector) + 1u)) == 0xff)
+        {
+            // 扇区头写到一半掉电，扇区中还没有日志page：擦掉它，否则它的序号（可能是任意值）会排在之后新分配的扇区前面
+            eraseSectorNow(sector);
+            maxSeq = 0;
+            continue;
+        }
+        limit = bestSeq;
+    } while (TRUE);
+    fmCtx.sectorSeq = maxSeq;
+
+    if (findLegacySegment(&isHigh))
+    {
+        memset(fmCtx.dataEntries, 0xff, sizeof(uint16_t) * MAX_DATA_ENTRIES);
+        result = migrateLegacyLayout(isHigh);
+    }
+    else if (sector != 0xffff)
+    {
+        UARTIF_uartPrintf(0, "flash_manager sector 0x%03x seq %lu, max erase count %lu\n", sector, bestSeq, fmCtx.wearMax);
+        replaySector(sector);
+        fmCtx.allocCursor = (uint16_t)((sector + 1u) % fmCtx.sectorCount);
+    }
+    else
+    {
+        UARTIF_uartPrintf(0, "flash_manager no sector log, start empty\n");
+    }
+
+    if ((result == FLASH_OK) && fmCtx.slotCachePinned)
+    {
+        // 旧格式的映射表写入槽位目录，再换一个扇区写入新格式的扇区头，之后启动不再迁移
+        UARTIF_uartPrintf(0, "flash_manager move image slots to slot directory\n");
+        result = writeSlot(0, 0, fmCtx.slotCache[0].headers[0], fmCtx.slotCache[0].color);
+        if (result == FLASH_OK)
+        {
+            result = openNewSector();
+        }
+    }
+
+    /* Populate per-slot color flags by reading existing image headers (if present) */
+    // Disabled to prevent automatic loading of image headers on boot which may trigger unwanted display updates
+    // if ((result == FLASH_OK) && (needToInitList))
+    // {
+    //     uint8_t kk;
+    //     uint8_t jj;
+    //     for (kk = 1; kk < 3; kk++)
+    //     {
+    //         for (jj = 0; jj < MAX_IMAGE_ENTRIES; jj++)
+    //         {
+    //             if (fmCtx.entries[kk][jj] != 0xffff)
+    //             {
+    //                 (void)readImageHeaderIntoBuffer((DATA_PAGE_MAGIC + kk), jj);
+    //             }
+    //         }
+    //     }
+    // }
+
+    UARTIF_uartPrintf(0, "flash_manager FM_init about to return\n");
+    return result;
+}
+
+/**
+ * @brief 写入数据
+ */
+flash_result_t FM_writeData(uint8_t magic, uint16_t dataId, const uint8_t* data, uint16_t size)
+{
+    flash_result_t result = FLASH_OK;
+    uint16_t page = 0xffff;
+    fm_image_stream_t* stream = NULL;
+    uint32_t crc32 = 0;
+    uint8_t color = 0xff;
+    // uint8_t slotId;
+
+    result = checkArguments(magic, dataId, data, size);
+    if (result == FLASH_OK)
+    {
+        if (magic == MAGIC_BW_IMAGE_HEADER || magic == MAGIC_RED_IMAGE_HEADER)
+        {
+            // 图像头末尾的颜色标志同时记在槽位目录中
+            color = data[size - 1u];
+        }
+        waitForErase();
+        // CRITICAL: DISABLE debug output during image transfer
+        // This interferes with UART protocol communication (ACK/NAK responses)
+        // UARTIF_uartPrintf(0, "flash_manager: write data to flash nextWriteAddress is 0x%04x! \n", fmCtx.nextWriteAddress);
+
+        if (magic == MAGIC_BW_IMAGE_DATA || magic == MAGIC_RED_IMAGE_DATA)
+        {
+            crc32 = calculate_crc32_default(data, size);
+            stream = openImageStream(magic, (uint8_t)(dataId >> 8u));
+            // 有接收记录的图像压缩后写入，多个帧共用一个page
+            // 没有接收记录的图像写头时要按page头扫描帧号，不能共用或引用其他page
+            if ((stream != NULL) && (size == PAYLOAD_SIZE))
+            {
+                result = appendPackedFrame(stream, magic, (uint8_t)dataId, data, crc32, &page);
+                if (result == FLASH_ERROR_NO_SPACE)
+                {
+                    result = FLASH_OK;
+                }
+            }
+            // 压缩不了的帧按原样写入：内容与最近写入的帧相同时直接引用那个page
+            if ((stream != NULL) && (result == FLASH_OK) && (page == 0xffff))
+            {
+                page = findDuplicatePage(magic, data, (uint8_t)size, crc32);
+            }
+        }
+
+        // 放得进一个page的数据作为记录追加到数据记录页，只编程用到的字节
+        if ((result == FLASH_OK) && (magic == DATA_PAGE_MAGIC) && (size + FLASH_DATA_RECORD_OVERHEAD <= PAYLOAD_SIZE))
+        {
+            result = appendDataRecord((uint8_t)dataId, data, (uint8_t)size, &page);
+        }
+
+        if ((result == FLASH_OK) && (page == 0xffff))
+        {
+            // 当前扇区写满时在这里分配新扇区
+            result = appendPage(magic, dataId, data, (uint8_t)size, &page);
+            if ((result == FLASH_OK) && (magic == MAGIC_BW_IMAGE_DATA || magic == MAGIC_RED_IMAGE_DATA))
+            {
+                rememberPage(page, crc32);
+            }
+            else if ((result == FLASH_OK) && (magic == DATA_PAGE_MAGIC))
+            {
+                // 之后的数据记录不能再追加到这个page之前的记录页，否则回放时会被它覆盖
+                fmCtx.dataRecordPage = 0xffff;
+            }
+        }
+    }
+    else
     {
         result = FLASH_ERROR_INVALID_PARAM;
     }
-    
-    if (magic == DATA_PAGE_MAGIC && dataId >= MAX_DATA_ENTRIES)
+
+    // 更新映射表
+    if (result == FLASH_OK)
+    {
+        fmCtx.bytesRequested += size;
+        if (magic == DATA_PAGE_MAGIC)
+        {
+            fmCtx.dataEntries[dataId] = page;
+        }
+        else if (magic == MAGIC_BW_IMAGE_HEADER || magic == MAGIC_RED_IMAGE_HEADER)
+        {
+            // 写入槽位目录后新图像头才生效，之前掉电时槽位仍是旧图像
+            result = writeSlot((uint8_t)dataId, (uint8_t)(magic - MAGIC_BW_IMAGE_HEADER), page, color);
+            if (result == FLASH_OK)
+            {
+                closeImageStream((uint8_t)(magic + 2u), (uint8_t)dataId);
+                invalidateImageCache();
+            }
+        }
+        else if (magic == MAGIC_BW_IMAGE_DATA || magic == MAGIC_RED_IMAGE_DATA)
+        {
+            // 记录帧地址，写图像头时不必再扫描日志
+            if (stream != NULL)
+            {
+                setStreamFrame(stream, (uint8_t)(dataId & 0xffu), page);
+            }
+        }
+        else
+        {
+            result = FLASH_ERROR_INVALID_PARAM;
+        }
+    }
+
+    // 图像帧在编程期间就返回，让接收下一帧与编程重叠；数据和图像头要在返回前真正写入
+    if ((result == FLASH_OK) && (magic != MAGIC_BW_IMAGE_DATA) && (magic != MAGIC_RED_IMAGE_DATA))
+    {
+        W25Q32_WaitForReady();
+    }
+
+    return result;
+}
+
+/**
+ * @brief 读取数据
+ */
+flash_result_t FM_readData(uint8_t magic, uint16_t dataId, uint8_t* data, uint8_t size)
+{
+    flash_result_t result = FLASH_OK;
+    uint32_t calculatedCrc, storedCrc;
+    uint8_t pageDataSize = 0;
+    uint8_t dataOffset = 0;
+    uint32_t destAddress = 0;
+    uint8_t readSize = size;
+    // uint8_t slotId = 0u;
+    uint8_t frameNum = 0u;
+    uint16_t page = 0xffff;
+    fm_slot_entry_t* slot;
+
+    // 在映射表中查找
+    result = checkArguments(magic, dataId, data, size);
+    if (result == FLASH_OK)
+    {
+        // UARTIF_uartPrintf(0, "flash_manager: read data from flash! \n");
+        if (magic == DATA_PAGE_MAGIC || magic == MAGIC_BW_IMAGE_HEADER || magic == MAGIC_RED_IMAGE_HEADER)
+        {
+            if (magic == DATA_PAGE_MAGIC)
+            {
+                page = fmCtx.dataEntries[dataId];
+            }
+            else
+            {
+                slot = lookupSlot((uint8_t)dataId);
+                page = (slot != NULL) ? slot->headers[magic - MAGIC_BW_IMAGE_HEADER] : 0xffff;
+            }
+            if (page == 0xffff)
+            {
+                result = FLASH_ERROR_NOT_FOUND;
+            }
+            else
+            {
+                destAddress |= (uint32_t) (page << 8u);
+            }
+        }
+        else if (magic == MAGIC_BW_IMAGE_DATA || magic == MAGIC_RED_IMAGE_DATA)
+        {
+            // slotId = (uint8_t)((dataId & 0xff00u) >> 8u);
+            frameNum = (uint8_t)(dataId & 0xffu);
+            if (G_imageAddressBuffer[frameNum] == 0xffff)
+            {
+                result = FLASH_ERROR_NOT_FOUND;
+            }
+            else
+            {
+                destAddress |= (uint32_t) (G_imageAddressBuffer[frameNum] << 8u);
+            }
+        }
+        else
+        {
+            // do nothing
+        }
+    }
+    else
     {
         result = FLASH_ERROR_INVALID_PARAM;
     }
 
-    if (magic == MAGIC_BW_IMAGE_DATA || magic == MAGIC_RED_IMAGE_DATA)
+    // 读取数据页
+    if (result == FLASH_OK)
     {
-        slotId = (uint8_t)((dataId & 0xff00u) >> 8u);
-        frameNum = (uint8_t)(dataId & 0xffu);
-        if (slotId >= MAX_IMAGE_ENTRIES || frameNum > MAX_FRAME_NUM)
+        memset(G_buffer1, 0, FLASH_PAGE_SIZE);
+        // 读取数据页到缓冲区
+        if (W25Q32_ReadData(destAddress, G_buffer1, FLASH_PAGE_SIZE) != 0)
+        {
+            result = FLASH_ERROR_READ_FAIL;
+        }
+    }
+
+    if (result == FLASH_OK)
+    {
+        if ((magic == DATA_PAGE_MAGIC) && (G_buffer1[0] == DATA_PACKED_MAGIC))
+        {
+            // 数据记录页：取该数据ID的最后一条记录，记录本身已校验过CRC
+            dataOffset = scanDataRecords(G_buffer1, page, (uint8_t)dataId);
+            if (dataOffset == 0u)
+            {
+                result = FLASH_ERROR_CRC_FAIL;
+            }
+            else
+            {
+                pageDataSize = G_buffer1[dataOffset + 1u];
+                dataOffset += 2u;
+            }
+        }
+        // 验证魔法数字；槽位目录项读取时没有校验，图像头还要核对槽位号（图像帧可能引用其他帧的相同page，不核对帧号）
+        else if ((G_buffer1[0] != magic) ||
+                 (((magic == MAGIC_BW_IMAGE_HEADER) || (magic == MAGIC_RED_IMAGE_HEADER)) && (G_buffer1[1] != (uint8_t)dataId)))
+        {
+            result = FLASH_ERROR_INVALID_PARAM;
+        }
+    }
+
+    // 验证CRC32（只验证数据部分）
+    if ((result == FLASH_OK) && (dataOffset == 0u))
+    {
+        // 从缓冲区解析数据页字段
+        dataOffset = FLASH_PAGE_HEADER_SIZE;
+        pageDataSize = G_buffer1[3];
+        storedCrc = (uint32_t)G_buffer1[4] | ((uint32_t)G_buffer1[5] << 8) |
+                     ((uint32_t)G_buffer1[6] << 16) | ((uint32_t)G_buffer1[7] << 24);
+
+        calculatedCrc = calculate_crc32_default(&G_buffer1[8], pageDataSize);
+        if (calculatedCrc != storedCrc)
+        {
+            fmCtx.crcErrors++;
+            result = FLASH_ERROR_CRC_FAIL;
+        }
+    }
+
+    // 检查缓冲区大小
+    if (result == FLASH_OK)
+    {
+        if (readSize > pageDataSize)
         {
+            readSize = pageDataSize;
+            // 复制数据
+
             result = FLASH_ERROR_INVALID_PARAM;
         }
+
+        memcpy(data, &G_buffer1[dataOffset], readSize);
     }
+
     return result;
 }
 
 /**
- * @brief 执行垃圾回收
+ * @brief 删除数据
  */
-static flash_result_t garbageCollect(void)
+flash_result_t FM_deleteData(uint16_t dataId)
 {
-    uint8_t i, k;
     flash_result_t result = FLASH_OK;
-    UARTIF_uartPrintf(0, "flash_manager start garbage collecting! \n");
+    uint16_t page = 0xffff;
+    if (dataId >= MAX_DATA_ENTRIES)
+    {
+        result = FLASH_ERROR_INVALID_PARAM;
+    }
 
-    fmCtx.currentGcCounter ++;
-    // 1. 将备用segment标记为激活
-    if (result == FLASH_OK)
+    // 追加一条长度为0的数据记录，回放时清除该条目；旧数据不再被引用，之后随扇区回收
+    // 删除记录本身也不被引用：它所在扇区之后的扇区头快照中该条目已经是空的
+    if ((result == FLASH_OK) && (fmCtx.dataEntries[dataId] != 0xffff))
+    {
+        waitForErase();
+        result = appendDataRecord((uint8_t)dataId, NULL, 0u, &page);
+        if (result == FLASH_OK)
+        {
+            fmCtx.dataEntries[dataId] = 0xffff;
+            W25Q32_WaitForReady();
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief 巡检发现扇区中的page出错：有效page在后台回收时搬走重写，扇区擦除后照常分配；
+ *        出错FLASH_BAD_SECTOR_FAULTS次后在扇区头page末尾写入坏扇区标记，该扇区不再分配
+ *        搬走之前再次发现的错误不重复计数；出错次数只记在RAM中
+ */
+static void sectorFault(uint16_t sector)
+{
+    uint8_t mark = FLASH_BAD_SECTOR_MARK;
+    uint8_t i = trackBadSector(sector);
+
+    if ((i == FLASH_BAD_SECTOR_LIST_SIZE) || ((fmCtx.badPending & (1u << i)) != 0u) ||
+        (fmCtx.badFaults[i] >= FLASH_BAD_SECTOR_FAULTS))
+    {
+        // 列表中都是等待搬移的扇区：下一轮巡检再处理
+        return;
+    }
+    fmCtx.badFaults[i]++;
+    fmCtx.badPending |= (uint8_t)(1u << i);
+    fmCtx.badCheckedSector = 0xffff;
+    if (fmCtx.badFaults[i] < FLASH_BAD_SECTOR_FAULTS)
     {
-        UARTIF_uartPrintf(0, "flash_manager garbage collecting step one \n");
-        result = resetSegment((fmCtx.activeSegmentBaseStatus == MAGIC_LOW_ACTIVE), SEGMENT_MAGIC_ACTIVE, fmCtx.currentGcCounter);
-        fmCtx.nextWriteAddress = (fmCtx.activeSegmentBaseStatus == MAGIC_LOW_ACTIVE) ? 0x2001 : 0x0001;
+        return;
     }
 
-    // 2. 复制有效数据
-    if (result == FLASH_OK)
+    UARTIF_uartPrintf(0, "ERR: flash_manager 0x0D! bad sector 0x%03x\n", sector);
+    (void)startWritePage((uint32_t)sector * FLASH_SECTOR_SIZE + FLASH_PAGE_SIZE - 1u, &mark, 1u);
+    if (sector == fmCtx.openSector)
     {
-        UARTIF_uartPrintf(0, "flash_manager garbage collecting step two \n");
-        result = copyValidPages();
+        // 当前日志扇区不再写入，下次写入时分配新扇区
+        fmCtx.nextWriteAddress = (uint16_t)(sectorFirstPage(sector) + FLASH_PAGES_PER_SECTOR);
     }
-    
-    // 3. 将原激活segment标记为备用
-    if (result == FLASH_OK)
+}
+
+/**
+ * @brief 出错的扇区不在最近的日志扇区中后回收它：有效page搬到新位置，图像头、槽位目录和映射表改到新地址
+ */
+static void drainBadSector(void)
+{
+    uint8_t i;
+    uint16_t sector;
+
+    // 日志扇区变化前结果不变，不重复读取扇区头
+    if (fmCtx.badCheckedSector == fmCtx.openSector)
+    {
+        return;
+    }
+    fmCtx.badCheckedSector = fmCtx.openSector;
+    for (i = 0; i < fmCtx.badCount; i++)
+    {
+        sector = fmCtx.badSectors[i];
+        if (((fmCtx.badPending & (1u << i)) != 0u) && (sector != fmCtx.gcSkipSector) && !sectorInLogGuard(sector))
+        {
+            fmCtx.badPending &= (uint8_t)~(1u << i);
+            UARTIF_uartPrintf(0, "flash_manager relocating sector 0x%03x\n", sector);
+            gcLoadVictim(sector);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief 巡检一个page：读出后校验page头和CRC，压缩帧page只校验该帧的记录
+ * @param frameNum 图像头page为0xff
+ */
+static boolean_t scrubPage(uint16_t page, uint8_t magic, uint8_t frameNum)
+{
+    boolean_t ok = FALSE;
+
+    memset(G_buffer1, 0, FLASH_PAGE_SIZE);
+    if (W25Q32_ReadData((uint32_t)page << 8u, G_buffer1, FLASH_PAGE_SIZE) != 0)
+    {
+        return FALSE;
+    }
+    if ((frameNum != 0xff) && (G_buffer1[0] == PACKED_MAGIC(magic)))
+    {
+        ok = (unpackFrame(G_buffer1, frameNum, NULL, TRUE) == FLASH_OK) ? TRUE : FALSE;
+    }
+    else
+    {
+        ok = ((G_buffer1[0] == magic) && (G_buffer1[3] <= PAYLOAD_SIZE) &&
+              (calculate_crc32_default(&G_buffer1[FLASH_PAGE_HEADER_SIZE], G_buffer1[3]) == readU32(&G_buffer1[4]))) ? TRUE : FALSE;
+    }
+    return ok;
+}
+
+/**
+ * @brief 巡检下一个位置：依次检查每个图像的图像头和各帧，全部通过的图像记为已校验
+ * @return FALSE 本轮巡检已结束
+ */
+static boolean_t scrubNextPage(void)
+{
+    uint16_t idx = (uint16_t)(fmCtx.scrubCursor / (MAX_FRAME_NUM + 2u));
+    uint8_t pos = (uint8_t)(fmCtx.scrubCursor % (MAX_FRAME_NUM + 2u));
+    uint16_t headerPage;
+    uint16_t page;
+    uint8_t addr[2];
+    uint8_t magic;
+    uint8_t tries;
+
+    if (idx >= MAX_IMAGE_ENTRIES * 2u)
+    {
+        fmCtx.scrubCursor = 0;
+        fmCtx.scrubWaiting = 1;
+        fmCtx.scrubPassEndMs = fmTickMs;
+        fmCtx.scrubPasses++;
+        return FALSE;
+    }
+
+    headerPage = imageHeaderPage(idx);
+    if ((headerPage == 0xffff) || ((pos != 0u) && (headerPage != fmCtx.scrubHeaderPage)))
+    {
+        // 没有图像，或巡检期间图像被重写：跳到下一个图像
+        fmCtx.scrubCursor = (uint16_t)((idx + 1u) * (MAX_FRAME_NUM + 2u));
+        return TRUE;
+    }
+    fmCtx.scrubCursor++;
+    if (pos == 0u)
+    {
+        fmCtx.scrubHeaderPage = headerPage;
+        fmCtx.scrubImageOk = 1;
+        page = headerPage;
+        magic = (uint8_t)(MAGIC_BW_IMAGE_HEADER + idx % 2u);
+    }
+    else
+    {
+        memset(addr, 0xff, sizeof(addr));
+        (void)W25Q32_ReadData(((uint32_t)headerPage << 8u) + FLASH_PAGE_HEADER_SIZE + (pos - 1u) * 2u, addr, 2u);
+        page = readU16(addr);
+        magic = (uint8_t)(MAGIC_BW_IMAGE_DATA + idx % 2u);
+    }
+
+    for (tries = 0; (page != 0xffff) && (tries < FLASH_SCRUB_READ_TRIES); tries++)
     {
-        UARTIF_uartPrintf(0, "flash_manager garbage collecting step three \n");
-        if (fmCtx.activeSegmentBaseStatus == MAGIC_LOW_ACTIVE)
+        if (scrubPage(page, magic, (uint8_t)(pos - 1u)))
         {
-            fmCtx.activeSegmentBaseStatus = MAGIC_HIGH_ACTIVE;
+            break;
         }
-        else 
+    }
+    if ((page == 0xffff) || ((tries == FLASH_SCRUB_READ_TRIES) && (G_buffer1[0] == DEAD_PAGE_MAGIC)))
+    {
+        // 没有这一帧，或GC复制时已无法读出、作废的page（当时已报告）
+        fmCtx.scrubImageOk = 0;
+    }
+    else if (tries == FLASH_SCRUB_READ_TRIES)
+    {
+        UARTIF_uartPrintf(0, "ERR: flash_manager 0x0D! scrub page 0x%04x crc error\n", page);
+        fmCtx.crcErrors++;
+        fmCtx.scrubImageOk = 0;
+        setImageVerified((uint8_t)idx, FALSE);
+        sectorFault(sectorOfPage(page));
+        if (pos == 0u)
         {
-            fmCtx.activeSegmentBaseStatus = MAGIC_LOW_ACTIVE;
+            // 图像头损坏时帧地址不可信
+            fmCtx.scrubCursor = (uint16_t)((idx + 1u) * (MAX_FRAME_NUM + 2u));
         }
-        result = resetSegment((fmCtx.activeSegmentBaseStatus == MAGIC_LOW_ACTIVE), SEGMENT_MAGIC_BACKUP, 0);
     }
-    
-    // 4. Update image header if needed
-    for (k = 1; k < 3; k++)
+    else if (tries != 0u)
+    {
+        // 重读后才通过：数据还在，趁早搬走重写
+        sectorFault(sectorOfPage(page));
+    }
+
+    if ((pos == MAX_FRAME_NUM + 1u) && fmCtx.scrubImageOk)
+    {
+        setImageVerified((uint8_t)idx, TRUE);
+    }
+    return TRUE;
+}
+
+/**
+ * @brief 后台统计page数（FM_getStats）：先每次读取FLASH_STATS_SCAN_STEP个扇区的日志尾部统计已写入的page，
+ *        再每次统计一个窗口的有效page，并把没有有效page的扇区中已写入的page从已写入数中减去（可回收，算空闲）；
+ *        统计期间仍在写入和回收，结果是近似值
+ */
+static void statsStep(void)
+{
+    uint16_t sector;
+    uint16_t end;
+    uint16_t firstPage;
+    uint16_t windowFirst;
+    uint16_t written;
+    uint8_t live;
+
+    if (fmCtx.statsCursor < fmCtx.sectorCount)
     {
-        for (i = 0; i < MAX_IMAGE_ENTRIES; i++) 
+        end = (uint16_t)(fmCtx.statsCursor + FLASH_STATS_SCAN_STEP);
+        if (end > fmCtx.sectorCount)
+        {
+            end = fmCtx.sectorCount;
+        }
+        // 有扇区头的扇区中日志尾部之前的page都已写入，回收后的扇区到分配时才擦除
+        for (sector = fmCtx.statsCursor; sector < end; sector++)
         {
-            if (fmCtx.entries[k][i] != 0xffff)
+            firstPage = (uint16_t)(sectorFirstPage(sector) + 1u);
+            if (readPageHeader(sectorFirstPage(sector)) == SECTOR_HEADER_MAGIC)
             {
-                result = FM_writeImageHeader(DATA_PAGE_MAGIC + k, i, (fmCtx.imageSlotColor[i] == 1) ? 1u : 0u);
-                if (result != FLASH_OK)
-                {
-                    UARTIF_uartPrintf(0, "ERR: flash_manager 0x08! write image header fail entry %d, type %d\n", i, k);
-                }
+                fmCtx.statsCount.usedPages += (uint16_t)(findLogTail(firstPage, (uint16_t)(firstPage + FLASH_LOG_PAGES_PER_SECTOR)) - firstPage);
             }
         }
+        fmCtx.statsCursor = end;
+        return;
     }
 
-    if (result == FLASH_OK)
+    windowFirst = (uint16_t)(fmCtx.statsCursor - fmCtx.sectorCount);
+    countLivePages(windowFirst);
+    for (sector = windowFirst; (sector < windowFirst + FLASH_SCAN_WINDOW_SECTORS) && (sector < fmCtx.sectorCount); sector++)
     {
-        UARTIF_uartPrintf(0, "flash_manager garbage collecting finished successfully! \n");
-
-        fmCtx.gcInProgress = 0;
+        live = liveCount(windowFirst, sector);
+        fmCtx.statsCount.livePages += live;
+        if (live == 0u)
+        {
+            fmCtx.statsCount.freeSectors++;
+            // 没有有效page的扇区（含已回收、等待擦除的扇区）分配时擦除，其中的page算空闲；正在写入的扇区除外
+            firstPage = (uint16_t)(sectorFirstPage(sector) + 1u);
+            if ((sector != fmCtx.openSector) && (readPageMagic(sectorFirstPage(sector)) == SECTOR_HEADER_MAGIC))
+            {
+                written = (uint16_t)(findLogTail(firstPage, (uint16_t)(firstPage + FLASH_LOG_PAGES_PER_SECTOR)) - firstPage);
+                // 两个阶段之间扇区可能已被擦除重写
+                fmCtx.statsCount.usedPages = (fmCtx.statsCount.usedPages > written) ? (uint16_t)(fmCtx.statsCount.usedPages - written) : 0u;
+            }
+        }
     }
-    else
+    fmCtx.statsCursor += FLASH_SCAN_WINDOW_SECTORS;
+    if (windowFirst + FLASH_SCAN_WINDOW_SECTORS >= fmCtx.sectorCount)
     {
-        UARTIF_uartPrintf(0, "ERR: flash_manager 0x08! gc error: %d\n", result);
+        fmCtx.statsDone = fmCtx.statsCount;
+        fmCtx.statsDoneMs = fmTickMs;
+        fmCtx.statsHave = 1;
+        fmCtx.statsCursor = 0xffff;
     }
-    
-    return result;
 }
 
+/**
+ * @brief 后台巡检：每次最多检查FLASH_SCRUB_PAGES_PER_STEP个page，一轮结束后等待FLASH_SCRUB_INTERVAL_MS
+ */
+static void scrubStep(uint32_t start)
+{
+    uint8_t n;
 
+    if (fmCtx.scrubWaiting && ((uint32_t)(fmTickMs - fmCtx.scrubPassEndMs) < FLASH_SCRUB_INTERVAL_MS))
+    {
+        return;
+    }
+    fmCtx.scrubWaiting = 0;
+    for (n = 0; (n < FLASH_SCRUB_PAGES_PER_STEP) && ((uint32_t)(fmTickMs - start) < FLASH_GC_STEP_BUDGET_MS); n++)
+    {
+        if (!scrubNextPage())
+        {
+            break;
+        }
+    }
+}
 
+/**
+ * @brief 强制执行垃圾回收
+ */
+flash_result_t FM_forceGarbageCollect(void)
+{
+    fm_sector_scan_t scan;
 
-/*****************************************************************************
- * Function implementation - global ('extern')
- ******************************************************************************/
+    waitForErase();
+    (void)gcFinish();
+    (void)refillFreeSectors(&scan);
+    if (scan.victim != 0xffff)
+    {
+        gcLoadVictim(scan.victim);
+    }
+    return gcFinish();
+}
 
 /**
- * @brief 初始化Flash管理器
+ * @brief 推进后台GC：每次最多执行FLASH_GC_STEP_BUDGET_MS；等待擦除完成时立即返回，空闲时预擦除下一个要分配的扇区或巡检
  */
-
-flash_result_t FM_init()
+void FM_process(void)
 {
-    boolean_t needToInitList = FALSE;
-    flash_result_t result = FLASH_OK;
-    memset(fmCtx.dataEntries, 0xff, sizeof(uint16_t) * MAX_DATA_ENTRIES);
-    memset(fmCtx.imageBwEntries, 0xff, sizeof(uint16_t) * MAX_IMAGE_ENTRIES);
-    memset(fmCtx.imageRedEntries, 0xff, sizeof(uint16_t) * MAX_IMAGE_ENTRIES);
-        memset(fmCtx.imageSlotColor, 0xFF, sizeof(fmCtx.imageSlotColor));
-    fmCtx.nextWriteAddress = 0xffff;
+    uint32_t start = fmTickMs;
 
-    fmCtx.entries[0] = fmCtx.dataEntries;
-    fmCtx.entries[1] = fmCtx.imageBwEntries;
-    fmCtx.entries[2] = fmCtx.imageRedEntries;
-    fmCtx.entriesCountMax[0] = MAX_DATA_ENTRIES;
-    fmCtx.entriesCountMax[1] = MAX_IMAGE_ENTRIES;
-    fmCtx.entriesCountMax[2] = MAX_IMAGE_ENTRIES;
-    
-    // 读取两个segment的header
-    if (result == FLASH_OK)
+    if (fmCtx.eraseBusy)
     {
-   
-        // 初始化管理器：读取两个 segment 的 header（segment0 -> header0, segment1 -> header1）
+        // 典型擦除时间的一半之内不查询状态，只恢复被读取暂停的擦除
+        if ((uint32_t)(fmTickMs - fmCtx.eraseStartMs) < W25Q32_SECTOR_ERASE_MS / 2u)
+        {
+            W25Q32_ResumeErase();
+            return;
+        }
+        if (W25Q32_IsBusy())
         {
-            flash_result_t r0;
-            flash_result_t r1;
+            return;
+        }
+        eraseDone();
+    }
 
-            r0 = readSegmentHeader(FLASH_SEGMENT0_BASE, FALSE);
-            if (r0 == FLASH_ERROR_READ_FAIL)
-            {
-                UARTIF_uartPrintf(0, "ERR: flash_manager 0x04! header0 error\n");
-            }
+    if ((fmCtx.gcState == FM_GC_IDLE) && fmCtx.scanNeeded && (fmCtx.freeCount < FLASH_FREE_LIST_LOW))
+    {
+        fmCtx.gcState = FM_GC_SCAN;
+        fmCtx.gcCursor = 0;
+    }
+    else if ((fmCtx.gcState == FM_GC_IDLE) && fmCtx.wearScanNeeded)
+    {
+        fmCtx.gcState = FM_GC_WEAR;
+        fmCtx.gcCursor = 0;
+    }
+    else if ((fmCtx.gcState == FM_GC_IDLE) && (fmCtx.coldSector != 0xffff) &&
+             (fmCtx.wearMax >= fmCtx.coldEraseCount + FLASH_WEAR_LEVEL_DELTA))
+    {
+        wearLevelColdSector();
+    }
+    else if ((fmCtx.gcState == FM_GC_IDLE) && (fmCtx.badPending != 0u))
+    {
+        drainBadSector();
+    }
 
-            r1 = readSegmentHeader(FLASH_SEGMENT1_BASE, TRUE);
-            if (r1 == FLASH_ERROR_READ_FAIL)
-            {
-                UARTIF_uartPrintf(0, "ERR: flash_manager 0x04! header1 error\n");
-            }
+    while ((fmCtx.gcState != FM_GC_IDLE) && ((uint32_t)(fmTickMs - start) < FLASH_GC_STEP_BUDGET_MS))
+    {
+        if (!gcStep() || fmCtx.eraseBusy)
+        {
+            break;
+        }
+    }
 
-            /* If both reads failed, consider init fail; otherwise continue */
-            if (r0 != FLASH_OK && r1 != FLASH_OK) {
-                result = FLASH_ERROR_READ_FAIL;
-            } else {
-                result = FLASH_OK;
-            }
+    if ((fmCtx.gcState == FM_GC_IDLE) && !fmCtx.eraseBusy && (fmCtx.freeCount > 0u) && !fmCtx.spareErased)
+    {
+        // 擦除后扇区头就没有了，先记下擦除次数
+        fmCtx.spareEraseCount = preferLeastWornFree() + 1u;
+        startErase(fmCtx.freeSectors[0]);
+    }
+
+    // 没有其他事情时统计FM_getStats请求的page数，或巡检已写入的图像
+    if ((fmCtx.gcState == FM_GC_IDLE) && !fmCtx.eraseBusy)
+    {
+        if (fmCtx.statsCursor != 0xffff)
+        {
+            statsStep();
+        }
+        else
+        {
+            scrubStep(start);
         }
     }
 
+    // Flash空闲FLASH_POWER_DOWN_IDLE_MS后进入掉电模式；回收、预擦除和一轮巡检都连续执行，之间很少需要唤醒
+    if (W25Q32_AccessCount() != fmCtx.lastAccessCount)
+    {
+        fmCtx.lastAccessCount = W25Q32_AccessCount();
+        fmCtx.lastAccessMs = fmTickMs;
+    }
+    else if ((fmCtx.gcState == FM_GC_IDLE) && !fmCtx.eraseBusy && !W25Q32_IsPoweredDown() &&
+             ((uint32_t)(fmTickMs - fmCtx.lastAccessMs) >= FLASH_POWER_DOWN_IDLE_MS))
+    {
+        W25Q32_PowerDown();
+        fmCtx.powerDowns++;
+    }
+}
+
+/**
+ * @brief 后台是否在回收、统计或巡检；等待擦除时不算
+ */
+boolean_t FM_isBusy(void)
+{
+    return (boolean_t)((fmCtx.gcState != FM_GC_IDLE) || (fmCtx.statsCursor != 0xffff) || !fmCtx.scrubWaiting);
+}
+
+/**
+ * @brief 统计擦除次数分布
+ */
+flash_result_t FM_getWearInfo(fm_wear_info_t* info)
+{
+    flash_result_t result = FLASH_OK;
+    uint16_t sector;
+    uint16_t prevSector;
+    uint32_t seq;
+    uint32_t eraseCount;
+    uint32_t span;
+    uint8_t bin;
+
+    if (info == NULL)
+    {
+        result = FLASH_ERROR_INVALID_PARAM;
+    }
+
     if (result == FLASH_OK)
     {
-        if ((fmCtx.header0.headerMagic != SEGMENT_HEADER_MAGIC) && (fmCtx.header1.headerMagic != SEGMENT_HEADER_MAGIC)) {
-            resetSegments(TRUE, TRUE, SEGMENT_MAGIC_ACTIVE, SEGMENT_MAGIC_BACKUP, &result);
-        }
-        else if ((fmCtx.header0.headerMagic != SEGMENT_HEADER_MAGIC) && (fmCtx.header1.headerMagic == SEGMENT_HEADER_MAGIC)) {
-            resetSegments(TRUE, FALSE, (fmCtx.header1.statusMagic == SEGMENT_MAGIC_BACKUP) ? SEGMENT_MAGIC_ACTIVE : SEGMENT_MAGIC_BACKUP, 0, &result);
-            fmCtx.activeSegmentBaseStatus = (fmCtx.header1.statusMagic == SEGMENT_MAGIC_BACKUP) ? MAGIC_LOW_ACTIVE : MAGIC_HIGH_ACTIVE;
+        waitForErase();
+        memset(info, 0, sizeof(fm_wear_info_t));
+        info->minEraseCount = 0xffffffff;
+        for (sector = 0; sector < fmCtx.sectorCount; sector++)
+        {
+            if (readSectorInfo(sector, &seq, &prevSector, &eraseCount))
+            {
+                info->knownSectors++;
+                info->totalEraseCount += eraseCount;
+                if (eraseCount < info->minEraseCount)
+                {
+                    info->minEraseCount = eraseCount;
+                }
+                if (eraseCount > info->maxEraseCount)
+                {
+                    info->maxEraseCount = eraseCount;
+                }
+            }
         }
-        else if ((fmCtx.header0.headerMagic == SEGMENT_HEADER_MAGIC) && (fmCtx.header1.headerMagic != SEGMENT_HEADER_MAGIC)) {
-            resetSegments(FALSE, TRUE, 0, (fmCtx.header0.statusMagic == SEGMENT_MAGIC_BACKUP) ? SEGMENT_MAGIC_ACTIVE : SEGMENT_MAGIC_BACKUP, &result);
-            fmCtx.activeSegmentBaseStatus = (fmCtx.header0.statusMagic == SEGMENT_MAGIC_BACKUP) ? MAGIC_HIGH_ACTIVE : MAGIC_LOW_ACTIVE;
+        if (info->knownSectors == 0u)
+        {
+            info->minEraseCount = 0;
         }
-        else 
+
+        // 第二遍按[min, max]等分统计分布
+        span = info->maxEraseCount - info->minEraseCount + 1u;
+        for (sector = 0; (sector < fmCtx.sectorCount) && (info->knownSectors > 0u); sector++)
         {
-            // 根据header状态确定激活segment
-            if (fmCtx.header0.statusMagic == SEGMENT_MAGIC_ACTIVE && fmCtx.header1.statusMagic == SEGMENT_MAGIC_BACKUP)
-            {
-                // 正常情况：segment0激活，segment1备用
-                fmCtx.activeSegmentBaseStatus = MAGIC_LOW_ACTIVE;
-                UARTIF_uartPrintf(0, "flash_manager low active\n");
-                needToInitList = TRUE;
-                fmCtx.currentGcCounter = fmCtx.header0.gcCounter;
-            } 
-            else if (fmCtx.header1.statusMagic == SEGMENT_MAGIC_ACTIVE && fmCtx.header0.statusMagic == SEGMENT_MAGIC_BACKUP)
-            {
-                // segment1激活，segment0备用
-                fmCtx.activeSegmentBaseStatus = MAGIC_HIGH_ACTIVE;
-                UARTIF_uartPrintf(0, "flash_manager high active\n");
-                needToInitList = TRUE;
-                fmCtx.currentGcCounter = fmCtx.header1.gcCounter;
-            } 
-            else if (fmCtx.header1.statusMagic == SEGMENT_MAGIC_ACTIVE && fmCtx.header0.statusMagic == SEGMENT_MAGIC_ACTIVE)
+            if (readSectorInfo(sector, &seq, &prevSector, &eraseCount))
             {
-                // 垃圾回收中断，需要恢复
-                // TO DO：
-                fmCtx.gcInProgress = 1;
-                UARTIF_uartPrintf(0, "flash_manager GC redo! \n");
-                result = judgeWhichSegmentIsActive();
-                if (result != FLASH_OK) {
-                    resetSegments(TRUE, TRUE, SEGMENT_MAGIC_ACTIVE, SEGMENT_MAGIC_BACKUP, &result);
-                }
-                else
+                bin = (uint8_t)(((eraseCount - info->minEraseCount) * FLASH_WEAR_HISTOGRAM_BINS) / span);
+                if (bin >= FLASH_WEAR_HISTOGRAM_BINS)
                 {
-                    needToInitList = TRUE;
+                    // 两遍之间扇区头被改写
+                    bin = FLASH_WEAR_HISTOGRAM_BINS - 1u;
                 }
-            } 
-            else
-            {
-                UARTIF_uartPrintf(0, "flash_manager start to init sg 0 else! \n");
-                // segment1激活，segment0备用
-                resetSegments(TRUE, FALSE, SEGMENT_MAGIC_ACTIVE, 0, &result);
-                UARTIF_uartPrintf(0, "flash_manager low active\n");
+                info->histogram[bin]++;
             }
         }
     }
+    return result;
+}
+
+/**
+ * @brief 获取存储统计
+ */
+flash_result_t FM_getStats(fm_stats_t* stats)
+{
+    flash_result_t result = FLASH_OK;
+    uint8_t i;
 
-    // 扫描激活segment构建映射表
+    if (stats == NULL)
+    {
+        result = FLASH_ERROR_INVALID_PARAM;
+    }
 
-    if (result == FLASH_OK) 
+    if (result == FLASH_OK)
     {
-        if (needToInitList)
+        memset(stats, 0, sizeof(fm_stats_t));
+        if (fmCtx.statsCursor == 0xffff)
         {
-            result = scanSegmentPages();
+            memset(&fmCtx.statsCount, 0, sizeof(fmCtx.statsCount));
+            fmCtx.statsCursor = 0;
         }
-        else 
+        stats->totalSectors = fmCtx.sectorCount;
+        stats->pageStatsAgeMs = 0xffffffff;
+        if (fmCtx.statsHave)
         {
-            if (fmCtx.activeSegmentBaseStatus == MAGIC_LOW_ACTIVE)
-            {
-                fmCtx.nextWriteAddress = 0x0001;
-            }
-            else 
+            stats->usedPages = fmCtx.statsDone.usedPages;
+            stats->freePages = (uint16_t)(fmCtx.sectorCount * FLASH_LOG_PAGES_PER_SECTOR - stats->usedPages);
+            stats->livePages = fmCtx.statsDone.livePages;
+            stats->freeSectors = fmCtx.statsDone.freeSectors;
+            // 共用的帧重复计数，有效page数可能略多
+            stats->stalePages = (stats->usedPages > stats->livePages) ? (uint16_t)(stats->usedPages - stats->livePages) : 0u;
+            stats->pageStatsAgeMs = fmTickMs - fmCtx.statsDoneMs;
+        }
+
+        stats->gcRuns = fmCtx.gcRuns;
+        stats->gcPagesCopied = fmCtx.gcPagesCopied;
+        stats->gcTotalMs = fmCtx.gcTotalMs;
+        stats->gcMaxMs = fmCtx.gcMaxMs;
+        stats->bytesRequested = fmCtx.bytesRequested;
+        stats->bytesWritten = fmCtx.bytesWritten;
+        stats->crcErrors = fmCtx.crcErrors;
+        stats->scrubPasses = fmCtx.scrubPasses;
+        stats->badSectors = 0;
+        for (i = 0; i < fmCtx.badCount; i++)
+        {
+            if (fmCtx.badFaults[i] >= FLASH_BAD_SECTOR_FAULTS)
             {
-                fmCtx.nextWriteAddress = 0x2001;
+                stats->badSectors++;
             }
-            fmCtx.gcInProgress = 0;
         }
+        stats->erases = fmCtx.erases;
+        stats->eraseTotalMs = fmCtx.eraseTotalMs;
+        stats->eraseMaxMs = fmCtx.eraseMaxMs;
+        stats->powerDowns = fmCtx.powerDowns;
     }
+    return result;
+}
 
-    if ((result == FLASH_OK) && (fmCtx.gcInProgress == 1))
-    {
-        result = garbageCollect();
-    }
-
-    /* Populate per-slot color flags by reading existing image headers (if present) */
-    // Disabled to prevent automatic loading of image headers on boot which may trigger unwanted display updates
-    // if ((result == FLASH_OK) && (needToInitList))
-    // {
-    //     uint8_t kk;
-    //     uint8_t jj;
-    //     for (kk = 1; kk < 3; kk++)
-    //     {
-    //         for (jj = 0; jj < MAX_IMAGE_ENTRIES; jj++)
-    //         {
-    //             if (fmCtx.entries[kk][jj] != 0xffff)
-    //             {
-    //                 (void)readImageHeaderIntoBuffer((DATA_PAGE_MAGIC + kk), jj);
-    //             }
-    //         }
-    //     }
-    // }
+/**
+ * @brief 1ms时基
+ */
+void FM_tick1ms(void)
+{
+    fmTickMs++;
+}
 
-    UARTIF_uartPrintf(0, "flash_manager FM_init about to return\n");
-    return result;
+/**
+ * @brief 读取1ms时基
+ */
+uint32_t FM_getTickMs(void)
+{
+    return fmTickMs;
 }
 
 /**
- * @brief 写入数据
+ * @brief 写入图像头页
  */
-flash_result_t FM_writeData(uint8_t magic, uint16_t dataId, const uint8_t* data, uint16_t size)
+flash_result_t FM_writeImageHeader(uint8_t magic, uint8_t slotId, uint8_t lastIsRed)
 {
     flash_result_t result = FLASH_OK;
-    uint32_t crc32;
-    uint32_t nextWriteAddress = 0;
-    // uint8_t slotId;
+    fm_image_stream_t* stream;
+    uint8_t frame;
 
-    // 检查是否需要垃圾回收
-    result = checkArguments(magic, dataId, data, size);
-    if (result == FLASH_OK)
+    if (magic != MAGIC_BW_IMAGE_HEADER && magic != MAGIC_RED_IMAGE_HEADER)
     {
-        result = checkAndDoGarbageCollection();
-        nextWriteAddress |= (uint32_t) (fmCtx.nextWriteAddress << 8u);
-
-        if (fmCtx.activeSegmentBaseStatus == MAGIC_LOW_ACTIVE)
-        {
-            if (nextWriteAddress >= FLASH_SEGMENT1_BASE)
-            {
-                result = FLASH_ERROR_NO_SPACE;
-            }
-        }
-        else 
-        {
-            if (nextWriteAddress >= FLASH_TOTAL_SIZE || nextWriteAddress < FLASH_SEGMENT1_BASE)
-            {
-                result = FLASH_ERROR_NO_SPACE;
-            }
-        }
-        if (nextWriteAddress == (FLASH_SEGMENT0_BASE) || nextWriteAddress == (FLASH_SEGMENT1_BASE))
-        {
-            result = FLASH_ERROR_INVALID_PARAM;
-        }
+        result = FLASH_ERROR_INVALID_PARAM;
     }
-    else
+
+    if (slotId >= MAX_IMAGE_ENTRIES)
     {
         result = FLASH_ERROR_INVALID_PARAM;
     }
 
     if (result == FLASH_OK)
     {
-        // 清空缓冲区
-        memset(G_buffer1, 0, FLASH_PAGE_SIZE);
-
-        // 将数据页字段复制到缓冲区
-        G_buffer1[0] = magic; // 魔法数字
-        G_buffer1[1] = (uint8_t)(dataId & 0xFF); // if image data, this byte is frameNum
-        // slotId = G_buffer1[2] = (uint8_t)((dataId >> 8) & 0xFF); // if image data, this byte is slotId
-        G_buffer1[2] = (uint8_t)((dataId >> 8) & 0xFF); // if image data, this byte is slotId
-        G_buffer1[3] = size;
-    
-        // 计算CRC32（只计算数据部分）
-        crc32 = calculate_crc32_default(data, size);
-        G_buffer1[4] = (uint8_t)(crc32 & 0xFF);
-        G_buffer1[5] = (uint8_t)((crc32 >> 8) & 0xFF);
-        G_buffer1[6] = (uint8_t)((crc32 >> 16) & 0xFF);
-        G_buffer1[7] = (uint8_t)((crc32 >> 24) & 0xFF);
-    
-        memcpy(&G_buffer1[8], data, size);
-
-        // CRITICAL: DISABLE debug output during image transfer
-        // This interferes with UART protocol communication (ACK/NAK responses)
-        // UARTIF_uartPrintf(0, "flash_manager: write data to flash nextWriteAddress is 0x%08x! \n", nextWriteAddress);
-
-        // 写入Flash
-        if (W25Q32_WritePage(nextWriteAddress, G_buffer1, FLASH_PAGE_SIZE) != 0)
+        waitForErase();
+        // 先分配好写入位置：分配扇区时可能阻塞回收，回收会改写G_imageAddressBuffer并搬移帧
+        result = ensureWritablePage();
+        // 图像头和槽位目录page写在同一个扇区：两次写入之间分配扇区时，回收看不到还没登记的新图像头
+        if ((result == FLASH_OK) && ((fmCtx.nextWriteAddress % FLASH_PAGES_PER_SECTOR) == FLASH_PAGES_PER_SECTOR - 1u))
         {
-            result = FLASH_ERROR_WRITE_FAIL;
-        }
-        else
-        {
-            // Write successful
+            result = openNewSector();
         }
     }
-    // 更新映射表
+
     if (result == FLASH_OK)
     {
-        if (magic == DATA_PAGE_MAGIC || magic == MAGIC_BW_IMAGE_HEADER || magic == MAGIC_RED_IMAGE_HEADER)
+        // 图像头在G_imageAddressBuffer中组包，FM_readImage缓存的帧地址随之作废
+        invalidateImageCache();
+        stream = findImageStream(magic + 2u, slotId);
+        // 帧地址在写入时已记录，不需要读Flash
+        for (frame = 0; (stream != NULL) && (frame <= MAX_FRAME_NUM); frame++)
         {
-            fmCtx.entries[magic & 0x03][dataId] = fmCtx.nextWriteAddress;
-            if (magic == MAGIC_BW_IMAGE_HEADER || magic == MAGIC_RED_IMAGE_HEADER)
+            G_imageAddressBuffer[frame] = streamFramePage(stream, frame);
+            if (G_imageAddressBuffer[frame] == 0xffff)
             {
-                // UARTIF_uartPrintf(0, "FM_writeData: Updated entries[%d][%d] = 0x%04x (magic=0x%02x)\r\n", 
-                //                 magic & 0x03, dataId, fmCtx.nextWriteAddress, magic);
+                // 记录曾被替换过或扇区表已满，缺少的帧只能到日志里找
+                stream = NULL;
             }
         }
-        else if (magic == MAGIC_BW_IMAGE_DATA || magic == MAGIC_RED_IMAGE_DATA)
-        {
-            // Image data written
-        }
-        else
+        if (stream == NULL)
         {
-            result = FLASH_ERROR_INVALID_PARAM;
+            memset(G_imageAddressBuffer, 0xff, sizeof(G_imageAddressBuffer));
+            result = scanImageDataPages(magic + 2u, slotId);
         }
-        fmCtx.nextWriteAddress++;
     }
-    
+
+    if (result == FLASH_OK)
+    {
+        /* Append 1-byte color flag */
+        ((uint8_t*)G_imageAddressBuffer)[(MAX_FRAME_NUM + 1) * 2] = (uint8_t)(lastIsRed);
+        /* 写入 addresses + color flag */
+        result = FM_writeData(magic, slotId, (uint8_t*)G_imageAddressBuffer, IMAGE_HEADER_SIZE);
+    }
     return result;
 }
 
 /**
- * @brief 读取数据
+ * @brief 把槽位图像头中的帧地址读到G_imageAddressBuffer，已是该图像时不再读取
+ * @param magic 图像数据页magic
  */
-flash_result_t FM_readData(uint8_t magic, uint16_t dataId, uint8_t* data, uint8_t size)
+static flash_result_t loadImageAddresses(uint8_t magic, uint8_t slotId)
 {
     flash_result_t result = FLASH_OK;
-    uint32_t calculatedCrc, storedCrc;
-    uint8_t pageDataSize;
-    uint32_t destAddress = 0;
-    uint8_t readSize = size;
-    // uint8_t slotId = 0u;
-    uint8_t frameNum = 0u;
+    fm_slot_entry_t* slot;
+    uint16_t headerAddr;
 
-    // 在映射表中查找
-    result = checkArguments(magic, dataId, data, size);
-    if (result == FLASH_OK)
+    if (magic != lastMagicInBuffer || slotId != lastSlotIdInBuffer)
     {
-        // UARTIF_uartPrintf(0, "flash_manager: read data from flash! \n");
-        if (magic == DATA_PAGE_MAGIC || magic == MAGIC_BW_IMAGE_HEADER || magic == MAGIC_RED_IMAGE_HEADER)
+        // 读取失败时缓冲区已清空，不能再当作之前的图像
+        lastMagicInBuffer = 0xff;
+        lastSlotIdInBuffer = 0xff;
+        verifiedRun = 0;
+        memset(G_imageAddressBuffer, 0xff, sizeof(G_imageAddressBuffer));
+        slot = lookupSlot(slotId);
+        headerAddr = (slot != NULL) ? slot->headers[magic - MAGIC_BW_IMAGE_DATA] : 0xffff;
+        // UARTIF_uartPrintf(0, "FM_readImage: magic=0x%02x hdr=0x%04x\r\n", magic, headerAddr);
+        if (headerAddr == 0xffff)
         {
-            if (fmCtx.entries[magic & 0x03][dataId] == 0xffff)
-            {
-                result = FLASH_ERROR_NOT_FOUND;
-            }
-            else
-            {
-                destAddress |= (uint32_t) (fmCtx.entries[magic & 0x03][dataId] << 8u);
-            }
+            result = FLASH_ERROR_NOT_FOUND;
         }
-        else if (magic == MAGIC_BW_IMAGE_DATA || magic == MAGIC_RED_IMAGE_DATA)
+        else
         {
-            // slotId = (uint8_t)((dataId & 0xff00u) >> 8u);
-            frameNum = (uint8_t)(dataId & 0xffu);
-            if (G_imageAddressBuffer[frameNum] == 0xffff)
-            {
-                result = FLASH_ERROR_NOT_FOUND;
-            }
-            else
-            {
-                destAddress |= (uint32_t) (G_imageAddressBuffer[frameNum] << 8u);
-            }
+            result = readImageHeaderIntoBuffer((magic - 2u), slotId);
         }
-        else
+        if (result == FLASH_OK)
         {
-            // do nothing
+            lastMagicInBuffer = magic;
+            lastSlotIdInBuffer = slotId;
         }
     }
-    else
-    {
-        result = FLASH_ERROR_INVALID_PARAM;
-    }
+    return result;
+}
 
-    // 读取数据页
-    if (result == FLASH_OK)
+/**
+ * @brief 从已读到内存的压缩帧page中解压一帧到data（PAYLOAD_SIZE字节）
+ * @param data NULL：不解压，只校验（后台巡检用）
+ * @param verify FALSE：不校验解压后数据的CRC
+ */
+static flash_result_t unpackFrame(const uint8_t* page, uint8_t frameNum, uint8_t* data, boolean_t verify)
+{
+    flash_result_t result = FLASH_ERROR_NOT_FOUND;
+    uint16_t offset = FLASH_PAGE_HEADER_SIZE;
+    uint32_t outLen;
+    uint8_t len;
+
+    while ((result == FLASH_ERROR_NOT_FOUND) && (offset + FLASH_PACKED_RECORD_HEADER_SIZE <= FLASH_PAGE_SIZE) &&
+           (page[offset] <= MAX_FRAME_NUM))
     {
-        memset(G_buffer1, 0, FLASH_PAGE_SIZE);
-        // 读取数据页到缓冲区
-        if (W25Q32_ReadData(destAddress, G_buffer1, FLASH_PAGE_SIZE) != 0) 
+        len = page[offset + 1u];
+        if (page[offset] != frameNum)
         {
-            result = FLASH_ERROR_READ_FAIL;
+            offset += FLASH_PACKED_RECORD_HEADER_SIZE + len;
         }
-    }
-    
-    if (result == FLASH_OK)
-    {
-        // 验证魔法数字
-        if (G_buffer1[0] != magic)
+        else if (offset + FLASH_PACKED_RECORD_HEADER_SIZE + len > FLASH_PAGE_SIZE)
         {
-            result = FLASH_ERROR_INVALID_PARAM;
+            result = FLASH_ERROR_CRC_FAIL;
         }
-    }
-    
-    // 验证CRC32（只验证数据部分）
-    if (result == FLASH_OK)
-    {
-        // 从缓冲区解析数据页字段
-        pageDataSize = G_buffer1[3];
-        storedCrc = (uint32_t)G_buffer1[4] | ((uint32_t)G_buffer1[5] << 8) | 
-                     ((uint32_t)G_buffer1[6] << 16) | ((uint32_t)G_buffer1[7] << 24);
-
-        calculatedCrc = calculate_crc32_default(&G_buffer1[8], pageDataSize);
-        if (calculatedCrc != storedCrc) 
+        else if (data == NULL)
+        {
+            result = (((uint16_t)rle_decoded_crc32(&page[offset + FLASH_PACKED_RECORD_HEADER_SIZE], len, &outLen) ==
+                       readU16(&page[offset + 2u])) && (outLen == PAYLOAD_SIZE)) ? FLASH_OK : FLASH_ERROR_CRC_FAIL;
+        }
+        else if ((rle_decode(&page[offset + FLASH_PACKED_RECORD_HEADER_SIZE], len, data, PAYLOAD_SIZE) != PAYLOAD_SIZE) ||
+                 (verify && ((uint16_t)calculate_crc32_default(data, PAYLOAD_SIZE) != readU16(&page[offset + 2u]))))
         {
             result = FLASH_ERROR_CRC_FAIL;
         }
-    }
-
-    // 检查缓冲区大小
-    if (result == FLASH_OK)
-    {
-        if (readSize > pageDataSize) 
+        else
         {
-            readSize = pageDataSize;
-            // 复制数据
-
-            result = FLASH_ERROR_INVALID_PARAM;
+            result = FLASH_OK;
         }
-
-        memcpy(data, &G_buffer1[8], readSize);
     }
-    
     return result;
 }
 
 /**
- * @brief 删除数据
+ * @brief 按帧号顺序读出一个图像的全部帧
+ *        每个page只发一次读命令，page头和payload一起读出；压缩帧page读出后留在G_buffer1中，
+ *        其中的帧依次解压到buffer，不再为每帧重新读取；回调拿到的data直接指向缓冲区，不再复制
+ *        FM_VERIFY_ONCE时全部帧校验通过后记为已校验，之后读取该图像不再计算CRC
  */
-flash_result_t FM_deleteData(uint16_t dataId)
+flash_result_t FM_readImagePlane(uint8_t magic, uint8_t slotId, uint8_t* buffer, fm_frame_callback_t callback)
 {
     flash_result_t result = FLASH_OK;
-    if (dataId >= MAX_DATA_ENTRIES)
+    flash_result_t frameResult;
+    uint16_t framePage;
+    uint16_t bufferedPage = 0xffff;
+    const uint8_t* data;
+    uint8_t frame;
+    boolean_t verify;
+    boolean_t allVerified;
+
+    if ((magic != MAGIC_BW_IMAGE_DATA && magic != MAGIC_RED_IMAGE_DATA) || (slotId >= MAX_IMAGE_ENTRIES) || (buffer == NULL) || (callback == NULL))
     {
         result = FLASH_ERROR_INVALID_PARAM;
     }
 
     if (result == FLASH_OK)
     {
-        fmCtx.dataEntries[dataId] = 0xffff;
-        fmCtx.gcInProgress = 1;
-        result = garbageCollect();
+        // 图像头读取失败时帧地址全部为0xffff，每帧都按未找到回调
+        (void)loadImageAddresses(magic, slotId);
+        verify = needVerify(magic, slotId);
+        allVerified = verify;
+        for (frame = 0; frame <= MAX_FRAME_NUM; frame++)
+        {
+            framePage = G_imageAddressBuffer[frame];
+            frameResult = FLASH_OK;
+            data = NULL;
+            if (framePage == 0xffff)
+            {
+                frameResult = FLASH_ERROR_NOT_FOUND;
+            }
+            else if (framePage != bufferedPage)
+            {
+                memset(G_buffer1, 0, FLASH_PAGE_SIZE);
+                if (W25Q32_ReadData((uint32_t)framePage << 8u, G_buffer1, FLASH_PAGE_SIZE) != 0)
+                {
+                    frameResult = FLASH_ERROR_READ_FAIL;
+                }
+                bufferedPage = ((frameResult == FLASH_OK) && (G_buffer1[0] == PACKED_MAGIC(magic))) ? framePage : 0xffff;
+            }
+
+            if ((frameResult == FLASH_OK) && (bufferedPage == framePage))
+            {
+                frameResult = unpackFrame(G_buffer1, frame, buffer, verify);
+                data = buffer;
+            }
+            else if (frameResult == FLASH_OK)
+            {
+                frameResult = checkFramePage(magic, verify);
+                data = &G_buffer1[FLASH_PAGE_HEADER_SIZE];
+            }
+
+            if (frameResult != FLASH_OK)
+            {
+                if (frameResult == FLASH_ERROR_CRC_FAIL)
+                {
+                    fmCtx.crcErrors++;
+                }
+                data = NULL;
+                result = frameResult;
+                allVerified = FALSE;
+            }
+            callback(frame, data, frameResult);
+        }
+        if (allVerified)
+        {
+            setImageVerified((uint8_t)(slotId * 2u + (magic - MAGIC_BW_IMAGE_DATA)), TRUE);
+        }
     }
     return result;
 }
 
 /**
- * @brief 强制执行垃圾回收
- */
-flash_result_t FM_forceGarbageCollect(void)
-{
-    return garbageCollect();
-}
-
-/**
- * @brief 写入图像头页
+ * @brief 设置读取图像帧时的CRC校验策略
  */
-flash_result_t FM_writeImageHeader(uint8_t magic, uint8_t slotId, uint8_t lastIsRed)
+flash_result_t FM_setVerifyPolicy(fm_verify_policy_t policy)
 {
     flash_result_t result = FLASH_OK;
-	uint16_t buf_addr1;
-	uint16_t buf_addr0;
-
-    if (magic != MAGIC_BW_IMAGE_HEADER && magic != MAGIC_RED_IMAGE_HEADER)
-    {
-        result = FLASH_ERROR_INVALID_PARAM;
-    }
 
-    if (slotId >= MAX_IMAGE_ENTRIES)
+    if ((policy != FM_VERIFY_ALWAYS) && (policy != FM_VERIFY_ONCE) && (policy != FM_VERIFY_NONE))
     {
         result = FLASH_ERROR_INVALID_PARAM;
     }
-
-    if (result == FLASH_OK)
-    {
-        memset(G_imageAddressBuffer, 0xff, sizeof(G_imageAddressBuffer));
-        result = scanImageDataPages(magic + 2u, slotId);
-    }
-
-    if (result == FLASH_OK)
+    else
     {
-        // 清空缓冲区
-        memset(G_buffer2, 0, FLASH_PAGE_SIZE);
-        memcpy(G_buffer2, G_imageAddressBuffer, (MAX_FRAME_NUM + 1) * 2);
-        
-        /* Append 1-byte color flag */
-        G_buffer2[(MAX_FRAME_NUM + 1) * 2] = (uint8_t)(lastIsRed);
-        /* 写入 addresses + color flag */
-        result = FM_writeData(magic, slotId, G_buffer2, (MAX_FRAME_NUM + 1) * 2 + 1);
-        if (result == FLASH_OK)
-        {
-            if (slotId < MAX_IMAGE_ENTRIES)
-            {
-                fmCtx.imageSlotColor[slotId] = lastIsRed;
-            }
-        }
+        fmCtx.verifyPolicy = (uint8_t)policy;
     }
     return result;
 }
@@ -1191,12 +4057,9 @@ flash_result_t FM_writeImageHeader(uint8_t magic, uint8_t slotId, uint8_t lastIs
  */
 flash_result_t FM_readImage(uint8_t magic, uint8_t slotId, uint8_t frameNum, uint8_t* data)
 {
-    static uint8_t lastMagicInBuffer = 0xff;
-    static uint8_t lastSlotIdInBuffer = 0xff;
     flash_result_t result = FLASH_OK;
-    uint16_t dataId = 0;
-	uint8_t entriesIndex;
-	uint16_t headerAddr;
+    uint16_t framePage;
+    boolean_t verify;
 
     if (magic != MAGIC_BW_IMAGE_DATA && magic != MAGIC_RED_IMAGE_DATA)
     {
@@ -1213,34 +4076,58 @@ flash_result_t FM_readImage(uint8_t magic, uint8_t slotId, uint8_t frameNum, uin
 
     if (result == FLASH_OK)
     {
-        if (magic != lastMagicInBuffer || slotId != lastSlotIdInBuffer)
+        result = loadImageAddresses(magic, slotId);
+    }
+
+    if (result == FLASH_OK)
+    {
+        framePage = G_imageAddressBuffer[frameNum];
+        verify = needVerify(magic, slotId);
+        if (framePage == 0xffff)
         {
-            memset(G_imageAddressBuffer, 0xff, sizeof(G_imageAddressBuffer));
-            entriesIndex = (magic - 2u) & 0x03;
-            headerAddr = fmCtx.entries[entriesIndex][slotId];
-            // UARTIF_uartPrintf(0, "FM_readImage: magic=0x%02x idx=%d hdr=0x%04x\r\n", magic, entriesIndex, headerAddr);
-            if (headerAddr == 0xffff)
+            result = FLASH_ERROR_NOT_FOUND;
+        }
+        else if (readPageHeader(framePage) == PACKED_MAGIC(magic))
+        {
+            // 压缩帧只读取它自己的记录，解压到data
+            result = readPackedFrame(framePage, frameNum, data, verify);
+        }
+        else
+        {
+            memset(G_buffer1, 0, FLASH_PAGE_SIZE);
+            if (W25Q32_ReadData((uint32_t)framePage << 8u, G_buffer1, FLASH_PAGE_SIZE) != 0)
             {
-                result = FLASH_ERROR_NOT_FOUND;
+                result = FLASH_ERROR_READ_FAIL;
             }
             else
             {
-                result = readImageHeaderIntoBuffer((magic - 2u), slotId);
+                result = checkFramePage(magic, verify);
             }
             if (result == FLASH_OK)
             {
-                lastMagicInBuffer = magic;
-                lastSlotIdInBuffer = slotId;
+                memcpy(data, &G_buffer1[FLASH_PAGE_HEADER_SIZE], PAYLOAD_SIZE);
             }
         }
-    }
-
-    if (result == FLASH_OK)
-    {
-        dataId = (uint16_t)slotId;
-        dataId = dataId << 8u;
-        dataId |= (uint16_t)frameNum;
-        result = FM_readData(magic, dataId, data, PAYLOAD_SIZE);
+        // FM_VERIFY_ONCE：从第0帧起按顺序全部校验通过时记为已校验
+        if (verify && (result == FLASH_OK))
+        {
+            if (frameNum == 0u)
+            {
+                verifiedRun = 0;
+            }
+            if (frameNum == verifiedRun)
+            {
+                verifiedRun++;
+            }
+            if (verifiedRun > MAX_FRAME_NUM)
+            {
+                setImageVerified((uint8_t)(slotId * 2u + (magic - MAGIC_BW_IMAGE_DATA)), TRUE);
+            }
+        }
+        else if (result == FLASH_ERROR_CRC_FAIL)
+        {
+            fmCtx.crcErrors++;
+        }
         if (result != FLASH_OK)
         {
             // if (frameNum == 0) UARTIF_uartPrintf(0, "FM_readImage DATA: magic=0x%02x err=%d\r\n", magic, result);
@@ -25,7 +25,7 @@ typedef enum {
 //     FLASH_SCAN_JOB_SCAN_IMAGE_DATA_BW,
 //     FLASH_SCAN_JOB_SCAN_IMAGE_DATA_RED
 // } flashScanJob_t;
-// Segment头结构（14字节）
+// 旧版segment头结构（14字节），只在启动迁移旧布局时读取
 typedef struct {
     uint8_t headerMagic;       // Segment头魔法数字 区分数据page
     uint8_t segmentId;         // Segment ID (0或1)
@@ -55,21 +55,173 @@ typedef struct {
 //     uint8_t pageAddress;      // 对应的page地址
 // } address_t;
 
+// 后台GC状态
+typedef enum {
+    FM_GC_IDLE = 0,     // 无GC
+    FM_GC_SCAN,         // 逐窗口统计各扇区有效page数，补充空闲扇区列表并选出回收扇区
+    FM_GC_RELOCATE,     // 把回收扇区中的有效数据page和图像帧复制到日志尾部
+    FM_GC_FIXUP,        // 重写引用了回收扇区图像帧的图像头
+    FM_GC_RELEASE,      // 确认回收扇区不再被引用后放回空闲扇区列表（分配时再擦除）
+    FM_GC_WEAR          // 逐段读取扇区头中的擦除次数，找出最冷的扇区
+} fm_gc_state_t;
+
+// 统计扇区有效page数的累计结果
+typedef struct {
+    uint16_t victim;                 // 有效page最少（但不为0）的扇区，0xffff：无
+    uint8_t  minLive;                // victim的有效page数
+    uint8_t  added;                  // 本次加入空闲扇区列表的扇区数
+    uint16_t freeTotal;              // 整片不含有效page的扇区数
+} fm_sector_scan_t;
+
+// 后台统计的page数（FM_getStats）
+typedef struct {
+    uint16_t usedPages;
+    uint16_t livePages;
+    uint16_t freeSectors;
+} fm_page_count_t;
+
+// 槽位目录中一个槽位的内容，RAM中只缓存最近使用的几个
+typedef struct {
+    uint8_t  slotId;                 // 0xff：空
+    uint8_t  color;                  // 颜色标志：0 = BW, 1 = RED, 0xFF = 未知
+    uint16_t headers[2];             // 黑白、红白图像头page，0xffff：无
+} fm_slot_entry_t;
+
+// 接收中的图像：FM_writeData写入的帧地址，写图像头时直接使用
+typedef struct {
+    uint8_t  magic;                  // 图像数据页magic，0xff：空闲
+    uint8_t  slotId;
+    uint8_t  idle;                   // 之后其他图像写入的帧数，超过一张图像的帧数视为已放弃
+    uint8_t  packUsed;               // packPage中已写入的记录字节数
+    uint16_t packPage;               // 正在追加压缩帧的page，0xffff：无
+    uint8_t  frameCodes[MAX_FRAME_NUM + 1u]; // 帧n所在page：streamSectors表项<<4 | 扇区内page，0xff：未写入
+} fm_image_stream_t;
+
+// 最近写入的图像帧：payload CRC -> page
+typedef struct {
+    uint32_t crc32;
+    uint16_t page;                   // 0xffff：空
+} fm_dedup_entry_t;
+
+// 擦除次数分布（FM_getWearInfo）
+typedef struct {
+    uint32_t minEraseCount;          // 有扇区头的扇区中最少的擦除次数
+    uint32_t maxEraseCount;          // 最多的擦除次数
+    uint32_t totalEraseCount;        // 有扇区头的扇区擦除次数总和
+    uint16_t knownSectors;           // 有扇区头（擦除次数已知）的扇区数，其余扇区从未使用或已被擦除
+    uint16_t histogram[FLASH_WEAR_HISTOGRAM_BINS]; // 把[minEraseCount, maxEraseCount]等分后各区间的扇区数
+} fm_wear_info_t;
+
+// 存储统计（FM_getStats）：page数为FM_process在后台分步统计的最近一次结果，其余为上电以来的累计值
+typedef struct {
+    uint16_t usedPages;              // 含有效page的扇区中已写入的日志page数
+    uint16_t freePages;              // 已擦除或所在扇区没有有效page（分配时擦除）的日志page数
+    uint16_t livePages;              // 被映射表、槽位目录、图像头或接收中图像引用的page数（共用的帧按引用次数计，每扇区最多15）
+    uint16_t stalePages;             // 已写入但不再被引用的page数，所在扇区回收后才能重新写入
+    uint16_t freeSectors;            // 不含有效page的扇区数
+    uint16_t totalSectors;           // 按启动时识别的Flash容量管理的扇区数
+    uint32_t gcRuns;                 // 完成的回收次数
+    uint32_t gcPagesCopied;          // 回收时复制和重写的page数
+    uint32_t gcTotalMs;              // 回收累计耗时（从选定回收扇区到放回空闲列表，含后台步骤之间的间隔）
+    uint32_t gcMaxMs;                // 单次回收的最长耗时
+    uint32_t bytesRequested;         // FM_writeData请求写入的字节数
+    uint32_t bytesWritten;           // 实际编程的字节数（含page头、扇区头、槽位目录和回收复制），与bytesRequested之比为写放大
+    uint32_t crcErrors;              // 读取和后台巡检时发现的CRC错误次数
+    uint32_t scrubPasses;            // 完成的后台巡检轮数
+    uint8_t  badSectors;             // 坏扇区列表中已标记的坏扇区数（最多FLASH_BAD_SECTOR_LIST_SIZE）
+    uint32_t erases;                 // 扇区擦除次数
+    uint32_t eraseTotalMs;           // 擦除累计耗时（从发出擦除命令到确认完成，含被读取暂停的时间）
+    uint32_t eraseMaxMs;             // 单次擦除的最长耗时
+    uint32_t powerDowns;             // 空闲后进入掉电模式的次数（每次之后的第一次访问唤醒Flash，约3us）
+    uint32_t pageStatsAgeMs;         // page数统计完成到现在的时间，0xffffffff：还没有统计完（page数都为0）
+} fm_stats_t;
+
+// 读取图像帧（FM_readImage、FM_readImagePlane）时的CRC校验策略（FM_setVerifyPolicy）
+typedef enum {
+    FM_VERIFY_ALWAYS = 0,            // 每次读取都校验
+    FM_VERIFY_ONCE,                  // 图像写入后第一次按顺序读出全部帧时校验，之后不再校验，直到图像被重写
+    FM_VERIFY_NONE                   // 不校验，依靠后台巡检（FM_process）
+} fm_verify_policy_t;
+
+// FM_readImagePlane每读出一帧调用一次：data为该帧PAYLOAD_SIZE字节数据，只在回调期间有效；
+// result不为FLASH_OK时data为NULL。回调中不能调用Flash管理器的接口
+typedef void (*fm_frame_callback_t)(uint8_t frameNum, const uint8_t* data, flash_result_t result);
+
 // Flash管理器上下文
 typedef struct {
-    uint8_t activeSegmentBaseStatus;   // 0x00为初始化状态或作为状态；0xAC 表示active_segment_base 为为0x000000，backup_segment_base 为0x200000；0xBD表示相反
-    uint8_t  gcInProgress;           // 垃圾回收进行标志
-    uint16_t nextWriteAddress;       // 下次写入地址
+    uint8_t  gcInProgress;           // 正在执行GC步骤（GC自身分配扇区时不能再触发GC）
+    uint16_t nextWriteAddress;       // 下次写入地址（0xffff：尚未打开日志扇区）
     // uint16_t data_count;               // 当前数据条目数
-    uint32_t currentGcCounter;
     uint16_t dataEntries[MAX_DATA_ENTRIES]; // 数据映射表
-    uint16_t imageBwEntries[MAX_IMAGE_ENTRIES]; // 数据映射表
-    uint16_t imageRedEntries[MAX_IMAGE_ENTRIES]; // 数据映射表
-    uint8_t imageSlotColor[MAX_IMAGE_ENTRIES]; // 每个槽的颜色标志：0 = BW, 1 = RED, 0xFF = 未知
-    segment_header_t header0;
-    segment_header_t header1;
-    uint16_t* entries[3u]; // 0 - dataEntries, 1 - imageBwEntries, 2 - imageRedEntries
-    uint8_t entriesCountMax[3u]; // 0 - MAX_DATA_ENTRIES, 1 - MAX_IMAGE_ENTRIES, 2 - MAX_IMAGE_ENTRIES
+    uint16_t dataRecordPage;         // 正在追加数据记录的page，只在当前写入扇区中（0xffff：无）
+    uint8_t  dataRecordUsed;         // dataRecordPage中已写入的记录字节数
+    uint16_t slotDirPages[FLASH_SLOT_DIR_PAGES]; // 槽位目录page（0xffff：该组槽位都没有图像）
+    fm_slot_entry_t slotCache[FLASH_SLOT_CACHE_SIZE]; // 最近使用的槽位
+    uint8_t  slotCacheNext;          // 下一个被替换的缓存项
+    uint8_t  slotCachePinned;        // 迁移旧格式中：slotCache[n]就是槽位n的映射，目录page还没有写入
+    uint16_t openSector;             // 当前写入的日志扇区（0xffff：无）
+    uint32_t sectorSeq;              // 最新扇区头的分配序号
+    uint16_t freeSectors[FLASH_FREE_LIST_SIZE]; // 空闲扇区列表（不含有效page，分配时从首部取）
+    uint8_t  freeCount;              // 空闲扇区列表长度
+    uint8_t  spareErased;            // 列表首个扇区已在后台擦除
+    uint32_t spareEraseCount;        // 后台擦除的扇区的擦除次数（擦除后扇区头已不在）
+    uint32_t wearMax;                // 已知的最大擦除次数
+    uint16_t coldSector;             // 擦除次数最少且仍在使用的扇区（0xffff：未知）
+    uint32_t coldEraseCount;         // coldSector的擦除次数
+    uint8_t  wearScanNeeded;         // 最冷扇区已被回收，需要重新查找
+    uint8_t  scanNeeded;             // 分配过扇区或回收过扇区，空闲扇区列表需要重新统计
+    uint16_t sectorCount;            // 管理的扇区数：启动时按识别的Flash容量设置，最多FLASH_MAX_SECTOR_COUNT
+    uint16_t allocCursor;            // 下一次从这个扇区开始查找空闲扇区，依次轮换以分散擦写
+    uint16_t allocFirstSector;       // 可分配扇区范围[allocFirstSector, allocEndSector)，迁移旧布局时只用备用segment
+    uint16_t allocEndSector;
+    uint8_t  eraseBusy;              // 已发出扇区擦除命令，等待Flash空闲
+    uint16_t eraseSector;            // 正在擦除的扇区
+    uint32_t eraseStartMs;           // 发出擦除命令的时间
+    uint32_t erases;                 // 以下为上电以来的擦除统计，见fm_stats_t
+    uint32_t eraseTotalMs;
+    uint32_t eraseMaxMs;
+    uint32_t lastAccessCount;        // 上次FM_process时驱动的片选次数
+    uint32_t lastAccessMs;           // 最近一次发现Flash被访问的时间
+    uint32_t powerDowns;
+    fm_image_stream_t streams[FLASH_IMAGE_STREAM_COUNT]; // 已写入图像数据页但图像头尚未写入的图像
+    uint16_t streamSectors[FLASH_STREAM_SECTOR_COUNT]; // 接收记录中的帧所在的扇区，0xffff：空
+    fm_dedup_entry_t dedup[FLASH_DEDUP_CACHE_SIZE]; // 可直接引用的图像帧
+    uint8_t  dedupNext;              // 下一个被替换的dedup记录
+    uint8_t  gcState;                // 后台GC状态，见fm_gc_state_t
+    uint16_t gcCursor;               // SCAN：窗口起始扇区；RELOCATE：扇区内page序号；FIXUP：图像头序号（槽位 * 2 + 颜色）
+    uint16_t gcVictim;               // 正在回收的扇区
+    uint16_t gcLiveMask;             // 回收扇区中需要复制的page（bit n对应扇区内page n）
+    uint16_t gcSkipSector;           // 上一次回收失败的扇区，暂不再选它
+    uint16_t gcMap[FLASH_PAGES_PER_SECTOR]; // 回收扇区page n复制后的新地址
+    uint8_t  gcFixupImages[(MAX_IMAGE_ENTRIES * 2 + 7) / 8]; // FIXUP要重写的图像头（bit n对应槽位 * 2 + 颜色）
+    fm_sector_scan_t scan;           // 后台SCAN的累计结果
+    uint32_t gcStartMs;              // 本次回收开始的时间
+    uint32_t gcRuns;                 // 以下为上电以来的统计，见fm_stats_t
+    uint32_t gcPagesCopied;
+    uint32_t gcTotalMs;
+    uint32_t gcMaxMs;
+    uint32_t bytesRequested;
+    uint32_t bytesWritten;
+    uint32_t crcErrors;
+    uint8_t  verifyPolicy;           // 读取图像帧时的CRC校验策略，见fm_verify_policy_t
+    uint8_t  verifiedImages[(MAX_IMAGE_ENTRIES * 2u + 7u) / 8u]; // 已完整校验过的图像（bit n：槽位 * 2 + 颜色），槽位目录更新时清除
+    uint16_t scrubCursor;            // 后台巡检位置：图像头序号 * (MAX_FRAME_NUM + 2) + 位置（0：图像头，n：第n - 1帧）
+    uint16_t scrubHeaderPage;        // 正在巡检的图像的图像头，巡检期间图像被重写时跳过该图像
+    uint8_t  scrubImageOk;           // 正在巡检的图像到目前为止都校验通过
+    uint8_t  scrubWaiting;           // 一轮巡检已结束，等待FLASH_SCRUB_INTERVAL_MS
+    uint32_t scrubPassEndMs;         // 上一轮巡检结束的时间
+    uint32_t scrubPasses;
+    uint16_t badSectors[FLASH_BAD_SECTOR_LIST_SIZE]; // 巡检出错的扇区；出错FLASH_BAD_SECTOR_FAULTS次的是坏扇区，不再分配，上电后由扇区头中的标记识别
+    uint8_t  badFaults[FLASH_BAD_SECTOR_LIST_SIZE];  // badSectors[n]的出错次数
+    uint8_t  badCount;
+    uint8_t  badPending;             // bit n：badSectors[n]中的有效page还没有搬走
+    uint8_t  badOverflow;            // 有已搬空的坏扇区被挤出列表，统计空闲扇区时要读取扇区头中的标记
+    uint16_t badCheckedSector;       // 上次检查坏扇区能否回收时的日志扇区，日志扇区变化前不再检查
+    uint16_t statsCursor;            // 后台统计page数：小于sectorCount时为下一个读取的扇区，之后减去sectorCount为下一个窗口；0xffff：没有进行中的统计
+    fm_page_count_t statsCount;      // 进行中的统计的累计结果
+    fm_page_count_t statsDone;       // 最近一次完成的统计
+    uint32_t statsDoneMs;            // statsDone完成的时间
+    uint8_t  statsHave;              // statsDone有效
 } flash_manager_t;
 
 // 函数声明
@@ -114,21 +266,47 @@ flash_result_t FM_deleteData(uint16_t dataId);
 // flash_result_t flash_garbage_collect(flash_manager_t* manager);
 
 /**
- * @brief 获取Flash状态信息
- * @param manager Flash管理器指针
- * @param used_pages 输出：已使用的page数量
- * @param free_pages 输出：剩余的page数量
- * @param data_count 输出：数据条目数量
+ * @brief 获取存储统计，不访问Flash：page数为后台最近一次统计完成的结果，没有进行中的统计时开始新一轮
+ *        （由FM_process分步完成），写入、回收等计数为当前值
+ * @param stats 输出：存储统计
  * @return flash_result_t 操作结果
  */
-// flash_result_t flash_get_status(flash_manager_t* manager, uint32_t* used_pages, uint32_t* free_pages, uint32_t* data_count);
+flash_result_t FM_getStats(fm_stats_t* stats);
 
 /**
- * @brief 强制执行垃圾回收（用于测试）
+ * @brief 强制执行垃圾回收（用于测试）：阻塞回收一个有效page最少的扇区
  * @return flash_result_t 操作结果
  */
 flash_result_t FM_forceGarbageCollect(void);
 
+/**
+ * @brief 在主循环中调用，推进后台GC和空闲扇区预擦除；单次调用耗时不超过FLASH_GC_STEP_BUDGET_MS（外加一步GC）
+ */
+void FM_process(void);
+
+/**
+ * @brief 读取全部扇区头，统计擦除次数分布，用于估算Flash寿命（阻塞，约读取18KB）
+ * @param info 输出：擦除次数分布
+ * @return flash_result_t 操作结果
+ */
+flash_result_t FM_getWearInfo(fm_wear_info_t* info);
+
+/**
+ * @brief 后台是否在回收或巡检（需要较高的时钟频率）
+ * @return boolean_t TRUE：正在回收或巡检
+ */
+boolean_t FM_isBusy(void);
+
+/**
+ * @brief 1ms时基，在1ms定时中断中调用
+ */
+void FM_tick1ms(void);
+
+/**
+ * @brief 读取1ms时基（上电以来的毫秒数）
+ */
+uint32_t FM_getTickMs(void);
+
 /**
  * @brief 写入图像头页
  * @param magic 魔法数字（区分数据页类型）
@@ -154,4 +332,23 @@ uint8_t FM_getImageSlotColor(uint8_t slotId);
  */
 flash_result_t FM_readImage(uint8_t magic, uint8_t slotId, uint8_t frameNum, uint8_t* data);
 
+/**
+ * @brief 按帧号顺序读出一个图像的全部帧（0..MAX_FRAME_NUM），每帧调用一次callback，
+ *        比逐帧调用FM_readImage少发读命令、不复制数据，用于显示时整屏读取
+ * @param magic 图像数据页魔法数字（MAGIC_BW_IMAGE_DATA或MAGIC_RED_IMAGE_DATA）
+ * @param slotId 槽位编号
+ * @param buffer 压缩帧解压用的缓冲区（PAYLOAD_SIZE字节），由调用者提供
+ * @param callback 帧回调
+ * @return flash_result_t 全部帧读取成功时为FLASH_OK，否则为最后一个失败帧的结果
+ */
+flash_result_t FM_readImagePlane(uint8_t magic, uint8_t slotId, uint8_t* buffer, fm_frame_callback_t callback);
+
+/**
+ * @brief 设置读取图像帧时的CRC校验策略，上电默认为FM_VERIFY_ONCE
+ *        数据条目和图像头每次读取都校验，不受影响
+ * @param policy 校验策略
+ * @return flash_result_t 操作结果
+ */
+flash_result_t FM_setVerifyPolicy(fm_verify_policy_t policy);
+
 #endif // FLASH_MANAGER_H
@@ -44,6 +44,7 @@
 #include "w25q32.h"
 #include "flash_manager.h"
 #include "image_transfer_v2.h"
+#include "clk_governor.h"
 // #include "testCase.h"
 #include <stdlib.h>
 
@@ -72,6 +73,7 @@ static volatile boolean_t tg1 = FALSE;
 static volatile boolean_t tg5ms = FALSE;  // 5ms task flag for image transfer
 static volatile boolean_t wakeup = FALSE;
 static volatile boolean_t tg8s = FALSE;
+static volatile boolean_t linkUp = FALSE;  // 蓝牙已连接，主循环据此保持高频
 // static volatile boolean_t tg2s = FALSE;
 //static float temperature = 0.0, humidity = 0.0;
 //static boolean_t linkFlag = FALSE;
@@ -92,13 +94,16 @@ void Bt0Int(void)
 
     // Call passThrough and image transfer processing every 1ms
     // UARTIF_passThrough();
-    (void)E104_getLinkState();
+    linkUp = E104_getLinkState();
+
+    FM_tick1ms();
+    CLKGOV_tick1ms();
 
     // High frequency image transfer processing (every 1ms)
     tg5ms = TRUE;  // Note: now 1ms, not 5ms, but keep variable name for compatibility
 
     // Maintain original timer counter logic for generating other time flags
-    if (timer0 < 7999)  // 1s (originally 200->5ms, now 8000->1ms)
+    if (timer0 < 7999)  // wraps every 8s at the 1ms tick (counts 0..7999)
     {
         timer0++;
     }
@@ -174,6 +179,22 @@ void LptInt(void)
 //   return result;
 //}
 
+/**
+ * @brief TIM0产生1ms中断的重载值：Base Timer向上计数到0xFFFF溢出后从重载值开始，1ms需要PCLK / 8 / 1000个计数
+ */
+static uint16_t timReload1ms(void)
+{
+    return (uint16_t)(0x10000u - Clk_GetPClkFreq() / 8u / 1000u);
+}
+
+/**
+ * @brief 时钟调节切换频率后按新的PCLK重设TIM0重载值，下一次溢出时生效
+ */
+static void timRetune(void)
+{
+    Bt_ARRSet(TIM0, timReload1ms());
+}
+
 static void timInit(void)
 {
     stc_bt_config_t   stcConfig;
@@ -197,12 +218,13 @@ static void timInit(void)
     EnableNvic(TIM0_IRQn, 0, TRUE);
 
     // Set reload value for interrupt period of 1ms (changed to high frequency data reception)
-    // Assume PCLK=8MHz, prescale=/8, actual clock=1MHz
-    // 1ms needs 1000 counts: 1000-1 = 999 = 0x3E7
+    // The counter counts up from the reload value and overflows at 0xFFFF,
+    // so 1ms needs PCLK/8/1000 counts below 0x10000 (0xF448 at 24MHz).
+    // PCLK changes with the clock governor, which calls timRetune on every switch.
     // Original config 0xC537(50487) produces ~50ms interrupt, insufficient receive buffer
     // To handle streaming data faster, changed to 1ms interrupt
-    Bt_ARRSet(TIM0, 0x03E7);   // 1ms interrupt for faster data reception
-    Bt_Cnt16Set(TIM0, 0x03E7);
+    Bt_ARRSet(TIM0, timReload1ms());   // 1ms interrupt for faster data reception
+    Bt_Cnt16Set(TIM0, timReload1ms());
     Bt_Run(TIM0);
 
 }
@@ -371,6 +393,7 @@ int32_t main(void)
     uint32_t chipId = 0;
 //   uint8_t sts = 0;
 //flash_result_t result = FLASH_OK;
+    CLKGOV_init(timRetune);
     UARTIF_uartInit();
     // i2cInit();
     UARTIF_lpuartInit();
@@ -388,6 +411,7 @@ int32_t main(void)
     chipId = W25Q32_ReadID();
     delay1ms(100);
     UARTIF_uartPrintf(0, "Chip id is 0x%x ! \n", chipId);
+    W25Q32_DetectSize();                // SPI在EPD初始化时才打开，之后才能识别容量
     delay1ms(100);
 
 
@@ -513,6 +537,14 @@ int32_t main(void)
     while(1)
     {
         UARTIF_passThrough();
+        // 蓝牙连接后上传随时开始，连接期间保持高频；后台GC：每次只推进一小步，不阻塞串口接收
+        if (linkUp || FM_isBusy())
+        {
+            CLKGOV_request();
+        }
+        FM_process();
+        // 没有上传、刷屏和后台GC/巡检时降频
+        CLKGOV_process();
         // 5ms task: image transfer processing
         // if (tg5ms)
         // {
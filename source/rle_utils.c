@@ -0,0 +1,145 @@
+#include "rle_utils.h"
+#include "crc_utils.h"
+#include <string.h>
+
+#define RLE_MAX_LITERAL     127u        // 一个控制字节最多带的原样字节数
+#define RLE_MAX_RUN         129u        // 一个控制字节最多表示的重复次数
+
+/**
+ * @brief RLE压缩
+ * @param data 原始数据
+ * @param length 原始数据长度
+ * @param output 输出缓冲区
+ * @param maxOutLen 输出缓冲区最大长度
+ * @return uint32_t 压缩后的长度，超过maxOutLen时返回0
+ */
+uint32_t rle_encode(const uint8_t* data, uint32_t length, uint8_t* output, uint32_t maxOutLen)
+{
+    uint32_t inPos = 0;
+    uint32_t outPos = 0;
+    uint32_t run;
+    uint32_t literalStart;
+    uint32_t literalLen;
+
+    while (inPos < length) {
+        run = 1;
+        while ((inPos + run < length) && (run < RLE_MAX_RUN) && (data[inPos + run] == data[inPos])) {
+            run++;
+        }
+
+        if (run >= 2) {
+            /* 重复模式 */
+            if (outPos + 2 > maxOutLen) {
+                return 0;
+            }
+            output[outPos++] = (uint8_t)(257u - run);
+            output[outPos++] = data[inPos];
+            inPos += run;
+        } else {
+            /* 字面量模式：遇到3个以上相同字节时结束，2个相同字节放在字面量里不会更长 */
+            literalStart = inPos;
+            inPos++;
+            while ((inPos < length) && (inPos - literalStart < RLE_MAX_LITERAL)) {
+                if ((inPos + 2 < length) && (data[inPos] == data[inPos + 1]) && (data[inPos] == data[inPos + 2])) {
+                    break;
+                }
+                inPos++;
+            }
+            literalLen = inPos - literalStart;
+            if (outPos + 1 + literalLen > maxOutLen) {
+                return 0;
+            }
+            output[outPos++] = (uint8_t)literalLen;
+            memcpy(&output[outPos], &data[literalStart], literalLen);
+            outPos += literalLen;
+        }
+    }
+
+    return outPos;
+}
+
+/**
+ * @brief RLE解压缩
+ * @param compressed 压缩数据
+ * @param compLen 压缩数据长度
+ * @param output 输出缓冲区
+ * @param maxOutLen 输出缓冲区最大长度
+ * @return uint32_t 解压后的长度，数据不完整或超过maxOutLen时返回0
+ */
+uint32_t rle_decode(const uint8_t* compressed, uint32_t compLen, uint8_t* output, uint32_t maxOutLen)
+{
+    uint32_t inPos = 0;
+    uint32_t outPos = 0;
+    uint8_t count;
+    uint32_t len;
+
+    while (inPos < compLen) {
+        count = compressed[inPos++];
+
+        if (count >= 128) {
+            /* 重复模式：257 - count = 实际重复次数 */
+            len = 257u - count;
+            if ((inPos >= compLen) || (outPos + len > maxOutLen)) {
+                return 0;
+            }
+            memset(&output[outPos], compressed[inPos++], len);
+        } else {
+            /* 字面量模式 */
+            len = count;
+            if ((inPos + len > compLen) || (outPos + len > maxOutLen)) {
+                return 0;
+            }
+            memcpy(&output[outPos], &compressed[inPos], len);
+            inPos += len;
+        }
+        outPos += len;
+    }
+
+    return outPos;
+}
+
+/**
+ * @brief 不解压到缓冲区，直接计算解压后数据的CRC32
+ * @param compressed 压缩数据
+ * @param compLen 压缩数据长度
+ * @param outLen 输出：解压后的长度，数据不完整时为0
+ * @return uint32_t 解压后数据的CRC32
+ */
+uint32_t rle_decoded_crc32(const uint8_t* compressed, uint32_t compLen, uint32_t* outLen)
+{
+    uint32_t inPos = 0;
+    uint32_t crc = 0;
+    uint8_t count;
+    uint32_t len;
+
+    *outLen = 0;
+    while (inPos < compLen) {
+        count = compressed[inPos++];
+
+        if (count >= 128) {
+            /* 重复模式：逐个字节计入CRC */
+            len = 257u - count;
+            if (inPos >= compLen) {
+                *outLen = 0;
+                return 0;
+            }
+            for (; len > 0; len--) {
+                crc = calculate_crc32_update(crc, &compressed[inPos], 1);
+            }
+            inPos++;
+            *outLen += 257u - count;
+        } else {
+            /* 字面量模式 */
+            len = count;
+            if (inPos + len > compLen) {
+                *outLen = 0;
+                return 0;
+            }
+            crc = calculate_crc32_update(crc, &compressed[inPos], len);
+            inPos += len;
+            *outLen += len;
+        }
+    }
+
+    return crc;
+}
@@ -0,0 +1,38 @@
+#ifndef RLE_UTILS_H
+#define RLE_UTILS_H
+
+#include <stdint.h>
+
+// RLE格式（与上位机一致）：控制字节count < 128时后跟count个原样字节，
+// count >= 128时后跟一个字节，重复257 - count次（2~129次）
+
+/**
+ * @brief RLE压缩
+ * @param data 原始数据
+ * @param length 原始数据长度
+ * @param output 输出缓冲区
+ * @param maxOutLen 输出缓冲区最大长度
+ * @return uint32_t 压缩后的长度，超过maxOutLen时返回0
+ */
+uint32_t rle_encode(const uint8_t* data, uint32_t length, uint8_t* output, uint32_t maxOutLen);
+
+/**
+ * @brief RLE解压缩
+ * @param compressed 压缩数据
+ * @param compLen 压缩数据长度
+ * @param output 输出缓冲区
+ * @param maxOutLen 输出缓冲区最大长度
+ * @return uint32_t 解压后的长度，数据不完整或超过maxOutLen时返回0
+ */
+uint32_t rle_decode(const uint8_t* compressed, uint32_t compLen, uint8_t* output, uint32_t maxOutLen);
+
+/**
+ * @brief 不解压到缓冲区，直接计算解压后数据的CRC32（默认配置）
+ * @param compressed 压缩数据
+ * @param compLen 压缩数据长度
+ * @param outLen 输出：解压后的长度，数据不完整时为0
+ * @return uint32_t 解压后数据的CRC32
+ */
+uint32_t rle_decoded_crc32(const uint8_t* compressed, uint32_t compLen, uint32_t* outLen);
+
+#endif // RLE_UTILS_H
@@ -37,11 +37,16 @@
 #include "queue.h"
 #include "drawWithFlash.h"
 #include "crc.h"
+#include "rle_utils.h"
+#include "clk_governor.h"
+#include "w25q32.h"
 
 /******************************************************************************
  * Local pre-processor symbols/macros ('#define')                            
  ******************************************************************************/
 #define DEBUGLEVEL        1
+#define UART1_BAUD_RATE   115200u
+#define LPUART_BAUD_RATE  19200u
 
 /******************************************************************************
  * Global variable definitions (declared in header file with 'extern')
@@ -63,17 +68,19 @@ static Queue uartRecdata, lpUartRecdata;
 static uint8_t cmd = 0xff;
 static uint32_t uartRxCount = 0;  // 统计UART接收字节数
 static uint32_t queueOverflowCount = 0;  // 统计队列溢出次数
+static volatile uint32_t lineActivity = 0;  // UART1和LPUART收发的字节数，时钟调节据此判断线路是否空闲
 
 char buffer[256]; // 假设最大字符串长度为 256
 size_t bufferIndex = 0;
 
 /* 支持接收多页（每页 PAGE_SIZE 字节），最多 60 页。接收到每页后写入 flash，但不立即刷新显示。
     接收方通过发送文本命令 "DISPLAY" (不含引号，结尾以 CR/LF) 来触发一次性显示已接收的所有页。
-    也可发送 "RESET_PAGES" 来重置接收页计数。 */
+    也可发送 "RESET_PAGES" 来重置接收页计数，发送 "FLASH_STATS" 查询存储统计，
+    发送 "FLASH_BENCH[:<页数>]" 对比逐字节读和连续读Flash的速度。 */
 #define MAX_PAGES_SUPPORTED 60
 static uint16_t receivedPageCount = 0;
 
-/* 当前目标图像槽位（0..7），由主机通过 "SET_SLOT:<1-8>" 指定。默认0（槽位1） */
+/* 当前目标图像槽位（0..MAX_IMAGE_ENTRIES-1），由主机通过 "SET_SLOT:<1-MAX_IMAGE_ENTRIES>" 指定。默认0（槽位1） */
 static uint8_t currentImageSlot = 0;
 
 /* 最近写入的图像是否为红色通道（true 表示 RED 数据页已被写入） */
@@ -94,6 +101,10 @@ static uint8_t decompressBuffer[PAGE_SIZE];
  * 在需要写入全白/全黑页时复用 decompressBuffer 以节省静态内存。
  */
 
+/* FLASH_BENCH 默认和最多读取的页数（从地址0开始，每页读 PAGE_SIZE 字节） */
+#define FLASH_BENCH_PAGES       64u
+#define FLASH_BENCH_MAX_PAGES   256u
+
 // 接收处理函数原型
 static void processReceivedBuffer(void);
 
@@ -124,68 +135,39 @@ static uint16_t crc16_ccitt(const uint8_t *data, uint32_t len)
 }
 
 /**
- * @brief RLE 解压缩（就地解压到固定248字节缓冲区）
- * @param compressed 压缩数据
- * @param compLen 压缩数据长度
- * @param output 输出缓冲区（必须至少248字节）
- * @param maxOutLen 输出缓冲区最大长度
- * @return 解压后的实际长度，失败返回0
+ * @brief Flash读取速度：每页分别用逐字节接收和W25Q32_ReadData连续接收读取，打印耗时和字节/秒
+ *        借用decompressBuffer，只能在两帧之间调用
+ * @param pages 每种方式读取的页数
  */
-static size_t decompressPageRLE(const uint8_t *compressed, size_t compLen,
-                                uint8_t *output, size_t maxOutLen)
+static void flashReadBenchmark(uint16_t pages)
 {
-    size_t inPos = 0;
-    size_t outPos = 0;
-		uint8_t count;
-		uint8_t value;
-		size_t runLength;
-		size_t literalLen;
-
-	
-
-    while (inPos < compLen) {
-        if (inPos >= compLen) break;
-
-        count = compressed[inPos++];
-
-        if (count >= 128) {
-            /* 重复模式：257 - count = 实际重复次数 */
-            if (inPos >= compLen) {
-                UARTIF_uartPrintf(0, "RLE ERR: missing repeat value at pos %u\r\n", (unsigned)inPos);
-                return 0;
-            }
+    uint16_t p;
+    uint32_t start;
+    uint32_t byteMs;
+    uint32_t burstMs;
+    uint32_t bytes = (uint32_t)pages * PAGE_SIZE;
 
-            value = compressed[inPos++];
-            runLength = 257 - count;
+    // 先等待进行中的编程/擦除完成并唤醒Flash，不计入时间
+    (void)W25Q32_ReadData(0, decompressBuffer, 1);
 
-            if (outPos + runLength > maxOutLen) {
-                UARTIF_uartPrintf(0, "RLE ERR: buffer overflow, need %u have %u\r\n",
-                                  (unsigned)(outPos + runLength), (unsigned)maxOutLen);
-                return 0;
-            }
-
-            memset(&output[outPos], value, runLength);
-            outPos += runLength;
-        } else {
-            /* 字面量模式 */
-            literalLen = count;
-
-            if (inPos + literalLen > compLen) {
-                UARTIF_uartPrintf(0, "RLE ERR: insufficient literal data at pos %u\r\n", (unsigned)inPos);
-                return 0;
-            }
-            if (outPos + literalLen > maxOutLen) {
-                UARTIF_uartPrintf(0, "RLE ERR: buffer overflow in literal mode\r\n");
-                return 0;
-            }
+    start = FM_getTickMs();
+    for (p = 0; p < pages; p++)
+    {
+        (void)W25Q32_ReadDataBytewise((uint32_t)p * W25Q32_PAGE_SIZE, decompressBuffer, PAGE_SIZE);
+    }
+    byteMs = FM_getTickMs() - start;
 
-            memcpy(&output[outPos], &compressed[inPos], literalLen);
-            inPos += literalLen;
-            outPos += literalLen;
-        }
+    start = FM_getTickMs();
+    for (p = 0; p < pages; p++)
+    {
+        (void)W25Q32_ReadData((uint32_t)p * W25Q32_PAGE_SIZE, decompressBuffer, PAGE_SIZE);
     }
+    burstMs = FM_getTickMs() - start;
 
-    return outPos;
+    UARTIF_uartPrintf(0, "FLASH_BENCH bytewise %lu bytes %lu ms %lu bytes/s\r\n", bytes, byteMs,
+                      (byteMs != 0u) ? (bytes * 1000u / byteMs) : 0u);
+    UARTIF_uartPrintf(0, "FLASH_BENCH burst %lu bytes %lu ms %lu bytes/s\r\n", bytes, burstMs,
+                      (burstMs != 0u) ? (bytes * 1000u / burstMs) : 0u);
 }
 
 /******************************************************************************
@@ -201,6 +183,7 @@ void UART_rxIntCallback(void)
     volatile char data = 0;
     data = Uart_ReceiveData(UARTCH1);
     uartRxCount++;
+    lineActivity++;
 
     if (Queue_Enqueue(&uartRecdata, data))
     {
@@ -224,6 +207,7 @@ void LPUART_rxIntCallback(void)
 {
     volatile char data = 0;
     data = LPUart_ReceiveData();
+    lineActivity++;
 
     if (Queue_Enqueue(&lpUartRecdata, data))
     {
@@ -251,6 +235,7 @@ void UARTIF_uartPrintf(uint8_t uartNumber, const char *format, ...)
     if (len > 0) {
         for (i = 0; i < len; i++) 
         {
+            lineActivity++;
             // 调用 Uart_SendData 发送字符
             if (uartNumber == 0)
             {
@@ -324,7 +309,7 @@ void UARTIF_uartInit(void)
     stcConfig.pstcMultiMode = &stcMulti;
 
     stcBaud.bDbaud = 1u;//双倍波特率功能
-    stcBaud.u32Baud = 115200;//更新波特率位置
+    stcBaud.u32Baud = UART1_BAUD_RATE;//更新波特率位置
     stcBaud.u8Mode = UartMode1; //计算波特率需要模式参数
     pclk = Clk_GetPClkFreq();
     timer=Uart_SetBaudRate(UARTCH1,pclk,&stcBaud);
@@ -397,7 +382,7 @@ void UARTIF_lpuartInit(void)
 
    u32sclk = Clk_GetPClkFreq();
 
-   stcBaud.u32Baud = 19200;
+   stcBaud.u32Baud = LPUART_BAUD_RATE;
    stcBaud.bDbaud = 1;
    stcBaud.u8LpMode = LPUartNoLPMode;
    stcBaud.u8Mode = LPUartMode3;
@@ -415,6 +400,42 @@ void UARTIF_lpuartInit(void)
    LPUart_ClrStatus(LPUartRxFull);
 }
 
+/**
+ * @brief 时钟频率切换后按新的PCLK重新设置UART1/LPUART的波特率定时器
+ */
+void UARTIF_updateBaudRate(void)
+{
+    uint16_t timer;
+    stc_uart_baud_config_t stcBaud;
+    stc_lpuart_baud_config_t stcLpBaud;
+
+    DDL_ZERO_STRUCT(stcBaud);
+    DDL_ZERO_STRUCT(stcLpBaud);
+
+    stcBaud.bDbaud = 1u;
+    stcBaud.u32Baud = UART1_BAUD_RATE;
+    stcBaud.u8Mode = UartMode1;
+    timer = Uart_SetBaudRate(UARTCH1, Clk_GetPClkFreq(), &stcBaud);
+    Bt_ARRSet(TIM1, timer);
+    Bt_Cnt16Set(TIM1, timer);
+
+    stcLpBaud.u32Baud = LPUART_BAUD_RATE;
+    stcLpBaud.bDbaud = 1;
+    stcLpBaud.u8LpMode = LPUartNoLPMode;
+    stcLpBaud.u8Mode = LPUartMode3;
+    timer = LPUart_SetBaudRate(Clk_GetPClkFreq(), LPUartDiv1, &stcLpBaud);
+    Bt_ARRSet(TIM2, timer);
+    Bt_Cnt16Set(TIM2, timer);
+}
+
+/**
+ * @brief 收发字节计数；发送都是查询方式，发送函数返回时最后一个字节已经发完（TC）
+ */
+uint32_t UARTIF_lineActivity(void)
+{
+    return lineActivity;
+}
+
 void UARTIF_passThrough(void)
 {
 	   uint8_t data = 0;
@@ -446,6 +467,8 @@ void UARTIF_passThrough(void)
 
     if (!Queue_IsEmpty(&lpUartRecdata))
     {
+        // 上传的帧需要CRC校验、解压并写入flash；收帧期间不切换，等线路空闲后由CLKGOV_process切换
+        CLKGOV_request();
         while (Queue_Dequeue(&lpUartRecdata, &data)) 
         {
             /* 先回显到 UART1 */
@@ -537,8 +560,8 @@ void UARTIF_passThrough(void)
                         if (isCompressed)
                         {
                             /* 解压到静态缓冲区 */
-                            finalLen = decompressPageRLE((uint8_t *)&buffer[5], payloadLen,
-                                                         decompressBuffer, PAGE_SIZE);
+                            finalLen = rle_decode((uint8_t *)&buffer[5], payloadLen,
+                                                  decompressBuffer, PAGE_SIZE);
 
                             if (finalLen == 0) {
                                 UARTIF_uartPrintf(0, "RLE decompress FAILED\r\n");
@@ -694,7 +717,7 @@ void UARTIF_passThrough(void)
                             else if (strncmp(tmp, "SET_SLOT:", 9) == 0)
                             {
                                 int v = atoi(&tmp[9]);
-                                if (v >= 1 && v <= 8)
+                                if (v >= 1 && v <= MAX_IMAGE_ENTRIES)
                                 {
                                     currentImageSlot = (uint8_t)(v - 1);
                                     UARTIF_uartPrintf(0, "SET_SLOT -> %d (slotIndex=%u)\r\n", v, currentImageSlot);
@@ -711,6 +734,48 @@ void UARTIF_passThrough(void)
                                 UARTIF_uartPrintf(0, "RESET_PAGES\r\n");
                                 receivedPageCount = 0;
                             }
+                            else if (strcmp(tmp, "FLASH_STATS") == 0)
+                            {
+                                fm_stats_t stats;
+                                if (FM_getStats(&stats) == FLASH_OK)
+                                {
+                                    /* page数由后台分步统计，这里只打印上一次的结果，第一次查询时还没有 */
+                                    if (stats.pageStatsAgeMs == 0xffffffffu)
+                                    {
+                                        UARTIF_uartPrintf(0, "FLASH_STATS pages counting, query again later sectors=%u\r\n",
+                                                          stats.totalSectors);
+                                    }
+                                    else
+                                    {
+                                        UARTIF_uartPrintf(0, "FLASH_STATS pages used=%u free=%u live=%u stale=%u freeSectors=%u sectors=%u age=%lums\r\n",
+                                                          stats.usedPages, stats.freePages, stats.livePages, stats.stalePages, stats.freeSectors,
+                                                          stats.totalSectors, stats.pageStatsAgeMs);
+                                    }
+                                    UARTIF_uartPrintf(0, "FLASH_STATS gc runs=%lu copied=%lu totalMs=%lu maxMs=%lu bytes requested=%lu written=%lu\r\n",
+                                                      stats.gcRuns, stats.gcPagesCopied, stats.gcTotalMs, stats.gcMaxMs,
+                                                      stats.bytesRequested, stats.bytesWritten);
+                                    UARTIF_uartPrintf(0, "FLASH_STATS crcErrors=%lu scrubPasses=%lu badSectors=%u\r\n",
+                                                      stats.crcErrors, stats.scrubPasses, stats.badSectors);
+                                    UARTIF_uartPrintf(0, "FLASH_STATS erases=%lu totalMs=%lu maxMs=%lu powerDowns=%lu\r\n",
+                                                      stats.erases, stats.eraseTotalMs, stats.eraseMaxMs, stats.powerDowns);
+                                }
+                                else
+                                {
+                                    UARTIF_uartPrintf(0, "FLASH_STATS fail\r\n");
+                                }
+                            }
+                            else if ((strcmp(tmp, "FLASH_BENCH") == 0) || (strncmp(tmp, "FLASH_BENCH:", 12) == 0))
+                            {
+                                int v = (tmp[11] == ':') ? atoi(&tmp[12]) : (int)FLASH_BENCH_PAGES;
+                                if (v >= 1 && v <= (int)FLASH_BENCH_MAX_PAGES)
+                                {
+                                    flashReadBenchmark((uint16_t)v);
+                                }
+                                else
+                                {
+                                    UARTIF_uartPrintf(0, "FLASH_BENCH invalid: %s\r\n", tmp);
+                                }
+                            }
                         }
 
                         /* 移除已处理的完整帧并继续解析后续帧 */
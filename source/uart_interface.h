@@ -8,6 +8,8 @@ void UARTIF_uartPrintf(uint8_t uartNumber, const char *format, ...);
 void UARTIF_uartPrintfFloat(uint8_t uartNumber, const char *head, const float data);
 void UARTIF_uartInit(void);
 void UARTIF_lpuartInit(void);
+void UARTIF_updateBaudRate(void);
+uint32_t UARTIF_lineActivity(void);
 void UARTIF_passThrough(void);
 uint8_t UARTIF_passThroughCmd(void);
 uint16_t UARTIF_fetchDataFromUart(uint8_t *buf, uint16_t *idx);
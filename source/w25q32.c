@@ -29,7 +29,7 @@
 /******************************************************************************
  * Local pre-processor symbols/macros ('#define')                            
  ******************************************************************************/
-#define FLASH_TOTAL_SIZE        0x400000    // 4MB总容量
+#define NO_ERASE                0xFFFFFFFFu // 没有进行中的后台扇区擦除
 
 /******************************************************************************
  * Global variable definitions (declared in header file with 'extern')
@@ -42,10 +42,22 @@
 /******************************************************************************
  * Local function prototypes ('static')
  ******************************************************************************/
+static void W25Q32_WaitIfPending(void);
 
 /******************************************************************************
  * Local variable definitions ('static')                                      *
  ******************************************************************************/
+/* 已发出编程/擦除命令但还没确认完成，下一次操作前先等待 */
+static uint8_t busyPending = 0;
+/* 进行中的后台擦除的地址范围，以及它是否已被暂停 */
+static uint32_t eraseAddr = NO_ERASE;
+static uint32_t eraseSize = 0;
+static uint8_t eraseSuspended = 0;
+/* 已进入掉电模式，下一次片选时先唤醒；片选次数用于判断Flash是否空闲 */
+static uint8_t poweredDown = 0;
+static uint32_t accessCount = 0;
+/* 初始化时从SFDP或JEDEC ID识别的容量 */
+static uint32_t totalSize = W25Q32_TOTAL_SIZE;
 
 /******************************************************************************
  * Local pre-processor symbols/macros ('#define')                             
@@ -54,17 +66,155 @@
 /*****************************************************************************
  * Function implementation - global ('extern') and local ('static')
  ******************************************************************************/
-/* 片选控制函数 */
+/* 发出唤醒命令并等待tRES1（3us）；掉电模式下芯片只响应这一条命令 */
+static void W25Q32_ReleasePowerDown(void)
+{
+    Gpio_SetIO(1, 4, 0);
+    Spi_SendData(W25Q32_CMD_RELEASE_POWER_DOWN);
+    Gpio_SetIO(1, 4, 1);
+    delay100us(1);
+    poweredDown = 0;
+}
+
+/* 片选控制函数；掉电模式下开始新命令前先唤醒 */
 void W25Q32_CS(uint8_t state) 
 {
+    if (state == 0)
+    {
+        if (poweredDown)
+        {
+            W25Q32_ReleasePowerDown();
+        }
+        accessCount++;
+    }
     Gpio_SetIO(1, 4, state); //DC输出高
 }
 
-/* 初始化SPI接口 */
+/* 读取SFDP表：命令 + 3字节地址 + 1个dummy字节 */
+static void W25Q32_ReadSfdp(uint32_t addr, uint8_t *buf, uint8_t len)
+{
+    W25Q32_CS(0);
+    Spi_SendData(W25Q32_CMD_READ_SFDP);
+    Spi_SendData((uint8_t)((addr >> 16) & 0xFF));
+    Spi_SendData((uint8_t)((addr >> 8) & 0xFF));
+    Spi_SendData((uint8_t)(addr & 0xFF));
+    Spi_SendData(0xFF);
+    while (len-- > 0)
+    {
+        *buf++ = Spi_ReceiveData();
+    }
+    W25Q32_CS(1);
+}
+
+/* 从SFDP基本参数表的第2个dword读取容量（字节），没有SFDP或内容无法识别时返回0 */
+static uint32_t W25Q32_SfdpSize(void)
+{
+    uint8_t buf[16];
+    uint32_t ptr;
+    uint32_t density;
+
+    W25Q32_ReadSfdp(0, buf, 16);
+    // "SFDP"签名；第一个参数头必须是JEDEC基本参数表（ID 0xFF00），长度至少2个dword
+    if ((buf[0] != 'S') || (buf[1] != 'F') || (buf[2] != 'D') || (buf[3] != 'P') ||
+        (buf[8] != 0x00) || (buf[15] != 0xFF) || (buf[11] < 2))
+    {
+        return 0;
+    }
+    ptr = ((uint32_t)buf[14] << 16) | ((uint32_t)buf[13] << 8) | buf[12];
+    W25Q32_ReadSfdp(ptr + 4, buf, 4);
+    density = ((uint32_t)buf[3] << 24) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[1] << 8) | buf[0];
+    if (density & 0x80000000u)
+    {
+        // 最高位为1时低31位N表示容量为2^N bit
+        density &= 0x7FFFFFFFu;
+        if (density > 27)
+        {
+            return W25Q32_MAX_SIZE;
+        }
+        return (density >= 23) ? (1ul << (density - 3)) : 0;
+    }
+    return (density == 0xFFFFFFFFu) ? 0 : (density / 8u + 1u);
+}
+
+/* 识别容量：优先使用SFDP，没有时用JEDEC ID的容量字节（2^N字节）；超过16MB的芯片只用前16MB
+ * 需要SPI已初始化（与EPD共用，在EPD_initGDEY042Z98之后调用） */
+uint32_t W25Q32_DetectSize(void)
+{
+    uint32_t size = W25Q32_SfdpSize();
+    const char *source = "SFDP";
+    uint8_t capacity;
+
+    if (size == 0)
+    {
+        source = "JEDEC";
+        capacity = (uint8_t)(W25Q32_ReadID() >> 16);
+        if ((capacity >= 20) && (capacity <= 24))
+        {
+            size = 1ul << capacity;
+        }
+        else if ((capacity > 24) && (capacity < 32))
+        {
+            size = W25Q32_MAX_SIZE;
+        }
+        else
+        {
+            // 0x00/0xFF：没有读到ID
+            size = W25Q32_TOTAL_SIZE;
+            source = "default";
+        }
+    }
+    if (size > W25Q32_MAX_SIZE)
+    {
+        size = W25Q32_MAX_SIZE;
+    }
+    if (size < W25Q32_MIN_SIZE)
+    {
+        size = W25Q32_TOTAL_SIZE;
+        source = "default";
+    }
+    totalSize = size;
+    UARTIF_uartPrintf(0, "W25Q32 size %lu KB (%s)\n", (unsigned long)(size >> 10), source);
+    return size;
+}
+
+/* 初始化片选引脚；MCU复位时Flash可能还在掉电模式，这时SPI还没打开，
+ * 只标记为掉电，SPI打开后的第一条命令先发唤醒并等待tRES1 */
 void W25Q32_Init(void) 
 {
     Gpio_InitIO(1, 4, GpioDirOut);
     Gpio_SetIO(1, 4, 1);               //RST输出高
+    poweredDown = 1;
+}
+
+/* W25Q32_DetectSize识别的容量 (字节)，识别前为默认的4MB */
+uint32_t W25Q32_TotalSize(void)
+{
+    return totalSize;
+}
+
+/* 进入掉电模式，等待进行中的编程/擦除完成后发出；之后的任何命令都会自动唤醒 */
+void W25Q32_PowerDown(void)
+{
+    if (poweredDown)
+    {
+        return;
+    }
+    W25Q32_WaitIfPending();
+    W25Q32_CS(0);
+    Spi_SendData(W25Q32_CMD_POWER_DOWN);
+    W25Q32_CS(1);
+    poweredDown = 1;
+}
+
+uint8_t W25Q32_IsPoweredDown(void)
+{
+    return poweredDown;
+}
+
+/* 片选次数，两次查询之间没有变化说明期间没有访问Flash */
+uint32_t W25Q32_AccessCount(void)
+{
+    return accessCount;
 }
 
 /* 读取状态寄存器1 (BUSY位在bit0) */
@@ -106,12 +256,25 @@ uint8_t W25Q32_ReadStatusReg3(void)
     return status;
 }
 
-/* 等待Flash就绪 (检查BUSY位) */
+/* 等待Flash就绪 (检查BUSY位)，暂停中的擦除先恢复 */
 void W25Q32_WaitForReady(void) 
 {
+    W25Q32_ResumeErase();
     while (W25Q32_ReadStatusReg() & 0x01) {  // BIT0=1表示忙
         delay100us(1);
     }
+    busyPending = 0;
+    eraseAddr = NO_ERASE;
+}
+
+/* 上一次编程/擦除还没确认完成时先等待，忙期间芯片不响应读和写使能命令 */
+static void W25Q32_WaitIfPending(void)
+{
+    W25Q32_ResumeErase();
+    if (busyPending)
+    {
+        W25Q32_WaitForReady();
+    }
 }
 
 /* 写使能命令 (必须在前置擦除/编程操作前调用) */
@@ -135,6 +298,7 @@ uint32_t W25Q32_ReadID(void)
 {
     uint8_t idBuf[3];
     
+    W25Q32_WaitIfPending();
     W25Q32_CS(0);
     Spi_SendData(W25Q32_CMD_JEDEC_ID);
 
@@ -147,133 +311,187 @@ uint32_t W25Q32_ReadID(void)
     return (idBuf[0] << 16) | (idBuf[1] << 8) | idBuf[2];
 }
 
-/* 扇区擦除 (4KB) */
-void W25Q32_EraseSector(uint32_t sectorAddr) 
-{    
-       uint8_t sts = 0;
-
+/* 发出擦除命令，不等待完成；地址对齐到擦除大小 */
+static void W25Q32_StartErase(uint8_t cmd, uint32_t addr, uint32_t size)
+{
+    addr &= ~(size - 1);
+    W25Q32_WaitIfPending();
     W25Q32_WriteEnable();          // 使能写操作
     W25Q32_CS(0);
 
-    Spi_SendData(W25Q32_CMD_SECTOR_ERASE);
-    Spi_SendData((uint8_t)((sectorAddr >> 16) & 0xFF));
-    Spi_SendData((uint8_t)((sectorAddr >> 8) & 0xFF));
-    Spi_SendData((uint8_t)(sectorAddr & 0xFF));
-
-    UARTIF_uartPrintf(0, "Waiting for erase sector .");
+    Spi_SendData(cmd);
+    Spi_SendData((uint8_t)((addr >> 16) & 0xFF));
+    Spi_SendData((uint8_t)((addr >> 8) & 0xFF));
+    Spi_SendData((uint8_t)(addr & 0xFF));
 
     W25Q32_CS(1);
-    do 
-    {
-        sts = W25Q32_ReadStatusReg();
-        // UARTIF_uartPrintf(0, "Status Reg 1 is 0x%x ! \n", sts);
-        UARTIF_uartPrintf(0, ".");
+    busyPending = 1;
+    eraseAddr = addr;
+    eraseSize = size;
+}
 
-        delay1ms(50);
-    }
-    while(sts & 0x01);
-    UARTIF_uartPrintf(0, "\n");
-    // W25Q32_WaitForReady();         // 等待擦除完成
+/* 等待擦除完成：典型时间的一半之内不会完成，先延时再查询状态 */
+static void W25Q32_WaitForErase(uint32_t typicalMs)
+{
+    delay1ms(typicalMs / 2);
+    W25Q32_WaitForReady();
 }
 
-void W25Q32_Erase32k(uint32_t addr) 
-{    
-       uint8_t sts = 0;
+/* 扇区擦除 (4KB) */
+void W25Q32_EraseSector(uint32_t sectorAddr) 
+{
+    W25Q32_StartEraseSector(sectorAddr);
+    W25Q32_WaitForErase(W25Q32_SECTOR_ERASE_MS);
+}
 
-    W25Q32_WriteEnable();          // 使能写操作
-    W25Q32_CS(0);
+/* 扇区擦除 (4KB)，只发出命令不等待完成，用W25Q32_IsBusy查询 */
+void W25Q32_StartEraseSector(uint32_t sectorAddr) 
+{
+    W25Q32_StartErase(W25Q32_CMD_SECTOR_ERASE, sectorAddr, W25Q32_SECTOR_SIZE);
+}
 
-    Spi_SendData(W25Q32_CMD_32K_BLOCK_ERASE);
-    Spi_SendData((uint8_t)((addr >> 16) & 0xFF));
-    Spi_SendData((uint8_t)((addr >> 8) & 0xFF));
-    Spi_SendData((uint8_t)(addr & 0xFF));
-    UARTIF_uartPrintf(0, "Waiting for erase 32k .");
+/* 32KB块擦除，只发出命令不等待完成，用W25Q32_IsBusy查询 */
+void W25Q32_StartErase32k(uint32_t addr)
+{
+    W25Q32_StartErase(W25Q32_CMD_32K_BLOCK_ERASE, addr, W25Q32_BLOCK_SIZE / 2);
+}
 
-    W25Q32_CS(1);
-    do 
-    {
-        sts = W25Q32_ReadStatusReg();
-        // UARTIF_uartPrintf(0, "Status Reg 1 is 0x%x ! \n", sts);
-        UARTIF_uartPrintf(0, ".");
+/* 64KB块擦除，只发出命令不等待完成，用W25Q32_IsBusy查询 */
+void W25Q32_StartErase64k(uint32_t addr)
+{
+    W25Q32_StartErase(W25Q32_CMD_64K_BLOCK_ERASE, addr, W25Q32_BLOCK_SIZE);
+}
 
-        delay1ms(100);
-    }
-    while(sts & 0x01);
-    UARTIF_uartPrintf(0, "\n");
+/* 查询擦除/编程是否进行中，暂停中的擦除先恢复 */
+uint8_t W25Q32_IsBusy(void)
+{
+    uint8_t busy;
 
-    // W25Q32_WaitForReady();         // 等待擦除完成
+    W25Q32_ResumeErase();
+    busy = (W25Q32_ReadStatusReg() & 0x01) ? 1 : 0;
+    if (!busy)
+    {
+        busyPending = 0;
+        eraseAddr = NO_ERASE;
+    }
+    return busy;
 }
 
-void W25Q32_Erase64k(uint32_t addr) 
-{    
-       uint8_t sts = 0;
+/* 暂停W25Q32_StartEraseSector/32k/64k发出的擦除，暂停期间可以读取擦除范围以外的数据
+ * 返回1：擦除已暂停；返回0：没有进行中的擦除（已经完成） */
+uint8_t W25Q32_SuspendErase(void)
+{
+    if (eraseSuspended)
+    {
+        return 1;
+    }
+    if (!busyPending || (eraseAddr == NO_ERASE))
+    {
+        return 0;
+    }
 
-    W25Q32_WriteEnable();          // 使能写操作
     W25Q32_CS(0);
-
-    Spi_SendData(W25Q32_CMD_64K_BLOCK_ERASE);
-    Spi_SendData((uint8_t)((addr >> 16) & 0xFF));
-    Spi_SendData((uint8_t)((addr >> 8) & 0xFF));
-    Spi_SendData((uint8_t)(addr & 0xFF));
-    UARTIF_uartPrintf(0, "Waiting for erase 64k .");
-
+    Spi_SendData(W25Q32_CMD_ERASE_SUSPEND);
     W25Q32_CS(1);
-    do 
+    while (W25Q32_ReadStatusReg() & 0x01) {  // tSUS最长20us
+        delay100us(1);
+    }
+    if (W25Q32_ReadStatusReg2() & 0x80)      // SUS位
+    {
+        eraseSuspended = 1;
+        return 1;
+    }
+    // 暂停命令到达前擦除已经完成
+    busyPending = 0;
+    eraseAddr = NO_ERASE;
+    return 0;
+}
+
+/* 恢复被暂停的擦除 */
+void W25Q32_ResumeErase(void)
+{
+    if (eraseSuspended)
     {
-        sts = W25Q32_ReadStatusReg();
-        // UARTIF_uartPrintf(0, "Status Reg 1 is 0x%x ! \n", sts);
-        UARTIF_uartPrintf(0, ".");
-        delay1ms(200);
+        W25Q32_CS(0);
+        Spi_SendData(W25Q32_CMD_ERASE_RESUME);
+        W25Q32_CS(1);
+        eraseSuspended = 0;
     }
-    while(sts & 0x01);
-    UARTIF_uartPrintf(0, "\n");
+}
+
+void W25Q32_Erase32k(uint32_t addr) 
+{
+    W25Q32_StartErase32k(addr);
+    W25Q32_WaitForErase(W25Q32_32K_ERASE_MS);
+}
 
-    // W25Q32_WaitForReady();         // 等待擦除完成
+void W25Q32_Erase64k(uint32_t addr) 
+{
+    W25Q32_StartErase64k(addr);
+    W25Q32_WaitForErase(W25Q32_64K_ERASE_MS);
 }
 
 /* 整片擦除 */
 void W25Q32_EraseChip(void) 
 {
-    uint8_t sts = 0;
+    W25Q32_WaitIfPending();
     W25Q32_WriteEnable();
     W25Q32_CS(0);
     Spi_SendData(W25Q32_CMD_CHIP_ERASE);
-    UARTIF_uartPrintf(0, "Waiting for erase chip .");
-
     W25Q32_CS(1);
-    do 
-    {
-        sts = W25Q32_ReadStatusReg();
-        // UARTIF_uartPrintf(0, "Status Reg 1 is 0x%x ! \n", sts);
-        UARTIF_uartPrintf(0, ".");
-        delay1ms(200);
-    }
-    while(sts & 0x01);
-    UARTIF_uartPrintf(0, "\n");
-
-    // W25Q32_WaitForReady();         // 等待时间较长（秒级）
+    busyPending = 1;
+    W25Q32_WaitForErase(W25Q32_CHIP_ERASE_MS);  // 等待时间较长（秒级）
 }
 
-/* 读取数据 (支持跨页连续读) */
-uint8_t W25Q32_ReadData(uint32_t addr, uint8_t *buf, uint32_t len) 
+/* 发出读指令和地址，片选保持拉低；后台擦除进行中时暂停擦除，只有读擦除范围本身时才等待擦除完成 */
+static uint8_t W25Q32_BeginRead(uint32_t addr, uint8_t *buf, uint32_t len)
 {
-    uint32_t i = 0;    
-    if (buf == NULL || len == 0 || addr >= FLASH_TOTAL_SIZE)
+    if (buf == NULL || len == 0 || addr >= totalSize)
     {
         return W25Q32_ERROR;
     }
 
+    if ((eraseAddr == NO_ERASE) || ((addr + len > eraseAddr) && (addr < eraseAddr + eraseSize)) ||
+        !W25Q32_SuspendErase())
+    {
+        W25Q32_WaitIfPending();
+    }
     W25Q32_CS(0);
 
     Spi_SendData(W25Q32_CMD_READ_DATA);
     Spi_SendData((uint8_t)((addr >> 16) & 0xFF));
     Spi_SendData((uint8_t)((addr >> 8) & 0xFF));
     Spi_SendData((uint8_t)(addr & 0xFF));
+    return W25Q32_OK;
+}
 
+/* 读取数据 (支持跨页连续读) */
+uint8_t W25Q32_ReadData(uint32_t addr, uint8_t *buf, uint32_t len) 
+{
+    en_result_t result;
 
-    for (;i < len;i++)
+    if (W25Q32_BeginRead(addr, buf, len) != W25Q32_OK)
     {
-        *(buf + i) = Spi_ReceiveData();
+        return W25Q32_ERROR;
+    }
+    result = Spi_ReceiveBuf(buf, len);
+    W25Q32_CS(1);
+
+    return (result == Ok) ? W25Q32_OK : W25Q32_ERROR;
+}
+
+/* 逐字节读取（每字节调用一次Spi_ReceiveData），只作为FLASH_BENCH的速度对照 */
+uint8_t W25Q32_ReadDataBytewise(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+    uint32_t i;
+
+    if (W25Q32_BeginRead(addr, buf, len) != W25Q32_OK)
+    {
+        return W25Q32_ERROR;
+    }
+    for (i = 0; i < len; i++)
+    {
+        buf[i] = Spi_ReceiveData();
     }
     W25Q32_CS(1);
 
@@ -283,32 +501,54 @@ uint8_t W25Q32_ReadData(uint32_t addr, uint8_t *buf, uint32_t len)
 /* 写入数据 (页编程，单次最大256字节) */
 uint8_t W25Q32_WritePage(uint32_t addr, uint8_t *buf, uint16_t len) 
 {
-    uint32_t i = 0;
+    uint8_t re = W25Q32_StartWritePage(addr, buf, len);
+
+    if (re == W25Q32_OK)
+    {
+        W25Q32_WaitForReady();         // 等待写入完成
+        W25Q32_WriteDisable();
+    }
+    return re;
+}
+
+/* 页编程，只发出命令不等待完成；编程期间可以处理其他事情，下一次Flash操作前自动等待 */
+uint8_t W25Q32_StartWritePage(uint32_t addr, uint8_t *buf, uint16_t len) 
+{
+    return W25Q32_StartWritePageGather(addr, buf, len, NULL, 0);
+}
 
-    if (buf == NULL || len == 0 || addr >= FLASH_TOTAL_SIZE)
+/* 页编程：head和data两段在同一条页编程命令中依次发出，不必先拼到一个缓冲区；只发出命令不等待完成 */
+uint8_t W25Q32_StartWritePageGather(uint32_t addr, const uint8_t *head, uint16_t headLen, const uint8_t *data, uint16_t dataLen)
+{
+    if (head == NULL || headLen == 0 || (data == NULL && dataLen != 0) || addr >= totalSize)
     {
         return W25Q32_ERROR;
     }
         // 长度不能超过页边界
-    if (len > W25Q32_PAGE_SIZE)
+    if (headLen > W25Q32_PAGE_SIZE)
+    {
+     headLen = W25Q32_PAGE_SIZE;
+    }
+    if (dataLen > W25Q32_PAGE_SIZE - headLen)
     {
-     len = W25Q32_PAGE_SIZE;
+     dataLen = W25Q32_PAGE_SIZE - headLen;
     }
 
+    W25Q32_WaitIfPending();
     W25Q32_WriteEnable();          // 必须使能写操作
     W25Q32_CS(0);
     Spi_SendData(W25Q32_CMD_PAGE_PROGRAM);
     Spi_SendData((uint8_t)((addr >> 16) & 0xFF));
     Spi_SendData((uint8_t)((addr >> 8) & 0xFF));
     Spi_SendData((uint8_t)(addr & 0xFF));
-    for (;i < len;i++)
+    (void)Spi_SendBuf(head, headLen);
+    if (dataLen != 0)
     {
-        Spi_SendData(*(buf + i));
+        (void)Spi_SendBuf(data, dataLen);
     }
     W25Q32_CS(1);
-    W25Q32_WaitForReady();         // 等待写入完成
+    busyPending = 1;               // 编程完成后写使能自动清除
 
-    W25Q32_WriteDisable();
     return W25Q32_OK;
 }
 
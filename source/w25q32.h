@@ -25,14 +25,27 @@
 
 #define W25Q32_CMD_WRITE_ENABLE     0x06
 #define W25Q32_CMD_WRITE_DISABLE    0x04
+#define W25Q32_CMD_ERASE_SUSPEND    0x75
+#define W25Q32_CMD_ERASE_RESUME     0x7A
+#define W25Q32_CMD_POWER_DOWN       0xB9
+#define W25Q32_CMD_RELEASE_POWER_DOWN 0xAB
 
 #define W25Q32_CMD_JEDEC_ID         0x9F
+#define W25Q32_CMD_READ_SFDP        0x5A
 
 /* 存储参数 */
 #define W25Q32_PAGE_SIZE         256     // 页大小 (字节)
 #define W25Q32_SECTOR_SIZE       4096    // 扇区大小 (字节)
 #define W25Q32_BLOCK_SIZE        65536   // 块大小 (字节)
-#define W25Q32_TOTAL_SIZE        4194304 // 总容量 (4MB)
+#define W25Q32_TOTAL_SIZE        4194304 // 总容量 (4MB)，无法识别容量时使用
+#define W25Q32_MIN_SIZE          1048576 // 可识别的最小容量 (1MB)
+#define W25Q32_MAX_SIZE          16777216 // 3字节地址可访问的最大容量 (16MB)，更大的芯片只用前16MB
+
+/* 典型擦除时间 (ms，数据手册)，等待擦除时先等这么久的一半再查询状态 */
+#define W25Q32_SECTOR_ERASE_MS   45
+#define W25Q32_32K_ERASE_MS      120
+#define W25Q32_64K_ERASE_MS      150
+#define W25Q32_CHIP_ERASE_MS     10000
 
 /* 函数声明 */
 void W25Q32_Init(void);
@@ -43,10 +56,24 @@ uint8_t W25Q32_ReadStatusReg3(void);
 void W25Q32_WriteEnable(void);
 void W25Q32_WaitForReady(void);
 uint32_t W25Q32_ReadID(void);
+uint32_t W25Q32_DetectSize(void);
+uint32_t W25Q32_TotalSize(void);
 void W25Q32_EraseSector(uint32_t sectorAddr);
+void W25Q32_StartEraseSector(uint32_t sectorAddr);
+void W25Q32_StartErase32k(uint32_t addr);
+void W25Q32_StartErase64k(uint32_t addr);
+uint8_t W25Q32_IsBusy(void);
+uint8_t W25Q32_SuspendErase(void);
+void W25Q32_ResumeErase(void);
+void W25Q32_PowerDown(void);
+uint8_t W25Q32_IsPoweredDown(void);
+uint32_t W25Q32_AccessCount(void);
 void W25Q32_EraseChip(void);
 uint8_t W25Q32_ReadData(uint32_t addr, uint8_t *buf, uint32_t len);
+uint8_t W25Q32_ReadDataBytewise(uint32_t addr, uint8_t *buf, uint32_t len);
 uint8_t W25Q32_WritePage(uint32_t addr, uint8_t *buf, uint16_t len);
+uint8_t W25Q32_StartWritePage(uint32_t addr, uint8_t *buf, uint16_t len);
+uint8_t W25Q32_StartWritePageGather(uint32_t addr, const uint8_t *head, uint16_t headLen, const uint8_t *data, uint16_t dataLen);
 void W25Q32_Erase32k(uint32_t addr);
 void W25Q32_Erase64k(uint32_t addr);
 uint8_t W25Q32_memset(void *s, int c, size_t n);
@@ -0,0 +1,1096 @@
+/*
+ * Flash管理器主机测试：在sim_flash.c模拟的W25Q32上运行source/flash_manager.c，
+ * 每次写入后与RAM中的模型比较，每次"上电"后用FM_init重建状态再全部读回校验。
+ * 用法见README.md。
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include "flash_manager.h"
+#include "w25q32.h"
+#include "sim_flash.h"
+
+#define SIM_FLASH_BYTES     (4ul << 20)     // legacy镜像文件中保存的Flash大小
+#define SIM_LEGACY_SLOTS    8               // legacy镜像中的图像槽位数
+#define SIM_LEGACY_ENTRIES  16              // legacy镜像中的数据条目数，每条SIM_LEGACY_LEN字节
+#define SIM_LEGACY_LEN      16
+#define SIM_PUMP_CALLS      3               // 每次写入后调用FM_process的次数
+#define SIM_SAME_FRAME_SEED 3000000          // 种子 >= 该值时图像各帧内容相同
+
+#define CHECK(c, ...) do { if (!(c)) { fails++; printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+static int fails, hdrFails;
+
+// 数据条目模型；pendId是正在写入的条目，断电后新旧两个值都可以接受
+static uint8_t model[MAX_DATA_ENTRIES][248];
+static int modelHas[MAX_DATA_ENTRIES];
+static int modelLen[MAX_DATA_ENTRIES];
+static int pendId = -1;
+static uint8_t pendVal[248];
+static int pendLen;
+static int kvFixedLen;
+
+// 图像模型：每帧内容由种子决定；imgOld表示图像由旧格式固件按fillOld规则写入
+static int imgSeed[2][MAX_IMAGE_ENTRIES];
+static int imgHas[2][MAX_IMAGE_ENTRIES];
+static int imgOld[2][MAX_IMAGE_ENTRIES];
+static int fillOld;
+
+static int sweepFrom = -1, sweepTo = -1;
+
+static void pump(void)
+{
+    int k;
+
+    for (k = 0; k < SIM_PUMP_CALLS; k++)
+    {
+        FM_tick1ms();
+        FM_process();
+    }
+}
+
+// 种子 % 3 == 0：空白帧；== 1：可压缩的长游程；其余：随机内容
+static void fill(uint8_t *b, int seed, int frame, int color)
+{
+    int i;
+
+    if (seed >= SIM_SAME_FRAME_SEED)
+    {
+        frame = 0;
+    }
+    for (i = 0; i < 248; i++)
+    {
+        b[i] = (uint8_t)(seed * 31 + frame * 7 + i + color * 101);
+    }
+    if (seed % 3 == 0)
+    {
+        memset(b, color ? 0x00 : 0xFF, 248);
+    }
+    else if ((seed % 3 == 1) && !fillOld)
+    {
+        for (i = 0; i < 248; i++)
+        {
+            b[i] = (uint8_t)(seed + frame * 3 + color + i / (2 + (seed + frame) % 29));
+        }
+    }
+}
+
+static void resetModel(void)
+{
+    memset(modelHas, 0, sizeof(modelHas));
+    memset(imgHas, 0, sizeof(imgHas));
+    memset(imgOld, 0, sizeof(imgOld));
+    pendId = -1;
+}
+
+static void writeImage(int slot, int red, int seed)
+{
+    uint8_t b[248];
+    int f;
+    flash_result_t r;
+
+    for (f = 0; f <= MAX_FRAME_NUM; f++)
+    {
+        fill(b, seed, f, red);
+        r = FM_writeData(red ? MAGIC_RED_IMAGE_DATA : MAGIC_BW_IMAGE_DATA, (uint16_t)(f | (slot << 8)), b, 248);
+        pump();
+        CHECK(r == FLASH_OK, "write frame %d slot %d r=%d", f, slot, r);
+    }
+    r = FM_writeImageHeader(red ? MAGIC_RED_IMAGE_HEADER : MAGIC_BW_IMAGE_HEADER, (uint8_t)slot, (uint8_t)red);
+    if (r != FLASH_OK)
+    {
+        hdrFails++;
+        return;
+    }
+    imgSeed[red][slot] = seed;
+    imgHas[red][slot] = 1;
+    imgOld[red][slot] = 0;
+}
+
+static void writeKV(int id, int seed)
+{
+    int i;
+    int len = kvFixedLen ? kvFixedLen : ((seed % 13 == 0) ? 246 : 1 + (seed * 7) % 40);
+    flash_result_t r;
+
+    for (i = 0; i < len; i++)
+    {
+        pendVal[i] = (uint8_t)(seed + i);
+    }
+    pendId = id;
+    pendLen = len;
+    r = FM_writeData(DATA_PAGE_MAGIC, (uint16_t)id, pendVal, (uint16_t)len);
+    CHECK(r == FLASH_OK, "kv %d r=%d", id, r);
+    memcpy(model[id], pendVal, len);
+    modelLen[id] = len;
+    modelHas[id] = 1;
+    pendId = -1;
+    pump();
+}
+
+static void verify(const char *tag)
+{
+    int id, s, c, f;
+    uint8_t b[248], e[248];
+    flash_result_t r;
+
+    for (id = 0; id < MAX_DATA_ENTRIES; id++)
+    {
+        if (!modelHas[id])
+        {
+            continue;
+        }
+        r = FM_readData(DATA_PAGE_MAGIC, (uint16_t)id, b, (uint8_t)modelLen[id]);
+        if ((r == FLASH_OK) && !memcmp(b, model[id], modelLen[id]))
+        {
+            continue;
+        }
+        if (id == pendId)
+        {
+            r = FM_readData(DATA_PAGE_MAGIC, (uint16_t)id, b, (uint8_t)pendLen);
+            if ((r == FLASH_OK) && !memcmp(b, pendVal, pendLen))
+            {
+                continue;
+            }
+        }
+        CHECK(0, "%s kv %d r=%d", tag, id, r);
+    }
+
+    for (c = 0; c < 2; c++)
+    {
+        for (s = 0; s < MAX_IMAGE_ENTRIES; s++)
+        {
+            if (!imgHas[c][s])
+            {
+                continue;
+            }
+            for (f = 0; f <= MAX_FRAME_NUM; f++)
+            {
+                memset(b, 0xEE, 248);
+                r = FM_readImage(c ? MAGIC_RED_IMAGE_DATA : MAGIC_BW_IMAGE_DATA, (uint8_t)s, (uint8_t)f, b);
+                fillOld = imgOld[c][s];
+                fill(e, imgSeed[c][s], f, c);
+                fillOld = 0;
+                if ((r != FLASH_OK) || memcmp(b, e, 248))
+                {
+                    CHECK(0, "%s img c%d s%d f%d r=%d seed %d", tag, c, s, f, r, imgSeed[c][s]);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static int planeC, planeS, planeBad, planeQuiet;
+static const char *planeTag;
+static uint8_t planeBuf[256];
+
+static void planeCb(uint8_t f, const uint8_t *d, flash_result_t r)
+{
+    uint8_t e[248];
+
+    fillOld = imgOld[planeC][planeS];
+    fill(e, imgSeed[planeC][planeS], f, planeC);
+    fillOld = 0;
+    if ((r != FLASH_OK) || (d == NULL) || memcmp(d, e, 248))
+    {
+        if (!planeBad && !planeQuiet)
+        {
+            CHECK(0, "%s plane c%d s%d f%d r=%d", planeTag, planeC, planeS, f, r);
+        }
+        planeBad = 1;
+    }
+}
+
+static void readPlane(int c, int s, const char *tag)
+{
+    planeC = c;
+    planeS = s;
+    planeBad = 0;
+    planeTag = tag;
+    (void)FM_readImagePlane(c ? MAGIC_RED_IMAGE_DATA : MAGIC_BW_IMAGE_DATA, (uint8_t)s, planeBuf, planeCb);
+}
+
+static void verifyPlanes(const char *tag)
+{
+    int c, s;
+
+    for (c = 0; c < 2; c++)
+    {
+        for (s = 0; s < MAX_IMAGE_ENTRIES; s++)
+        {
+            if (imgHas[c][s])
+            {
+                readPlane(c, s, tag);
+            }
+        }
+    }
+}
+
+static void reboot(const char *tag)
+{
+    flash_result_t r;
+    unsigned long rb = simSpiBytes;
+
+    sim_powercycle();
+    r = FM_init();
+    CHECK(r == FLASH_OK, "%s init r=%d", tag, r);
+    printf("[%s] boot SPI bytes: %lu\n", tag, simSpiBytes - rb);
+    verify(tag);
+    verifyPlanes(tag);
+}
+
+static void writeRound(int round, int seed)
+{
+    int i;
+
+    for (i = 0; i < MAX_IMAGE_ENTRIES; i++)
+    {
+        writeImage(i, (round + i) & 1, round * 8 + i + 2 + seed);
+        writeKV((round + i + seed) % MAX_DATA_ENTRIES, round * 3 + i + seed);
+    }
+}
+
+/*
+ * 断电测试：每个种子从空Flash开始写入，然后在第crashAt次program/erase处断电，
+ * 重新上电后所有已确认的写入都必须能读回，之后还要能继续写入。
+ * sweep模式下种子n在第from + n次操作处断电，否则随机选择断电点。
+ */
+static int runCrash(void)
+{
+    volatile int seed;                  // longjmp返回后还要用
+    int i, round;
+    int seeds = (sweepFrom >= 0) ? (sweepTo - sweepFrom) : 300;
+
+    for (seed = 1; seed <= seeds; seed++)
+    {
+        srand(seed);
+        sim_reset();
+        resetModel();
+        sim_powercycle();
+        (void)FM_init();
+        for (i = 0; i < MAX_DATA_ENTRIES; i++)
+        {
+            writeKV(i, i);
+        }
+        // 奇数种子先写满几轮，让断电落在GC和扇区回收中
+        if (seed & 1)
+        {
+            for (round = 0; round < 13; round++)
+            {
+                writeRound(round, seed);
+            }
+        }
+
+        simOps = 0;
+        simCrashAt = (sweepFrom >= 0) ? (sweepFrom + seed) : (50 + rand() % 5000);
+        if (setjmp(simCrashJmp) == 0)
+        {
+            for (round = 0; round < 10; round++)
+            {
+                writeRound(round, seed);
+            }
+        }
+        simCrashAt = -1;
+        reboot("crash");
+        pendId = -1;
+        for (i = 0; i < MAX_IMAGE_ENTRIES; i++)
+        {
+            writeImage(i, i & 1, seed + i + 99);
+        }
+        reboot("after");
+        if (fails)
+        {
+            printf("seed %d crash point %ld\n", seed, (sweepFrom >= 0) ? (long)(sweepFrom + seed) : -1L);
+            return 1;
+        }
+    }
+    printf("crash ok\n");
+    return 0;
+}
+
+// legacy镜像文件：Flash前4MB + 数据条目模型 + 图像种子，由旧版本flash_manager.c编译的mklegacy生成
+static void saveLegacy(const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    int i;
+
+    fwrite(simFlash, 1, SIM_FLASH_BYTES, fp);
+    for (i = 0; i < SIM_LEGACY_ENTRIES; i++)
+    {
+        fwrite(model[i], 1, SIM_LEGACY_LEN, fp);
+    }
+    fwrite(modelHas, sizeof(int), SIM_LEGACY_ENTRIES, fp);
+    for (i = 0; i < 2; i++)
+    {
+        fwrite(imgSeed[i], sizeof(int), SIM_LEGACY_SLOTS, fp);
+    }
+    for (i = 0; i < 2; i++)
+    {
+        fwrite(imgHas[i], sizeof(int), SIM_LEGACY_SLOTS, fp);
+    }
+    fclose(fp);
+}
+
+static int loadLegacy(const char *path, int old)
+{
+    FILE *fp = fopen(path, "rb");
+    int i;
+
+    if (fp == NULL)
+    {
+        printf("cannot open %s\n", path);
+        return 0;
+    }
+    resetModel();
+    fread(simFlash, 1, SIM_FLASH_BYTES, fp);
+    for (i = 0; i < SIM_LEGACY_ENTRIES; i++)
+    {
+        fread(model[i], 1, SIM_LEGACY_LEN, fp);
+        modelLen[i] = SIM_LEGACY_LEN;
+    }
+    fread(modelHas, sizeof(int), SIM_LEGACY_ENTRIES, fp);
+    for (i = 0; i < 2; i++)
+    {
+        fread(imgSeed[i], sizeof(int), SIM_LEGACY_SLOTS, fp);
+    }
+    for (i = 0; i < 2; i++)
+    {
+        fread(imgHas[i], sizeof(int), SIM_LEGACY_SLOTS, fp);
+    }
+    fclose(fp);
+    for (i = 0; i < SIM_LEGACY_SLOTS; i++)
+    {
+        imgOld[0][i] = old;
+        imgOld[1][i] = old;
+    }
+    return 1;
+}
+
+static int runMkLegacy(const char *path)
+{
+    int i;
+
+    sim_reset();
+    sim_powercycle();
+    (void)FM_init();
+    kvFixedLen = SIM_LEGACY_LEN;
+    for (i = 0; i < SIM_LEGACY_ENTRIES; i++)
+    {
+        writeKV(i, i);
+    }
+    kvFixedLen = 0;
+    for (i = 0; i < SIM_LEGACY_SLOTS; i++)
+    {
+        writeImage(i, i & 1, i + 5);
+    }
+    saveLegacy(path);
+    return 0;
+}
+
+static int runLegacy(const char *path, int old)
+{
+    fm_stats_t st;
+    unsigned long e0;
+    int round;
+
+    if (!loadLegacy(path, old))
+    {
+        return 1;
+    }
+    e0 = simErases;
+    reboot("legacy");
+    // 迁移中的擦除也计入统计；旧segment头的擦除在后台完成，可能还没有计入
+    FM_getStats(&st);
+    printf("migration erases: flash %lu, counted %lu\n", simErases - e0, (unsigned long)st.erases);
+    CHECK(st.erases + 1u >= simErases - e0, "migration erases not counted");
+    for (round = 0; round < 12; round++)
+    {
+        writeRound(round, 0);
+        reboot("legacy-round");
+    }
+    printf("legacy fails=%d hdrFails=%d\n", fails, hdrFails);
+    return fails ? 1 : 0;
+}
+
+// 迁移期间断电：第k次program/erase处断电，k从1到399
+static int runMigCrash(const char *path, int old)
+{
+    int k;
+
+    simTear = 1;
+    for (k = 1; k < 400; k++)
+    {
+        if (!loadLegacy(path, old))
+        {
+            return 1;
+        }
+        sim_powercycle();
+        simOps = 0;
+        simCrashAt = k;
+        if (setjmp(simCrashJmp) == 0)
+        {
+            (void)FM_init();
+        }
+        simCrashAt = -1;
+        reboot("mig");
+        writeImage(MAX_IMAGE_ENTRIES - 1, 1, 77);
+        writeImage(3, 0, 78);
+        reboot("mig2");
+        if (fails)
+        {
+            printf("k=%d\n", k);
+            break;
+        }
+    }
+    printf("migcrash fails=%d\n", fails);
+    return fails ? 1 : 0;
+}
+
+static void printStats(const fm_stats_t *st)
+{
+    printf("used=%u free=%u live=%u stale=%u freeSec=%u gc=%lu copied=%lu ms=%lu max=%lu req=%lu wr=%lu\n",
+           st->usedPages, st->freePages, st->livePages, st->stalePages, st->freeSectors,
+           (unsigned long)st->gcRuns, (unsigned long)st->gcPagesCopied, (unsigned long)st->gcTotalMs,
+           (unsigned long)st->gcMaxMs, (unsigned long)st->bytesRequested, (unsigned long)st->bytesWritten);
+}
+
+// page数由FM_process在后台统计：请求后一直调用FM_process直到得到之后完成的结果，记下统计期间一次FM_process最多的SPI字节数
+static unsigned long statsMaxStepBytes;
+
+static void getPageStats(fm_stats_t *st)
+{
+    uint32_t t0;
+    unsigned long b;
+    int k;
+
+    CHECK(FM_getStats(st) == FLASH_OK, "stats");
+    t0 = FM_getTickMs();
+    for (k = 0; (k < 100000) && (st->pageStatsAgeMs > FM_getTickMs() - t0); k++)
+    {
+        b = simSpiBytes;
+        FM_process();
+        if (simSpiBytes - b > statsMaxStepBytes)
+        {
+            statsMaxStepBytes = simSpiBytes - b;
+        }
+        FM_tick1ms();
+        CHECK(FM_getStats(st) == FLASH_OK, "stats");
+    }
+    CHECK(st->pageStatsAgeMs != 0xffffffff, "page stats not counted");
+    CHECK(st->usedPages + st->freePages == st->totalSectors * 15u, "used %u free %u", st->usedPages, st->freePages);
+    // 没有有效page的扇区都算空闲，只有正在写入的扇区例外
+    CHECK(st->freePages + 15u >= st->freeSectors * 15u, "free %u freeSec %u", st->freePages, st->freeSectors);
+}
+
+static int runStats(void)
+{
+    fm_stats_t st;
+    int round, g;
+
+    sim_reset();
+    reboot("blank");
+    for (round = 0; round < 16; round++)
+    {
+        writeRound(round, 0);
+        getPageStats(&st);
+        printStats(&st);
+        verify("stats");
+    }
+    for (g = 0; g < 5; g++)
+    {
+        (void)FM_forceGarbageCollect();
+    }
+    getPageStats(&st);
+    printf("after gc: ");
+    printStats(&st);
+    verify("gc");
+    printf("erases=%lu eraseMs=%lu eraseMax=%lu\n",
+           (unsigned long)st.erases, (unsigned long)st.eraseTotalMs, (unsigned long)st.eraseMaxMs);
+    printf("page stats: max SPI bytes in one FM_process while counting: %lu\n", statsMaxStepBytes);
+    printf("stats fails=%d progPages=%lu\n", fails, simProgPages);
+    return fails ? 1 : 0;
+}
+
+// 找一个前6个槽位中的黑白图像帧page，翻转一个bit
+static long corruptFrame(int *slot)
+{
+    long a;
+    uint8_t b[248];
+
+    for (a = (long)SIM_FLASH_BYTES - 256; a >= 0; a -= 256)
+    {
+        int id = simFlash[a + 1] | (simFlash[a + 2] << 8);
+
+        if ((simFlash[a] != MAGIC_BW_IMAGE_DATA) || (simFlash[a + 3] != 248) || ((id >> 8) >= 6))
+        {
+            continue;
+        }
+        simFlash[a + 50] ^= 0x10;
+        // 只选当前图像引用的page
+        FM_setVerifyPolicy(FM_VERIFY_ALWAYS);
+        if (FM_readImage(MAGIC_BW_IMAGE_DATA, (uint8_t)(id >> 8), (uint8_t)(id & 0xff), b) != FLASH_OK)
+        {
+            FM_setVerifyPolicy(FM_VERIFY_ONCE);
+            *slot = id >> 8;
+            return a;
+        }
+        simFlash[a + 50] ^= 0x10;
+    }
+    FM_setVerifyPolicy(FM_VERIFY_ONCE);
+    return -1;
+}
+
+// 反复调用FM_process直到巡检又完成passes轮
+static void runScrubPasses(unsigned long passes)
+{
+    fm_stats_t st;
+    unsigned long p0;
+    long k;
+
+    FM_getStats(&st);
+    p0 = st.scrubPasses;
+    for (k = 0; (k < 4000000L) && (st.scrubPasses < p0 + passes); k++)
+    {
+        FM_process();
+        FM_tick1ms();
+        if ((k & 1023) == 0)
+        {
+            FM_getStats(&st);
+        }
+    }
+}
+
+/*
+ * 巡检：一个page的数据被破坏只搬走所在扇区的有效page，扇区照常重用；
+ * 扇区中有坏的存储单元时，重用后再次出错才标记为坏扇区，之后不再分配
+ */
+static int runScrub(void)
+{
+    fm_stats_t st;
+    long bad, sectorBase;
+    int i, round, slot = -1;
+    uint8_t b[248];
+
+    sim_reset();
+    reboot("blank");
+    for (i = 0; i < 6; i++)
+    {
+        writeImage(i, i & 1, i * 3 + 1);
+    }
+    for (i = 0; i < MAX_DATA_ENTRIES; i++)
+    {
+        writeKV(i, i);
+    }
+    for (i = 0; i < 6; i++)
+    {
+        writeImage(i, i & 1, i * 3 + 2);
+    }
+    pump();
+
+    bad = corruptFrame(&slot);
+    printf("corrupt page 0x%04lx slot %d\n", bad >> 8, slot);
+    if (bad < 0)
+    {
+        return 1;
+    }
+    sectorBase = bad & ~4095L;
+    imgHas[0][slot] = 0;
+
+    // 写入几轮，让出错的扇区离开最近的日志扇区，可以回收
+    runScrubPasses(1);
+    for (round = 0; round < 4; round++)
+    {
+        for (i = 0; i < 6; i++)
+        {
+            if (i != slot)
+            {
+                writeImage(i, i & 1, round * 5 + i + 100);
+            }
+        }
+    }
+    runScrubPasses(2);
+    FM_getStats(&st);
+    printf("single: crcErrors=%lu badSectors=%u mark=%02x page magic=%02x\n", (unsigned long)st.crcErrors,
+           st.badSectors, simFlash[sectorBase + 255], simFlash[bad]);
+    CHECK((st.crcErrors >= 1) && (st.badSectors == 0) && (simFlash[sectorBase + 255] != 0x5A), "single fault retired the sector");
+    CHECK(FM_readImage(MAGIC_BW_IMAGE_DATA, (uint8_t)slot, (uint8_t)(simFlash[bad + 1] & 0xff), b) != FLASH_OK, "lost frame read back");
+    verify("single");
+    verifyPlanes("single");
+
+    // 该扇区中的一个bit从此只能是0
+    simStuckAddr = bad + 50;
+    for (round = 0; (round < 400) && !fails; round++)
+    {
+        for (i = 0; i < 6; i++)
+        {
+            if (i != slot)
+            {
+                writeImage(i, i & 1, round * 7 + i + 200);
+            }
+        }
+        writeKV(round % MAX_DATA_ENTRIES, round);
+        runScrubPasses(1);
+        FM_getStats(&st);
+        if (st.badSectors != 0)
+        {
+            break;
+        }
+    }
+    // 出错的帧已无法恢复
+    for (i = 0; i < 6; i++)
+    {
+        imgHas[i & 1][i] = 0;
+    }
+    runScrubPasses(1);
+    FM_getStats(&st);
+    printf("stuck: rounds=%d crcErrors=%lu badSectors=%u mark=%02x\n", round, (unsigned long)st.crcErrors,
+           st.badSectors, simFlash[sectorBase + 255]);
+    CHECK((st.badSectors == 1) && (simFlash[sectorBase + 255] == 0x5A), "stuck sector not retired");
+    verify("stuck");
+    reboot("scrub-boot");
+
+    for (round = 0; round < 60; round++)
+    {
+        for (i = 0; i < 6; i++)
+        {
+            if (i != slot)
+            {
+                writeImage(i, i & 1, round * 5 + i + 1000);
+            }
+        }
+        writeKV(round % MAX_DATA_ENTRIES, round);
+        pump();
+    }
+    reboot("scrub-after");
+    printf("after: mark=%02x\n", simFlash[sectorBase + 255]);
+    CHECK(simFlash[sectorBase + 255] == 0x5A, "bad sector reused");
+    simStuckAddr = -1;
+    printf("scrub fails=%d\n", fails);
+    return fails ? 1 : 0;
+}
+
+// 后台擦除期间的读取应挂起擦除而不是等待
+static int runSuspend(void)
+{
+    int round, i, k, hits = 0, b0;
+    uint8_t b[248];
+
+    sim_reset();
+    reboot("blank");
+    for (round = 0; round < 30; round++)
+    {
+        for (i = 0; i < 8; i++)
+        {
+            writeImage(i, (round + i) & 1, round * 8 + i + 2);
+            writeKV(i, round + i);
+        }
+        for (k = 0; (k < 50) && !sim_busy(); k++)
+        {
+            FM_process();
+        }
+        if (!sim_busy())
+        {
+            continue;
+        }
+        b0 = sim_busy();
+        verify("susp");
+        verifyPlanes("susp");
+        (void)FM_readImage(MAGIC_BW_IMAGE_DATA, 0, 3, b);
+        if ((sim_busy() == b0) && sim_suspended())
+        {
+            hits++;
+        }
+        pump();
+    }
+    printf("susp reads served during erase: %d fails=%d\n", hits, fails);
+    reboot("susp-end");
+    printf("susp fails=%d\n", fails);
+    return fails ? 1 : 0;
+}
+
+// 空闲后进入深度掉电，下一次访问自动唤醒
+static int runPowerDown(void)
+{
+    fm_stats_t st;
+    int round, k, downs = 0;
+
+    sim_reset();
+    reboot("blank");
+    for (round = 0; round < 20; round++)
+    {
+        writeImage(round % 4, round & 1, round + 3);
+        writeKV(round % MAX_DATA_ENTRIES, round);
+        for (k = 0; (k < 2000) && !sim_pd(); k++)
+        {
+            FM_tick1ms();
+            FM_process();
+        }
+        if (sim_pd())
+        {
+            downs++;
+        }
+        verify("pd");
+        verifyPlanes("pd");
+    }
+    FM_getStats(&st);
+    printf("pd: downs=%d powerDowns=%lu\n", downs, (unsigned long)st.powerDowns);
+    CHECK((downs == 20) && (st.powerDowns >= 20), "pd");
+    printf("pd fails=%d\n", fails);
+    return fails ? 1 : 0;
+}
+
+// 校验策略：ONCE模式下已校验过的图像不再校验，ALWAYS模式下每次都校验
+static int runVerifyPolicy(void)
+{
+    fm_stats_t st;
+    uint8_t b[248];
+    long a;
+    int f, nc = 0;
+
+    sim_reset();
+    reboot("blank");
+    writeImage(0, 0, 5);
+    writeImage(1, 0, 8);
+    pump();
+    verifyPlanes("v1");
+    for (f = 0; f <= MAX_FRAME_NUM; f++)
+    {
+        CHECK(FM_readImage(MAGIC_BW_IMAGE_DATA, 1, (uint8_t)f, b) == FLASH_OK, "ri");
+    }
+    for (a = 0; a < (long)SIM_FLASH_BYTES; a += 256)
+    {
+        if (simFlash[a] == MAGIC_BW_IMAGE_DATA)
+        {
+            simFlash[a + 100] ^= 0x01;
+            nc++;
+        }
+    }
+    FM_getStats(&st);
+    printf("corrupted=%d crcErrors=%lu\n", nc, (unsigned long)st.crcErrors);
+
+    // 下面的读取预期会读到被破坏的数据，只统计结果
+    planeQuiet = 1;
+    readPlane(0, 0, "once");
+    for (f = 0; f <= MAX_FRAME_NUM; f++)
+    {
+        (void)FM_readImage(MAGIC_BW_IMAGE_DATA, 1, (uint8_t)f, b);
+    }
+    FM_getStats(&st);
+    printf("once: crcErrors=%lu planeBad=%d (expect 0, 1)\n", (unsigned long)st.crcErrors, planeBad);
+    CHECK((st.crcErrors == 0) && (planeBad == 1), "once");
+
+    CHECK(FM_setVerifyPolicy(FM_VERIFY_ALWAYS) == FLASH_OK, "pol");
+    readPlane(0, 0, "always");
+    for (f = 0; f <= MAX_FRAME_NUM; f++)
+    {
+        (void)FM_readImage(MAGIC_BW_IMAGE_DATA, 1, (uint8_t)f, b);
+    }
+    FM_getStats(&st);
+    printf("always: crcErrors=%lu planeBad=%d\n", (unsigned long)st.crcErrors, planeBad);
+    CHECK((st.crcErrors > 0) && (planeBad == 1), "always");
+    planeQuiet = 0;
+    // 槽位1的帧已被破坏，不再校验
+    imgHas[0][1] = 0;
+
+    CHECK(FM_setVerifyPolicy(FM_VERIFY_ONCE) == FLASH_OK, "pol");
+    CHECK(FM_setVerifyPolicy((fm_verify_policy_t)7) == FLASH_ERROR_INVALID_PARAM, "pol7");
+    writeImage(0, 0, 11);
+    pump();
+    verifyPlanes("rewrite");
+    FM_getStats(&st);
+    printf("rewrite fails=%d crcErrors=%lu\n", fails, (unsigned long)st.crcErrors);
+    return fails ? 1 : 0;
+}
+
+// 删除条目只写一条删除记录，上电后仍然是删除状态
+static int runDelete(void)
+{
+    uint8_t b[16];
+    flash_result_t r;
+    unsigned long pp;
+    int round, i;
+
+    sim_reset();
+    reboot("blank");
+    for (round = 0; round < 400; round++)
+    {
+        for (i = 0; i < MAX_DATA_ENTRIES; i++)
+        {
+            if (!modelHas[i] || (rand() % 3))
+            {
+                writeKV(i, round + i);
+                continue;
+            }
+            pp = simProgPages;
+            r = FM_deleteData((uint16_t)i);
+            CHECK(r == FLASH_OK, "del");
+            CHECK(simProgPages - pp <= 2, "del cost %lu", simProgPages - pp);
+            modelHas[i] = 0;
+            r = FM_readData(DATA_PAGE_MAGIC, (uint16_t)i, b, 16);
+            CHECK(r == FLASH_ERROR_NOT_FOUND, "del read r=%d", r);
+            pump();
+        }
+        if (round % 7 == 3)
+        {
+            writeImage(round % MAX_IMAGE_ENTRIES, round & 1, round);
+            reboot("del");
+            for (i = 0; i < MAX_DATA_ENTRIES; i++)
+            {
+                if (!modelHas[i])
+                {
+                    r = FM_readData(DATA_PAGE_MAGIC, (uint16_t)i, b, 16);
+                    CHECK(r == FLASH_ERROR_NOT_FOUND, "del after boot %d r=%d", i, r);
+                }
+            }
+        }
+        if (fails)
+        {
+            break;
+        }
+    }
+    printf("del fails=%d erases=%lu\n", fails, simErases);
+    return fails ? 1 : 0;
+}
+
+// n个图像交错上传：逐帧轮流写入n个槽位，最后依次写图像头
+static int runInterleaved(int n)
+{
+    int round, f, k, slot, red;
+    uint8_t b[248];
+    flash_result_t r;
+    unsigned long rd, hdrMax = 0, hdrScans = 0, hdrs = 0;
+
+    sim_reset();
+    reboot("blank");
+    for (round = 0; round < 200; round++)
+    {
+        for (f = 0; f <= MAX_FRAME_NUM; f++)
+        {
+            for (k = 0; k < n; k++)
+            {
+                slot = (round + k) % MAX_IMAGE_ENTRIES;
+                red = (round + k) & 1;
+                fill(b, round * 10 + k, f, red);
+                r = FM_writeData(red ? MAGIC_RED_IMAGE_DATA : MAGIC_BW_IMAGE_DATA, (uint16_t)(f | (slot << 8)), b, 248);
+                pump();
+                CHECK(r == FLASH_OK, "w");
+                if (((f & 7) == 0) && (k == 0))
+                {
+                    writeKV(f % MAX_DATA_ENTRIES, round + f);
+                }
+            }
+        }
+        for (k = 0; k < n; k++)
+        {
+            slot = (round + k) % MAX_IMAGE_ENTRIES;
+            red = (round + k) & 1;
+            rd = simReadBytes;
+            r = FM_writeImageHeader(red ? MAGIC_RED_IMAGE_HEADER : MAGIC_BW_IMAGE_HEADER, (uint8_t)slot, (uint8_t)red);
+            CHECK(r == FLASH_OK, "hdr round %d k %d r=%d", round, k, r);
+            // 帧地址已记录时只读槽位目录，退回扫描日志时要逐个读page头，超过一个page的量
+            rd = simReadBytes - rd;
+            hdrs++;
+            hdrMax = (rd > hdrMax) ? rd : hdrMax;
+            hdrScans += (rd > 256u);
+            if (r == FLASH_OK)
+            {
+                imgSeed[red][slot] = round * 10 + k;
+                imgHas[red][slot] = 1;
+            }
+            pump();
+        }
+        verify("inter");
+        if (round % 20 == 19)
+        {
+            reboot("inter-boot");
+        }
+        if (fails)
+        {
+            break;
+        }
+    }
+    printf("inter: %lu headers, %lu scanned the log, max %lu bytes read by one header\n", hdrs, hdrScans, hdrMax);
+    printf("inter fails=%d progPages=%lu\n", fails, simProgPages);
+    return fails ? 1 : 0;
+}
+
+/*
+ * 相同帧引用：同一槽位交替写入各帧内容不同的图像和各帧内容相同的图像（都不可压缩），
+ * 比较每个图像编程的page数（含图像头、槽位目录和回收复制）
+ */
+static int runDedup(void)
+{
+    int i, seed;
+    unsigned long p0, distinct = 0, same = 0;
+
+    sim_reset();
+    reboot("blank");
+    for (i = 0; i < 4 * MAX_IMAGE_ENTRIES; i++)
+    {
+        seed = 3 * i + 2;
+        p0 = simProgPages;
+        writeImage(i % MAX_IMAGE_ENTRIES, 0, seed);
+        distinct += simProgPages - p0;
+        p0 = simProgPages;
+        writeImage(i % MAX_IMAGE_ENTRIES, 1, SIM_SAME_FRAME_SEED + seed);
+        same += simProgPages - p0;
+    }
+    verify("dedup");
+    reboot("dedup");
+    printf("dedup: %d images x %d frames, pages per image: distinct frames %.1f, identical frames %.1f\n",
+           4 * MAX_IMAGE_ENTRIES, MAX_FRAME_NUM + 1, (double)distinct / (4 * MAX_IMAGE_ENTRIES),
+           (double)same / (4 * MAX_IMAGE_ENTRIES));
+    CHECK(same * 4 < distinct, "identical frames were not shared");
+    printf("dedup fails=%d\n", fails);
+    return fails ? 1 : 0;
+}
+
+static void printWear(int rewrites)
+{
+    fm_wear_info_t w;
+
+    CHECK(FM_getWearInfo(&w) == FLASH_OK, "wear info");
+    printf("rewrites=%d progPages=%lu erases=%lu min=%lu max=%lu known=%u hdrFails=%d\n", rewrites, simProgPages, simErases, (unsigned long)w.minEraseCount,
+           (unsigned long)w.maxEraseCount, w.knownSectors, hdrFails);
+}
+
+/*
+ * 磨损均衡：其他槽位和数据条目写入一次后不再改变，只反复重写槽位0，
+ * 最冷的扇区也要定期参与分配，最多和最少的擦除次数之差保持在FLASH_WEAR_LEVEL_DELTA附近
+ */
+static int runWear(int rewrites)
+{
+    fm_wear_info_t w;
+    int i, k;
+
+    sim_reset();
+    reboot("blank");
+    for (i = 0; i < MAX_DATA_ENTRIES; i++)
+    {
+        writeKV(i, i);
+    }
+    for (i = 1; i < MAX_IMAGE_ENTRIES; i++)
+    {
+        writeImage(i, 0, 3 * i + 2);
+        writeImage(i, 1, 3 * i + 302);
+    }
+    for (k = 0; (k < rewrites) && !fails; k++)
+    {
+        writeImage(0, 0, 3 * k + 602);
+        if ((k + 1) % ((rewrites >= 10) ? rewrites / 10 : 1) == 0)
+        {
+            printWear(k + 1);
+        }
+    }
+    reboot("wear");
+    CHECK(FM_getWearInfo(&w) == FLASH_OK, "wear info");
+    CHECK(w.maxEraseCount - w.minEraseCount <= 2u * FLASH_WEAR_LEVEL_DELTA, "spread %lu",
+          (unsigned long)(w.maxEraseCount - w.minEraseCount));
+    printf("wear fails=%d\n", fails);
+    return fails ? 1 : 0;
+}
+
+// 默认：所有槽位反复重写，每3轮上电一次
+static int runSoak(int rounds)
+{
+    int i, round;
+
+    sim_reset();
+    reboot("blank");
+    for (i = 0; i < MAX_DATA_ENTRIES; i++)
+    {
+        writeKV(i, i);
+    }
+    for (i = 0; i < MAX_IMAGE_ENTRIES; i++)
+    {
+        writeImage(i, 0, i + 1);
+        writeImage(i, 1, i + 50);
+    }
+    verify("written");
+    reboot("boot1");
+    for (round = 0; (round < rounds) && (fails <= 20); round++)
+    {
+        writeRound(round, 0);
+        verify("live");
+        if (round % 3 == 2)
+        {
+            reboot("round");
+        }
+    }
+    verify("end");
+    reboot("final");
+    printf("progPages=%lu erases=%lu fails=%d hdrFails=%d\n", simProgPages, simErases, fails, hdrFails);
+    return fails ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *mode = (argc > 1) ? argv[1] : "";
+
+    W25Q32_Init();
+    W25Q32_DetectSize();
+    if (!strcmp(mode, "crash"))
+    {
+        simTear = argc > 2;
+        return runCrash();
+    }
+    if (!strcmp(mode, "sweep") && (argc > 3))
+    {
+        simTear = 1;
+        sweepFrom = atoi(argv[2]);
+        sweepTo = atoi(argv[3]);
+        return runCrash();
+    }
+    if (!strcmp(mode, "mklegacy") && (argc > 2))
+    {
+        return runMkLegacy(argv[2]);
+    }
+    if (!strcmp(mode, "legacy") && (argc > 2))
+    {
+        return runLegacy(argv[2], argc > 3);
+    }
+    if (!strcmp(mode, "migcrash") && (argc > 2))
+    {
+        return runMigCrash(argv[2], argc > 3);
+    }
+    if (!strcmp(mode, "stats"))
+    {
+        return runStats();
+    }
+    if (!strcmp(mode, "scrub"))
+    {
+        return runScrub();
+    }
+    if (!strcmp(mode, "susp"))
+    {
+        return runSuspend();
+    }
+    if (!strcmp(mode, "pd"))
+    {
+        return runPowerDown();
+    }
+    if (!strcmp(mode, "vpol"))
+    {
+        return runVerifyPolicy();
+    }
+    if (!strcmp(mode, "del"))
+    {
+        return runDelete();
+    }
+    if (!strcmp(mode, "inter"))
+    {
+        return runInterleaved((argc > 2) ? atoi(argv[2]) : 3);
+    }
+    if (!strcmp(mode, "dedup"))
+    {
+        return runDedup();
+    }
+    if (!strcmp(mode, "wear"))
+    {
+        return runWear((argc > 2) ? atoi(argv[2]) : 20000);
+    }
+    simVerbose = argc > 2;
+    return runSoak((argc > 1) ? atoi(argv[1]) : 40);
+}
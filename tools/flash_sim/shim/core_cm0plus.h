@@ -0,0 +1,30 @@
+/* 主机编译用的CMSIS替身：只提供flash_manager.c及其依赖用到的符号 */
+#ifndef CORE_CM0PLUS_SHIM_H
+#define CORE_CM0PLUS_SHIM_H
+
+#include <stdint.h>
+
+#define __IO    volatile
+#define __I     volatile const
+#define __O     volatile
+#define __weak  __attribute__((weak))
+
+#define __NOP()         do {} while (0)
+#define __WFI()         do {} while (0)
+#define __disable_irq() do {} while (0)
+#define __enable_irq()  do {} while (0)
+
+static inline uint32_t __get_PRIMASK(void) { return 0u; }
+static inline void __set_PRIMASK(uint32_t x) { (void)x; }
+
+static inline void NVIC_ClearPendingIRQ(int x) { (void)x; }
+static inline void NVIC_SetPriority(int x, int y) { (void)x; (void)y; }
+static inline void NVIC_EnableIRQ(int x) { (void)x; }
+static inline void NVIC_DisableIRQ(int x) { (void)x; }
+
+typedef struct { volatile uint32_t CTRL, LOAD, VAL, CALIB; } SysTick_Type;
+extern SysTick_Type *SysTick;
+typedef struct { volatile uint32_t CPUID, ICSR, VTOR, AIRCR, SCR, CCR; } SCB_Type;
+extern SCB_Type *SCB;
+
+#endif // CORE_CM0PLUS_SHIM_H
@@ -0,0 +1,425 @@
+/*
+ * 主机上的W25Q32模型：在SPI字节层面模拟指令、BUSY、写使能、擦除挂起和深度掉电，
+ * 并提供flash_manager.c用到的GPIO/UART/延时桩函数。
+ *
+ * 断电：simCrashAt >= 0时，第simCrashAt次page program或擦除处longjmp到simCrashJmp。
+ * simTear不为0时，被打断的操作只随机完成一部分（page中部分bit被编程，扇区中部分字节被擦除）。
+ * simStuckAddr >= 0时，该字节的bit 4坏掉，编程和擦除后都是0。
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include "ddl.h"
+#include "gpio.h"
+#include "spi.h"
+#include "sim_flash.h"
+
+#define SIM_SIZE        (16u * 1024u * 1024u)
+#define SIM_CS_PORT     1
+#define SIM_CS_PIN      4
+
+uint8_t simFlash[SIM_SIZE];
+unsigned long simReadBytes, simProgPages, simErases, simOps, simSpiBytes;
+long simCrashAt = -1;
+jmp_buf simCrashJmp;
+int simVerbose = 0;
+int simTear = 0;
+long simStuckAddr = -1;
+
+static int csLow = 0, busy = 0, wel = 0, pd = 0, sus = 0;
+static uint8_t curCmd = 0;
+static int cmdLen = 0;
+static uint32_t addr = 0;
+static uint8_t pageBuf[256];
+static int pageTouched = 0;
+static uint32_t eraseLo = 1, eraseHi = 0;
+
+// 容量：环境变量SIM_MB（默认4），SIM_NOSFDP置位时SFDP读出全0xFF，驱动只能按JEDEC ID识别
+static uint32_t capacity = 4u << 20;
+static int capInit = 0, noSfdp = 0;
+static uint8_t capCode = 0x16;
+
+// 每次program/erase都是一个断电点；Flash操作期间1ms时基照常走
+static int crashNow(void)
+{
+    simOps++;
+    FM_tick1ms();
+    return (simCrashAt >= 0) && ((long)simOps >= simCrashAt);
+}
+
+static void crash(void)
+{
+    simCrashAt = -1;
+    longjmp(simCrashJmp, 1);
+}
+
+void sim_reset(void)
+{
+    memset(simFlash, 0xFF, SIM_SIZE);
+}
+
+void sim_powercycle(void)
+{
+    csLow = 0;
+    busy = 0;
+    wel = 0;
+    pd = 0;
+    sus = 0;
+}
+
+int sim_busy(void) { return busy; }
+int sim_suspended(void) { return sus; }
+int sim_pd(void) { return pd; }
+
+void UARTIF_uartPrintf(uint8_t n, const char *fmt, ...)
+{
+    va_list a;
+
+    (void)n;
+    if (!simVerbose)
+    {
+        return;
+    }
+    va_start(a, fmt);
+    vprintf(fmt, a);
+    va_end(a);
+}
+
+void delay1ms(uint32_t x) { (void)x; }
+void delay100us(uint32_t x) { (void)x; }
+en_result_t Gpio_InitIO(uint8_t a, uint8_t b, en_gpio_dir_t c) { (void)a; (void)b; (void)c; return Ok; }
+
+static void stuckBit(void)
+{
+    if (simStuckAddr >= 0)
+    {
+        simFlash[simStuckAddr] &= (uint8_t)~0x10u;
+    }
+}
+
+static void programPage(void)
+{
+    uint32_t base = addr & ~0xFFu;
+    int i;
+
+    if (crashNow())
+    {
+        if (simTear)
+        {
+            int k = rand() % 257;
+
+            for (i = 0; i < 256; i++)
+            {
+                if ((rand() % 256) < k)
+                {
+                    simFlash[base + i] &= (uint8_t)(pageBuf[i] | (rand() & 0xFF));
+                }
+            }
+        }
+        crash();
+    }
+    for (i = 0; i < 256; i++)
+    {
+        simFlash[base + i] &= pageBuf[i];
+    }
+    stuckBit();
+    simProgPages++;
+    busy = 3;
+    wel = 0;
+}
+
+static void eraseBlock(uint32_t size)
+{
+    uint32_t base = addr & ~(size - 1u);
+    uint32_t i;
+
+    if (crashNow())
+    {
+        if (simTear)
+        {
+            int k = rand() % 257;
+
+            for (i = 0; i < size; i++)
+            {
+                if ((rand() % 256) < k)
+                {
+                    simFlash[base + i] |= (uint8_t)(rand() & 0xFF);
+                }
+            }
+        }
+        crash();
+    }
+    memset(&simFlash[base], 0xFF, size);
+    stuckBit();
+    eraseLo = base;
+    eraseHi = base + size;
+    simErases++;
+    busy = (size == 4096u) ? 20 : 60;
+    wel = 0;
+}
+
+// 片选拉高时执行已收到的指令
+static void csRise(void)
+{
+    switch (curCmd)
+    {
+        case 0x02:
+            if ((cmdLen >= 4) && wel && !busy)
+            {
+                programPage();
+            }
+            break;
+        case 0x20:
+        case 0x52:
+        case 0xD8:
+            if ((cmdLen >= 4) && wel && !busy)
+            {
+                eraseBlock((curCmd == 0x20) ? 4096u : ((curCmd == 0x52) ? 32768u : 65536u));
+            }
+            break;
+        case 0xC7:
+            if (wel)
+            {
+                memset(simFlash, 0xFF, SIM_SIZE);
+                busy = 100;
+                wel = 0;
+            }
+            break;
+        case 0x06: wel = 1; break;
+        case 0x04: wel = 0; break;
+        case 0x75: if (busy) { sus = 1; } break;
+        case 0x7A: sus = 0; break;
+        case 0xB9: pd = 1; break;
+        case 0xAB: pd = 0; break;
+        default: break;
+    }
+}
+
+void Gpio_SetIO(uint8_t port, uint8_t pin, boolean_t st)
+{
+    if ((port == SIM_CS_PORT) && (pin == SIM_CS_PIN))
+    {
+        if (!st && !csLow)
+        {
+            csLow = 1;
+            cmdLen = 0;
+            curCmd = 0;
+            memset(pageBuf, 0xFF, sizeof(pageBuf));
+            pageTouched = 0;
+        }
+        else if (st && csLow)
+        {
+            csLow = 0;
+            csRise();
+        }
+    }
+}
+
+static int addressByte(uint8_t out)
+{
+    if (cmdLen < 4)
+    {
+        addr = (addr << 8) | out;
+        cmdLen++;
+        if (cmdLen == 4)
+        {
+            addr &= 0xFFFFFF;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// SFDP：头部在0，JEDEC基本参数表在0x30，容量（bit数 - 1）在表内偏移4
+static uint8_t sfdpByte(uint32_t a)
+{
+    static uint8_t sfdp[0x40];
+    static int init = 0;
+
+    if (!init)
+    {
+        uint32_t bits = capacity * 8u - 1u;
+
+        memset(sfdp, 0xFF, sizeof(sfdp));
+        memcpy(sfdp, "SFDP", 4);
+        sfdp[4] = 0; sfdp[5] = 1; sfdp[6] = 0;
+        sfdp[8] = 0; sfdp[9] = 0; sfdp[10] = 1; sfdp[11] = 9;
+        sfdp[12] = 0x30; sfdp[13] = 0; sfdp[14] = 0;
+        sfdp[0x34] = bits & 0xFF;
+        sfdp[0x35] = (bits >> 8) & 0xFF;
+        sfdp[0x36] = (bits >> 16) & 0xFF;
+        sfdp[0x37] = (bits >> 24) & 0xFF;
+        init = 1;
+    }
+    return ((a < sizeof(sfdp)) && !noSfdp) ? sfdp[a] : 0xFF;
+}
+
+static uint8_t xfer(uint8_t out)
+{
+    simSpiBytes++;
+    if (!capInit)
+    {
+        const char *e = getenv("SIM_MB");
+        uint32_t c;
+
+        capInit = 1;
+        if (e)
+        {
+            capacity = (uint32_t)atoi(e) << 20;
+        }
+        noSfdp = getenv("SIM_NOSFDP") != NULL;
+        for (c = capacity, capCode = 0; c > 1; c >>= 1)
+        {
+            capCode++;
+        }
+    }
+    if (!csLow)
+    {
+        return 0;
+    }
+    if (cmdLen == 0)
+    {
+        curCmd = out;
+        cmdLen = 1;
+        // 驱动的时序错误直接终止，便于定位
+        if (pd && (curCmd != 0xAB))
+        {
+            fprintf(stderr, "SIM: cmd 0x%02x while powered down\n", out);
+            abort();
+        }
+        if (busy && !sus && (curCmd != 0x05) && (curCmd != 0x35) && (curCmd != 0x75) && (curCmd != 0x15))
+        {
+            fprintf(stderr, "SIM: cmd 0x%02x while busy\n", out);
+            abort();
+        }
+        if (sus && ((curCmd == 0x02) || (curCmd == 0x20) || (curCmd == 0x52) || (curCmd == 0xD8)))
+        {
+            fprintf(stderr, "SIM: program/erase while suspended\n");
+            abort();
+        }
+        return 0xFF;
+    }
+
+    switch (curCmd)
+    {
+        case 0x05:
+        {
+            uint8_t s = (busy && !sus) ? 1 : 0;
+
+            if (wel)
+            {
+                s |= 2;
+            }
+            // 每次读状态过去一段时间
+            if (busy && !sus)
+            {
+                busy--;
+            }
+            return s;
+        }
+        case 0x35:
+            return sus ? 0x80 : 0x00;
+        case 0x15:
+            return 0x00;
+        case 0x9F:
+        {
+            uint8_t id[3] = { 0xEF, 0x40, 0x16 };
+            int i = cmdLen - 1;
+
+            id[2] = capCode;
+            cmdLen++;
+            return (i < 3) ? id[i] : 0xFF;
+        }
+        case 0x03:
+        case 0x0B:
+            if (addressByte(out))
+            {
+                return 0xFF;
+            }
+            if ((curCmd == 0x0B) && (cmdLen == 4))
+            {
+                cmdLen++;
+                return 0xFF;
+            }
+            if (sus && ((addr % capacity) >= eraseLo) && ((addr % capacity) < eraseHi))
+            {
+                fprintf(stderr, "SIM: read 0x%06x inside suspended erase\n", (unsigned)addr);
+                abort();
+            }
+            simReadBytes++;
+            return simFlash[addr++ % capacity];
+        case 0x02:
+            if (!addressByte(out))
+            {
+                pageBuf[(addr + pageTouched) & 0xFF] &= out;
+                pageTouched++;
+            }
+            return 0xFF;
+        case 0x20:
+        case 0x52:
+        case 0xD8:
+            (void)addressByte(out);
+            return 0xFF;
+        case 0x5A:
+            if (addressByte(out))
+            {
+                return 0xFF;
+            }
+            if (cmdLen == 4)
+            {
+                cmdLen++;
+                return 0xFF;
+            }
+            return sfdpByte(addr++);
+        case 0xAB:
+            cmdLen++;
+            return 0x15;
+        default:
+            return 0xFF;
+    }
+}
+
+en_result_t Spi_SendData(uint8_t d)
+{
+    (void)xfer(d);
+    return Ok;
+}
+
+uint8_t Spi_ReceiveData(void)
+{
+    return xfer(0x00);
+}
+
+void Spi_SetCS(boolean_t b)
+{
+    (void)b;
+}
+
+en_result_t Spi_TransferBuf(const uint8_t* tx, uint8_t* rx, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        uint8_t v = xfer(tx ? tx[i] : 0x00);
+
+        if (rx)
+        {
+            rx[i] = v;
+        }
+    }
+    return Ok;
+}
+
+en_result_t Spi_SendBuf(const uint8_t* b, uint32_t n)
+{
+    return Spi_TransferBuf(b, NULL, n);
+}
+
+en_result_t Spi_ReceiveBuf(uint8_t* b, uint32_t n)
+{
+    return Spi_TransferBuf(NULL, b, n);
+}
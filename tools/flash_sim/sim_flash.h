@@ -0,0 +1,23 @@
+#ifndef SIM_FLASH_H
+#define SIM_FLASH_H
+
+#include <stdint.h>
+#include <setjmp.h>
+
+extern uint8_t simFlash[];
+extern unsigned long simReadBytes, simProgPages, simErases, simOps, simSpiBytes;
+extern long simCrashAt;
+extern jmp_buf simCrashJmp;
+extern int simVerbose;
+extern int simTear;
+extern long simStuckAddr;
+
+void FM_tick1ms(void);
+
+void sim_reset(void);
+void sim_powercycle(void);
+int sim_busy(void);
+int sim_suspended(void);
+int sim_pd(void);
+
+#endif // SIM_FLASH_H